@@ -0,0 +1,240 @@
+#include "async.h"
+#include <stdio.h>
+#include <string.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "launch.h"
+#include "prebuilt.h"
+
+//one built program per shape and context, with the kernel of the variant select_variant picks for it
+struct async_program
+{
+	char options[512];
+	cl_context context;
+	cl_program program;
+	cl_kernel kernel;
+	unsigned last_use;
+};
+
+//what a product holds until its completion work ran
+struct async_state
+{
+	std::promise<bool> result;
+	cl_mem buffers[3];
+};
+
+//the cache and the arguments of its kernels, from clSetKernelArg until the launch is enqueued
+static std::mutex lock;
+static async_program programs[ASYNC_PROGRAM_CACHE];
+static unsigned use_counter = 0;
+
+//the work of the completion thread, started with the first callback
+struct completion_queue
+{
+	std::mutex lock;
+	std::condition_variable ready;
+	std::deque<std::function<void()>> work;
+	bool started;
+};
+
+//never destroyed: the thread still waits on it when the process exits, and destroying a condition variable
+//with a waiter blocks
+static completion_queue* completions = new completion_queue();
+
+static void completion_thread(void)
+{
+	for (;;)
+	{
+		std::unique_lock<std::mutex> guard(completions->lock);
+		completions->ready.wait(guard, []() { return !completions->work.empty(); });
+		std::function<void()> work = completions->work.front();
+		completions->work.pop_front();
+		guard.unlock();
+
+		work();
+	}
+}
+
+static void post(std::function<void()> work)
+{
+	std::lock_guard<std::mutex> guard(completions->lock);
+
+	if (!completions->started)
+	{
+		std::thread(completion_thread).detach();
+		completions->started = true;
+	}
+	completions->work.push_back(work);
+	completions->ready.notify_one();
+}
+
+//on the callback thread of the runtime: only hands the work over
+static void CL_CALLBACK on_complete(cl_event event, cl_int status, void* data)
+{
+	std::function<void(cl_int)>* work = (std::function<void(cl_int)>*)data;
+
+	post([work, status]() { (*work)(status); delete work; });
+}
+
+bool async_when_complete(cl_event event, std::function<void(cl_int)> work)
+{
+	std::function<void(cl_int)>* copy = new std::function<void(cl_int)>(work);
+	cl_int err = clSetEventCallback(event, CL_COMPLETE, on_complete, copy);
+
+	if (err != CL_SUCCESS)
+	{
+		printf("Unable to set an event callback. Error: %d\n", err);
+		delete copy;
+		return false;
+	}
+	return true;
+}
+
+//cached program and kernel for the build options of p, the least recently used entry is rebuilt on a miss
+static cl_kernel find_kernel(ocl_env* env, const kernel_params* p, const kernel_variant* v)
+{
+	char options[512];
+	int victim = 0;
+	cl_int err;
+
+	kernel_build_options(p, options, sizeof(options));
+	for (int e = 0; e < ASYNC_PROGRAM_CACHE; ++e)
+	{
+		if (programs[e].program != NULL && programs[e].context == env->context && strcmp(programs[e].options, options) == 0)
+		{
+			programs[e].last_use = ++use_counter;
+			return programs[e].kernel;
+		}
+		if (programs[e].last_use < programs[victim].last_use) victim = e;
+	}
+
+	async_program* entry = &programs[victim];
+	if (entry->kernel != NULL) clReleaseKernel(entry->kernel);
+	if (entry->program != NULL) clReleaseProgram(entry->program);
+	memset(entry, 0, sizeof(*entry));
+
+	entry->program = prebuilt_build(env, KernelSource, options, &err);
+	if (entry->program == NULL) return NULL;
+	entry->kernel = clCreateKernel(entry->program, v->entry, &err);
+	if (err != CL_SUCCESS)
+	{
+		printf("Error setting kernel %s. Error: %d\n", v->entry, err);
+		clReleaseProgram(entry->program);
+		entry->program = NULL;
+		return NULL;
+	}
+	snprintf(entry->options, sizeof(entry->options), "%s", options);
+	entry->context = env->context;
+	entry->last_use = ++use_counter;
+
+	return entry->kernel;
+}
+
+//rows x cols elements of a dense host matrix into the top left of a buffer whose rows are buf_cols apart
+static cl_int write_rect(cl_command_queue queue, cl_mem buf, int buf_cols, const void* src, int rows, int cols, size_t es,
+	const cl_event* deps, cl_uint num_deps)
+{
+	size_t origin[3] = { 0, 0, 0 }, region[3] = { cols * es, (size_t)rows, 1 };
+
+	return clEnqueueWriteBufferRect(queue, buf, CL_FALSE, origin, origin, region, buf_cols * es, 0, cols * es, 0,
+		src, num_deps, num_deps > 0 ? deps : NULL, NULL);
+}
+
+bool async_gemm(ocl_env* env, const kernel_params* p, double alpha, const void* A, const void* B, double beta, void* C,
+	const cl_event* deps, cl_uint num_deps, async_op* op)
+{
+	size_t es = dtype_size(p->dtype), global[MAX_WORK_DIM], local[MAX_WORK_DIM];
+	int m = p->m, n = p->n, k = p->k;
+	int a_rows = p->transa ? k : m, a_cols = p->transa ? m : k;
+	int b_rows = p->transb ? n : k, b_cols = p->transb ? k : n;
+	launch_plan plan;
+	cl_int err = CL_SUCCESS;
+
+	op->done = NULL;
+	std::lock_guard<std::mutex> guard(lock);
+	const kernel_variant* v = select_variant(p);
+	cl_kernel kernel = find_kernel(env, p, v);
+	if (kernel == NULL) return false;
+
+	//the shapes of the buffers the kernel expects
+	int buf_rows[3] = { a_rows, b_rows, m }, buf_cols[3] = { a_cols, b_cols, n };
+	if (v->padded)
+	{
+		buf_rows[0] = p->transa ? p->kp : p->mp; buf_cols[0] = p->transa ? p->mp : p->kp;
+		buf_rows[1] = p->transb ? p->np : p->kp; buf_cols[1] = p->transb ? p->kp : p->np;
+		buf_rows[2] = p->mp; buf_cols[2] = p->np;
+	}
+	async_state* state = new async_state();
+	for (int i = 0; i < 3 && err == CL_SUCCESS; ++i)
+		state->buffers[i] = clCreateBuffer(env->context, i < 2 ? CL_MEM_READ_ONLY : CL_MEM_READ_WRITE,
+			(size_t)buf_rows[i] * buf_cols[i] * es, NULL, &err);
+
+	// the queue is in order, so only the first command waits for deps and the others follow it
+	if (err == CL_SUCCESS && v->padded)
+	{
+		cl_uchar zero = 0;
+		err = clEnqueueFillBuffer(env->queue, state->buffers[0], &zero, sizeof(zero), 0, (size_t)buf_rows[0] * buf_cols[0] * es,
+			num_deps, num_deps > 0 ? deps : NULL, NULL);
+		if (err == CL_SUCCESS)
+			err = clEnqueueFillBuffer(env->queue, state->buffers[1], &zero, sizeof(zero), 0, (size_t)buf_rows[1] * buf_cols[1] * es, 0, NULL, NULL);
+		num_deps = 0;
+	}
+	if (err == CL_SUCCESS) err = write_rect(env->queue, state->buffers[0], buf_cols[0], A, a_rows, a_cols, es, deps, num_deps);
+	if (err == CL_SUCCESS) err = write_rect(env->queue, state->buffers[1], buf_cols[1], B, b_rows, b_cols, es, deps, num_deps);
+	if (err == CL_SUCCESS && beta != 0) err = write_rect(env->queue, state->buffers[2], buf_cols[2], C, m, n, es, deps, num_deps);
+
+	if (err == CL_SUCCESS)
+	{
+		clSetKernelArg(kernel, 0, sizeof(cl_mem), &state->buffers[0]);
+		clSetKernelArg(kernel, 1, sizeof(cl_mem), &state->buffers[1]);
+		clSetKernelArg(kernel, 2, sizeof(cl_mem), &state->buffers[2]);
+		kernel_set_scalar(kernel, 3, p, alpha);
+		kernel_set_scalar(kernel, 4, p, beta);
+		if (v->local_arg) clSetKernelArg(kernel, 5, v->local_mem(p), NULL);
+		v->geometry(p, global, local);
+		if (!launch_plan_init(env, kernel, v->dim, global, local, &plan)) err = CL_INVALID_WORK_GROUP_SIZE;
+	}
+	if (err == CL_SUCCESS)
+		err = clEnqueueNDRangeKernel(env->queue, kernel, v->dim, NULL, plan.global, plan.local[0] ? plan.local : NULL, 0, NULL, NULL);
+	if (err == CL_SUCCESS)
+	{
+		size_t origin[3] = { 0, 0, 0 }, region[3] = { n * es, (size_t)m, 1 };
+		err = clEnqueueReadBufferRect(env->queue, state->buffers[2], CL_FALSE, origin, origin, region, buf_cols[2] * es, 0,
+			n * es, 0, C, 0, NULL, &op->done);
+	}
+
+	// the commands that did get enqueued still use the buffers, an error is the one place that waits for them
+	if (err == CL_SUCCESS) err = clFlush(env->queue);
+	if (err == CL_SUCCESS)
+	{
+		op->result = state->result.get_future();
+		if (async_when_complete(op->done, [state](cl_int status)
+			{
+				for (int i = 0; i < 3; ++i) clReleaseMemObject(state->buffers[i]);
+				state->result.set_value(status == CL_COMPLETE);
+				delete state;
+			}))
+			return true;
+		err = CL_INVALID_EVENT;
+	}
+
+	printf("Unable to enqueue the product. Error: %d\n", err);
+	clFinish(env->queue);
+	for (int i = 0; i < 3; ++i)
+		if (state->buffers[i] != NULL) clReleaseMemObject(state->buffers[i]);
+	if (op->done != NULL) clReleaseEvent(op->done);
+	op->done = NULL;
+	op->result = std::future<bool>();
+	delete state;
+	return false;
+}
+
+void async_release(async_op* op)
+{
+	if (op->done != NULL) clReleaseEvent(op->done);
+	op->done = NULL;
+}
@@ -0,0 +1,72 @@
+// asynchronous products: async_gemm enqueues the uploads, the kernel and the download without waiting for them and
+// hands back a std::future that becomes ready from the completion callback of the download (clSetEventCallback),
+// so the host thread is free until it needs C, and products that depend on each other wait for each other's events
+// on the device instead of on the host
+// the completion work (releasing buffers, setting futures, resuming coroutines) runs on one completion thread of
+// this module, not on the callback thread of the runtime, where most OpenCL calls are not allowed
+// with C++20 coroutines, co_await async_event{ op.done } resumes the coroutine on that thread once C is on the host,
+// a coroutine must not block there on a future of another product, its completion runs on the same thread
+
+#pragma once
+
+#include "CL/cl.h"
+
+#include <functional>
+#include <future>
+
+#include "kernels.h"
+#include "ocl.h"
+
+#define ASYNC_PROGRAM_CACHE 8 //built programs kept, one per shape
+
+//a product in flight, A, B and C are read and written in place until it is done, so they must stay alive
+struct async_op
+{
+	cl_event done;              //download of C, later products can wait for it, released by async_release
+	std::future<bool> result;   //true once C is on the host, false if a command failed
+};
+
+//C = alpha * op(A) * op(B) + beta * C for host matrices as stored (A k x m for transa, B n x k for transb) in the
+//element type of p, its commands wait for the num_deps events of deps first (e.g. done of the product that writes A)
+//returns false with the reason printed if it could not be enqueued, nothing is left in flight then
+bool async_gemm(ocl_env* env, const kernel_params* p, double alpha, const void* A, const void* B, double beta, void* C,
+	const cl_event* deps, cl_uint num_deps, async_op* op);
+
+//releases the event of a product, the product itself goes on if it is still running
+void async_release(async_op* op);
+
+//runs work(status) on the completion thread once event completes, status is CL_COMPLETE or the error of the command
+//returns false if the callback cannot be set, work never runs then
+bool async_when_complete(cl_event event, std::function<void(cl_int)> work);
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+
+//co_await async_event{ e } gives CL_COMPLETE or the error of the command once e completed
+struct async_event
+{
+	cl_event event;
+	cl_int status = CL_COMPLETE;
+
+	bool await_ready()
+	{
+		cl_int now;
+		if (clGetEventInfo(event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(now), &now, NULL) != CL_SUCCESS) now = CL_INVALID_EVENT;
+		status = now;
+		return now <= CL_COMPLETE;
+	}
+
+	//false resumes right away, when the callback cannot be set
+	bool await_suspend(std::coroutine_handle<> handle)
+	{
+		if (async_when_complete(event, [this, handle](cl_int s) { status = s; handle.resume(); })) return true;
+		status = CL_INVALID_EVENT;
+		return false;
+	}
+
+	cl_int await_resume()
+	{
+		return status;
+	}
+};
+#endif
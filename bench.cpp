@@ -0,0 +1,245 @@
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#define make_dir(path) _mkdir(path)
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#define make_dir(path) mkdir(path, 0755)
+#endif
+
+static void sanitize(char* s)
+{
+	for (; *s; ++s)
+		if (!((*s >= 'a' && *s <= 'z') || (*s >= 'A' && *s <= 'Z') || (*s >= '0' && *s <= '9') || *s == '.' || *s == '-'))
+			*s = '-';
+}
+
+void bench_fingerprint(cl_device_id device, char* fingerprint, size_t len)
+{
+	char host[256] = "unknown-host", device_name[256] = "unknown-device", driver[256] = "unknown-driver";
+
+#ifdef _WIN32
+	const char* computer = getenv("COMPUTERNAME");
+	if (computer != NULL) snprintf(host, sizeof(host), "%s", computer);
+#else
+	gethostname(host, sizeof(host) - 1);
+#endif
+	if (device != NULL)
+	{
+		clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(device_name), device_name, NULL);
+		clGetDeviceInfo(device, CL_DRIVER_VERSION, sizeof(driver), driver, NULL);
+	}
+
+	snprintf(fingerprint, len, "%s_%s_%s", host, device_name, driver);
+	sanitize(fingerprint);
+}
+
+static void baseline_path(char* path, size_t len, const char* dir, const char* fingerprint, const char* name)
+{
+	snprintf(path, len, "%s/%s__%s.txt", dir, fingerprint, name);
+}
+
+bool bench_save_baseline(const char* dir, const char* fingerprint, const char* name, const double* samples, int n)
+{
+	char path[1024];
+	FILE* f;
+
+	make_dir(dir); //fails harmlessly if it already exists
+	baseline_path(path, sizeof(path), dir, fingerprint, name);
+	f = fopen(path, "w");
+	if (f == NULL)
+	{
+		printf("Unable to write baseline %s\n", path);
+		return false;
+	}
+
+	if (n > BENCH_MAX_SAMPLES) n = BENCH_MAX_SAMPLES;
+	fprintf(f, "%d\n", n);
+	for (int i = 0; i < n; ++i)
+		fprintf(f, "%.6f\n", samples[i]);
+	fclose(f);
+
+	printf("Saved baseline %s (%d samples)\n", path, n);
+	return true;
+}
+
+int bench_load_baseline(const char* dir, const char* fingerprint, const char* name, double* samples, int max)
+{
+	char path[1024];
+	FILE* f;
+	int n = 0;
+
+	baseline_path(path, sizeof(path), dir, fingerprint, name);
+	f = fopen(path, "r");
+	if (f == NULL) return -1;
+
+	if (fscanf(f, "%d", &n) != 1) n = 0;
+	if (n > max) n = max;
+	for (int i = 0; i < n; ++i)
+		if (fscanf(f, "%lf", &samples[i]) != 1)
+		{
+			n = i; //truncated file, use what we have
+			break;
+		}
+	fclose(f);
+
+	return n;
+}
+
+static int compare_double(const void* a, const void* b)
+{
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+double median(const double* samples, int n)
+{
+	double sorted[BENCH_MAX_SAMPLES];
+
+	if (n <= 0) return 0.0;
+	if (n > BENCH_MAX_SAMPLES) n = BENCH_MAX_SAMPLES;
+	memcpy(sorted, samples, n * sizeof(double));
+	qsort(sorted, n, sizeof(double), compare_double);
+
+	return (n % 2) ? sorted[n / 2] : 0.5 * (sorted[n / 2 - 1] + sorted[n / 2]);
+}
+
+//P(U >= u) for the exact null distribution of U, counted as the number of orderings of
+//nc "cur" and nb "base" values in which "cur" beats "base" exactly u times
+//N(i, j, u) = N(i - 1, j, u - j) + N(i, j - 1, u) where the largest value is either from cur (beats all j) or not
+static double exact_upper_tail(int nc, int nb, double u)
+{
+	int umax = nc * nb;
+	double* prev = (double*)calloc((size_t)(nb + 1) * (umax + 1), sizeof(double));
+	double* cur = (double*)calloc((size_t)(nb + 1) * (umax + 1), sizeof(double));
+	double tail = 0.0, total = 0.0;
+
+	for (int j = 0; j <= nb; ++j) prev[j * (umax + 1)] = 1.0; //i = 0: only one ordering with U = 0
+	for (int i = 1; i <= nc; ++i)
+	{
+		memset(cur, 0, (size_t)(nb + 1) * (umax + 1) * sizeof(double));
+		cur[0] = 1.0; //j = 0
+		for (int j = 1; j <= nb; ++j)
+			for (int v = 0; v <= i * j; ++v)
+				cur[j * (umax + 1) + v] = (v >= j ? prev[j * (umax + 1) + v - j] : 0.0) + cur[(j - 1) * (umax + 1) + v];
+		double* swap = prev; prev = cur; cur = swap;
+	}
+
+	for (int v = 0; v <= umax; ++v)
+	{
+		total += prev[nb * (umax + 1) + v];
+		if (v >= u) tail += prev[nb * (umax + 1) + v];
+	}
+
+	free(prev);
+	free(cur);
+	return tail / total;
+}
+
+double mann_whitney_p(const double* base, int nb, const double* cur, int nc)
+{
+	double u = 0.0;
+	bool ties = false;
+
+	if (nb <= 0 || nc <= 0) return 1.0;
+
+	for (int i = 0; i < nc; ++i)
+		for (int j = 0; j < nb; ++j)
+		{
+			if (cur[i] > base[j]) u += 1.0;
+			else if (cur[i] == base[j]) { u += 0.5; ties = true; }
+		}
+
+	if (!ties && nb <= BENCH_MAX_SAMPLES && nc <= BENCH_MAX_SAMPLES)
+		return exact_upper_tail(nc, nb, u);
+
+	//normal approximation, the variance shrinks by sum(t^3 - t) over groups of tied values
+	int n = nb + nc;
+	double* all = (double*)malloc(n * sizeof(double));
+	double tie_sum = 0.0;
+	memcpy(all, base, nb * sizeof(double));
+	memcpy(all + nb, cur, nc * sizeof(double));
+	qsort(all, n, sizeof(double), compare_double);
+	for (int i = 0; i < n;)
+	{
+		int t = 1;
+		while (i + t < n && all[i + t] == all[i]) ++t;
+		tie_sum += (double)t * t * t - t;
+		i += t;
+	}
+	free(all);
+
+	double mean = 0.5 * nb * nc;
+	double var = nb * nc / 12.0 * ((n + 1) - tie_sum / ((double)n * (n - 1)));
+	if (var <= 0.0) return 1.0; //all values identical
+
+	double z = (u - mean - 0.5) / sqrt(var); //continuity correction
+	return 0.5 * erfc(z / sqrt(2.0));
+}
+
+bool bench_check(const char* dir, const char* fingerprint, const char* name, const double* samples, int n)
+{
+	double base[BENCH_MAX_SAMPLES];
+	int nb = bench_load_baseline(dir, fingerprint, name, base, BENCH_MAX_SAMPLES);
+
+	if (nb <= 0)
+	{
+		printf("No baseline for %s on %s, nothing to compare\n", name, fingerprint);
+		return false;
+	}
+
+	double base_median = median(base, nb), cur_median = median(samples, n);
+	double change = (cur_median - base_median) / base_median;
+	double p = mann_whitney_p(base, nb, samples, n);
+	bool regression = p < BENCH_ALPHA && change > BENCH_THRESHOLD;
+
+	printf("%s: baseline median %.3f ms, current median %.3f ms (%+.1f%%), p = %.4f -> %s\n",
+		name, base_median, cur_median, 100.0 * change, p, regression ? "REGRESSION" : "ok");
+
+	return regression;
+}
+
+cl_int bench_kernel(cl_command_queue queue, cl_kernel kernel, cl_uint dim, const size_t* global, const size_t* local, double* samples, int reps)
+{
+	cl_event event;
+	cl_ulong start, end;
+	cl_int err;
+
+	for (int rep = 0; rep < reps; ++rep)
+	{
+		err = clEnqueueNDRangeKernel(queue, kernel, dim, NULL, global, local, 0, NULL, &event);
+		if (err != CL_SUCCESS)
+		{
+			printf("Unable to launch kernel. Error: %d\n", err);
+			return err;
+		}
+		clFinish(queue);
+
+		clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL);
+		clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL);
+		samples[rep] = (end - start) / 1000000.0;
+		clReleaseEvent(event);
+	}
+
+	return CL_SUCCESS;
+}
+
+bool bench_baseline(const char* dir, cl_device_id device, const char* name, const double* samples, int n, bool save, bool compare)
+{
+	char fingerprint[768];
+	bool regression = false;
+
+	if (!save && !compare) return false;
+
+	bench_fingerprint(device, fingerprint, sizeof(fingerprint));
+	if (compare) regression = bench_check(dir, fingerprint, name, samples, n);
+	if (save) bench_save_baseline(dir, fingerprint, name, samples, n);
+
+	return regression;
+}
@@ -0,0 +1,39 @@
+// benchmark helpers: repeated timings are stored as baselines per host/device fingerprint
+// and later runs are compared against them with a one-sided Mann-Whitney U test
+
+#pragma once
+
+#include "CL/cl.h"
+#include <stddef.h>
+
+#define BENCH_REPS          10          //number of timed kernel launches per run, these are the samples for the test
+#define BENCH_MAX_SAMPLES   64          //upper bound of samples stored per baseline
+#define BENCH_ALPHA         0.05        //significance level, smaller p values count as significant
+#define BENCH_THRESHOLD     0.05        //relative slowdown of the median that we accept as noise
+#define BENCH_DIR           "baselines" //default directory of the baseline store
+
+//writes "<host>_<device>_<driver>" into fingerprint, with everything but [A-Za-z0-9.-] replaced by '-'
+void bench_fingerprint(cl_device_id device, char* fingerprint, size_t len);
+
+//stores samples as baseline <dir>/<fingerprint>__<name>.txt, overwriting an older one
+bool bench_save_baseline(const char* dir, const char* fingerprint, const char* name, const double* samples, int n);
+
+//loads at most max samples of a baseline, returns the number of samples or -1 if there is none
+int bench_load_baseline(const char* dir, const char* fingerprint, const char* name, double* samples, int max);
+
+//one-sided p value for "cur is stochastically larger (slower) than base"
+//exact distribution when there are no ties, normal approximation with tie correction otherwise
+double mann_whitney_p(const double* base, int nb, const double* cur, int nc);
+
+double median(const double* samples, int n);
+
+//launches kernel reps times and stores the profiled execution times in ms, the queue needs CL_QUEUE_PROFILING_ENABLE
+cl_int bench_kernel(cl_command_queue queue, cl_kernel kernel, cl_uint dim, const size_t* global, const size_t* local, double* samples, int reps);
+
+//compares samples to the stored baseline and prints the verdict
+//returns true only for a significant slowdown beyond BENCH_THRESHOLD
+bool bench_check(const char* dir, const char* fingerprint, const char* name, const double* samples, int n);
+
+//what main does with the samples of one benchmark: compare against and/or store the baseline of this host/device
+//returns true on regression
+bool bench_baseline(const char* dir, cl_device_id device, const char* name, const double* samples, int n, bool save, bool compare);
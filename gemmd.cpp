@@ -0,0 +1,752 @@
+// compile in Linux with gcc:
+// g++ -O2 gemmd.cpp service.cpp ocl.cpp kernels.cpp launch.cpp ooc.cpp host_gemm.cpp precision.cpp prebuilt.cpp prebuilt_data.cpp -o gemmd -lOpenCL -pthread -lrt
+// GEMM daemon: keeps the OpenCL context, the built programs and the device buffers of earlier jobs and takes jobs
+// over a Unix domain socket (--socket <path>, default SERVICE_SOCKET), the operands stay in the POSIX shared memory
+// the client names in its request, so only the request and the reply go over the socket and C is written in place
+// (service.h has the protocol and the client side, the driver's --daemon <socket> is a client)
+// one thread per connection maps the shared memory and waits, one device thread runs the jobs in the order they
+// came in, a job the device cannot take (no device, no fp64, failed build) runs on the host backend instead
+// small jobs of the same shape, element type, transposes, alpha and beta are coalesced into one launch of
+// matmult_batched: the device thread waits up to --window <us> (default GEMMD_WINDOW_US) after the arrival of the
+// oldest of them for more, unless other jobs are waiting, and takes at most --max-batch <n> (default GEMMD_MAX_BATCH)
+// jobs come in two priority classes with a queue each, high before low, and a job larger than what the device does
+// in --slice <ms> (default GEMMD_SLICE_MS, measured on earlier jobs) runs in slices of rows of C with a job of the
+// queue of its class between two slices, so neither a large high priority job nor a large bulk job holds up a small
+// high priority one for longer than a slice (OpenCL 1.2 cannot preempt a kernel, the slices bound the wait instead)
+// a SERVICE_STATS request returns the latency percentiles of both classes over their last GEMMD_LATENCY_SAMPLES jobs
+// --vec, --tile, --wpt, --no-pad and --stage-bt are those of the driver, --host keeps every job on the host
+
+#include "CL/cl.h"
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "host_gemm.h"
+#include "kernels.h"
+#include "launch.h"
+#include "ocl.h"
+#include "ooc.h"
+#include "prebuilt.h"
+#include "service.h"
+
+#define GEMMD_PROGRAM_CACHE     16                          //built programs kept, the sizes are build options so every shape needs one
+#define GEMMD_WINDOW_US         200                         //longest wait for more jobs to coalesce with
+#define GEMMD_MAX_BATCH         64                          //jobs per batched launch at most
+#define GEMMD_BATCH_MAX_FLOPS   (2.0 * 256 * 256 * 256)     //larger jobs fill the device on their own and run alone
+#define GEMMD_SLICE_MS          5                           //target duration of a slice of a large job
+#define GEMMD_SLICE_FLOPS       (2.0 * 1024 * 1024 * 1024)  //work of a slice until the device has been measured
+#define GEMMD_MIN_SLICE         64                          //rows of C per slice at least, slices have power of two rows
+#define GEMMD_LATENCY_SAMPLES   4096                        //latencies kept per priority class for the percentiles
+
+//one built program per shape, with the kernel of the variant select_variant picks for it and matmult_batched,
+//created when a batch of the shape comes first
+struct program_entry
+{
+	char options[512];
+	cl_program program;
+	cl_kernel kernel, batched;
+	unsigned last_use;
+};
+
+//grow-only device buffer
+struct device_buffer
+{
+	cl_mem mem;
+	size_t size;
+};
+
+//a request with its mapped operands, owned by the connection thread, which waits until done
+struct daemon_job
+{
+	service_request request;
+	service_reply reply;
+	char* base;                 //shared memory of the request, mapped by the connection thread
+	double arrival;             //ms
+	double started;             //of the first slice, 0 before
+	int slice;                  //rows of C per slice of a large job, 0 for a job that runs whole
+	int next_row;               //rows of C the slices have done so far
+	bool device;                //every slice so far ran on the device
+	bool done;
+};
+
+//pending jobs of one priority class, the large one being sliced and the latencies of the last jobs
+struct job_class
+{
+	std::deque<daemon_job*> queue;
+	daemon_job* sliced;
+	bool queue_turn;            //the next step of the class is a job of the queue rather than a slice
+	double latencies[GEMMD_LATENCY_SAMPLES]; //ms, a ring indexed by jobs
+	uint64_t jobs;
+};
+
+//build parameters of every job
+static int vec = 4, tile = 16, wpt = 4, pad = 1, stage_bt = 0;
+
+//everything of the device is only touched by the device thread
+static bool available = false;
+static bool fp64 = false;       //the device has cl_khr_fp64, double jobs go to the host without it
+static ocl_env env;
+static program_entry programs[GEMMD_PROGRAM_CACHE];
+static unsigned use_counter = 0;
+static device_buffer buf_a, buf_b, buf_c, buf_offsets;
+static bool built;              //find_program built a program since the flag was cleared
+static double device_rate = 0;  //flops per ms of the device, 0 until measured
+
+//coalescing
+static double window_ms = GEMMD_WINDOW_US / 1000.0;
+static int max_batch = GEMMD_MAX_BATCH;
+static double slice_ms = GEMMD_SLICE_MS;
+
+//the queues of the device thread, the latencies and the flags of the jobs are guarded by queue_lock
+static std::mutex queue_lock;
+static std::condition_variable queue_ready, job_done;
+static job_class classes[NUM_SERVICE_PRIORITIES];
+
+static const char* socket_path = SERVICE_SOCKET;
+
+static double now_ms(void)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//cached program and kernel for the build options of p, the least recently used entry is rebuilt on a miss
+static program_entry* find_program(const kernel_params* p, const kernel_variant* v)
+{
+	char options[512];
+	int victim = 0;
+	cl_int err;
+
+	kernel_build_options(p, options, sizeof(options));
+	for (int e = 0; e < GEMMD_PROGRAM_CACHE; ++e)
+	{
+		if (programs[e].program != NULL && strcmp(programs[e].options, options) == 0)
+		{
+			programs[e].last_use = ++use_counter;
+			return &programs[e];
+		}
+		if (programs[e].last_use < programs[victim].last_use) victim = e;
+	}
+
+	program_entry* entry = &programs[victim];
+	if (entry->kernel != NULL) clReleaseKernel(entry->kernel);
+	if (entry->batched != NULL) clReleaseKernel(entry->batched);
+	if (entry->program != NULL) clReleaseProgram(entry->program);
+	memset(entry, 0, sizeof(*entry));
+
+	built = true;
+	entry->program = prebuilt_build(&env, KernelSource, options, &err);
+	if (entry->program == NULL) return NULL;
+	entry->kernel = clCreateKernel(entry->program, v->entry, &err);
+	if (err != CL_SUCCESS)
+	{
+		printf("Error setting kernel %s. Error: %d\n", v->entry, err);
+		clReleaseProgram(entry->program);
+		entry->program = NULL;
+		return NULL;
+	}
+	snprintf(entry->options, sizeof(entry->options), "%s", options);
+	entry->last_use = ++use_counter;
+
+	return entry;
+}
+
+static bool reserve(device_buffer* buf, size_t size, cl_mem_flags flags)
+{
+	cl_int err;
+
+	if (buf->size >= size) return true;
+	if (buf->mem != NULL) clReleaseMemObject(buf->mem);
+	buf->mem = clCreateBuffer(env.context, flags, size, NULL, &err);
+	buf->size = buf->mem != NULL ? size : 0;
+	if (err != CL_SUCCESS)
+	{
+		printf("Unable to create buffer of %zu bytes. Error: %d\n", size, err);
+		return false;
+	}
+	return true;
+}
+
+//copies a rows x cols matrix whose rows are ld elements apart into a buffer whose rows are buf_cols elements apart
+static cl_int write_rect(cl_mem buf, int buf_cols, const void* src, int ld, int rows, int cols, size_t es)
+{
+	size_t origin[3] = { 0, 0, 0 }, region[3] = { cols * es, (size_t)rows, 1 };
+	return clEnqueueWriteBufferRect(env.queue, buf, CL_FALSE, origin, origin, region, buf_cols * es, 0, ld * es, 0,
+		src, 0, NULL, NULL);
+}
+
+static cl_int read_rect(cl_mem buf, int buf_cols, void* dst, int ld, int rows, int cols, size_t es)
+{
+	size_t origin[3] = { 0, 0, 0 }, region[3] = { cols * es, (size_t)rows, 1 };
+	return clEnqueueReadBufferRect(env.queue, buf, CL_TRUE, origin, origin, region, buf_cols * es, 0, ld * es, 0,
+		dst, 0, NULL, NULL);
+}
+
+//the product of p on the device, as the library does it, false leaves the job to the host backend unless lost is set:
+//an out-of-core product failed after it wrote blocks of C, and the job cannot run again on it
+static bool device_gemm(const kernel_params* p, double alpha, const void* A, int lda, const void* B, int ldb, double beta,
+	void* C, int ldc, bool* lost)
+{
+	size_t es = dtype_size(p->dtype), global[MAX_WORK_DIM], local[MAX_WORK_DIM];
+	int m = p->m, n = p->n, k = p->k;
+	int a_rows = p->transa ? k : m, a_cols = p->transa ? m : k;
+	int b_rows = p->transb ? n : k, b_cols = p->transb ? k : n;
+	launch_plan plan;
+	cl_int err;
+
+	if (!available || (p->dtype == DTYPE_DOUBLE && !fp64)) return false;
+
+	ooc_blocks blocks;
+	if (!ooc_plan(&env, p, 0, &blocks)) return false;
+	if (blocks.count_m * blocks.count_n * blocks.count_k > 1)
+	{
+		ooc_stats stats;
+		bool ok = ooc_gemm(&env, p, 0, alpha, A, lda, B, ldb, beta, C, ldc, &stats);
+		*lost = !ok && stats.c_written && beta != 0;
+		return ok;
+	}
+
+	const kernel_variant* v = select_variant(p);
+	program_entry* entry = find_program(p, v);
+	if (entry == NULL) return false;
+	cl_kernel kernel = entry->kernel;
+
+	int abuf_rows = a_rows, abuf_cols = a_cols, bbuf_rows = b_rows, bbuf_cols = b_cols, cbuf_rows = m, cbuf_cols = n;
+	if (v->padded)
+	{
+		abuf_rows = p->transa ? p->kp : p->mp; abuf_cols = p->transa ? p->mp : p->kp;
+		bbuf_rows = p->transb ? p->np : p->kp; bbuf_cols = p->transb ? p->kp : p->np;
+		cbuf_rows = p->mp; cbuf_cols = p->np;
+	}
+	size_t a_size = (size_t)abuf_rows * abuf_cols * es, b_size = (size_t)bbuf_rows * bbuf_cols * es;
+	size_t c_size = (size_t)cbuf_rows * cbuf_cols * es;
+	if (!reserve(&buf_a, a_size, CL_MEM_READ_ONLY) || !reserve(&buf_b, b_size, CL_MEM_READ_ONLY) ||
+		!reserve(&buf_c, c_size, CL_MEM_READ_WRITE))
+		return false;
+
+	//the padding has to be zero, the buffers may hold a larger product of an earlier job
+	if (v->padded)
+	{
+		cl_uchar zero = 0;
+		clEnqueueFillBuffer(env.queue, buf_a.mem, &zero, sizeof(zero), 0, a_size, 0, NULL, NULL);
+		clEnqueueFillBuffer(env.queue, buf_b.mem, &zero, sizeof(zero), 0, b_size, 0, NULL, NULL);
+	}
+	err = write_rect(buf_a.mem, abuf_cols, A, lda, a_rows, a_cols, es);
+	if (err == CL_SUCCESS) err = write_rect(buf_b.mem, bbuf_cols, B, ldb, b_rows, b_cols, es);
+	if (err == CL_SUCCESS && beta != 0) err = write_rect(buf_c.mem, cbuf_cols, C, ldc, m, n, es);
+	if (err != CL_SUCCESS) printf("Unable to write operands. Error: %d\n", err);
+
+	if (err == CL_SUCCESS)
+	{
+		clSetKernelArg(kernel, 0, sizeof(cl_mem), &buf_a.mem);
+		clSetKernelArg(kernel, 1, sizeof(cl_mem), &buf_b.mem);
+		clSetKernelArg(kernel, 2, sizeof(cl_mem), &buf_c.mem);
+		kernel_set_scalar(kernel, 3, p, alpha);
+		kernel_set_scalar(kernel, 4, p, beta);
+		if (v->local_arg) clSetKernelArg(kernel, 5, v->local_mem(p), NULL);
+		v->geometry(p, global, local);
+		if (!launch_plan_init(&env, kernel, v->dim, global, local, &plan)) err = CL_INVALID_WORK_GROUP_SIZE;
+		else err = clEnqueueNDRangeKernel(env.queue, kernel, v->dim, NULL, plan.global, plan.local[0] ? plan.local : NULL, 0, NULL, NULL);
+		if (err != CL_SUCCESS) printf("Unable to launch kernel. Error: %d\n", err);
+	}
+	if (err == CL_SUCCESS)
+	{
+		err = read_rect(buf_c.mem, cbuf_cols, C, ldc, m, n, es);
+		if (err != CL_SUCCESS) printf("Unable to read result. Error: %d\n", err);
+	}
+
+	// the writes read the shared memory of the client until they are done, and the host backend writes C after a
+	// failure, so finish even after an error
+	if (err != CL_SUCCESS)
+	{
+		clFinish(env.queue);
+		return false;
+	}
+	return true;
+}
+
+//count products of the shape of p in one launch of matmult_batched, the operands of every job are copied from its
+//shared memory to its place in the batch buffers and C back, false leaves them to the host backend
+static bool device_gemm_batched(const kernel_params* p, double alpha, double beta, daemon_job* const* jobs, int count)
+{
+	size_t es = dtype_size(p->dtype), sa = (size_t)p->m * p->k, sb = (size_t)p->k * p->n, sc = (size_t)p->m * p->n;
+	size_t global[3], local[3];
+	launch_plan plan;
+	cl_int err = CL_SUCCESS;
+
+	if (!available || (p->dtype == DTYPE_DOUBLE && !fp64)) return false;
+	program_entry* entry = find_program(p, select_variant(p));
+	if (entry == NULL) return false;
+	if (entry->batched == NULL)
+	{
+		entry->batched = clCreateKernel(entry->program, "matmult_batched", &err);
+		if (err != CL_SUCCESS)
+		{
+			printf("Error setting kernel matmult_batched. Error: %d\n", err);
+			entry->batched = NULL;
+			return false;
+		}
+	}
+	if (!reserve(&buf_a, count * sa * es, CL_MEM_READ_ONLY) || !reserve(&buf_b, count * sb * es, CL_MEM_READ_ONLY) ||
+		!reserve(&buf_c, count * sc * es, CL_MEM_READ_WRITE) || !reserve(&buf_offsets, count * sizeof(batch_offsets), CL_MEM_READ_ONLY))
+		return false;
+
+	batch_offsets* offsets = (batch_offsets*)malloc(count * sizeof(batch_offsets));
+	if (!batch_strided_offsets(offsets, count, sa, sb, sc))
+	{
+		free(offsets);
+		return false;
+	}
+	err = clEnqueueWriteBuffer(env.queue, buf_offsets.mem, CL_FALSE, 0, count * sizeof(batch_offsets), offsets, 0, NULL, NULL);
+	for (int b = 0; err == CL_SUCCESS && b < count; ++b)
+	{
+		const service_request* r = &jobs[b]->request;
+		err = clEnqueueWriteBuffer(env.queue, buf_a.mem, CL_FALSE, b * sa * es, sa * es, jobs[b]->base + r->a_offset, 0, NULL, NULL);
+		if (err == CL_SUCCESS)
+			err = clEnqueueWriteBuffer(env.queue, buf_b.mem, CL_FALSE, b * sb * es, sb * es, jobs[b]->base + r->b_offset, 0, NULL, NULL);
+		if (err == CL_SUCCESS && beta != 0)
+			err = clEnqueueWriteBuffer(env.queue, buf_c.mem, CL_FALSE, b * sc * es, sc * es, jobs[b]->base + r->c_offset, 0, NULL, NULL);
+	}
+
+	cl_kernel kernel = entry->batched;
+	clSetKernelArg(kernel, 0, sizeof(cl_mem), &buf_a.mem);
+	clSetKernelArg(kernel, 1, sizeof(cl_mem), &buf_b.mem);
+	clSetKernelArg(kernel, 2, sizeof(cl_mem), &buf_c.mem);
+	kernel_set_scalar(kernel, 3, p, alpha);
+	kernel_set_scalar(kernel, 4, p, beta);
+	clSetKernelArg(kernel, 5, sizeof(cl_mem), &buf_offsets.mem);
+	batched_geometry(p, count, global, local);
+	if (err == CL_SUCCESS && !launch_plan_init(&env, kernel, 3, global, local, &plan)) err = CL_INVALID_WORK_GROUP_SIZE;
+	if (err == CL_SUCCESS) err = clEnqueueNDRangeKernel(env.queue, kernel, 3, NULL, plan.global, plan.local, 0, NULL, NULL);
+	for (int b = 0; err == CL_SUCCESS && b < count; ++b)
+		err = clEnqueueReadBuffer(env.queue, buf_c.mem, CL_FALSE, b * sc * es, sc * es, jobs[b]->base + jobs[b]->request.c_offset, 0, NULL, NULL);
+
+	// the writes read offsets and the shared memory until they are done, so finish even after an error
+	cl_int finished = clFinish(env.queue);
+	free(offsets);
+	if (err == CL_SUCCESS) err = finished;
+	if (err != CL_SUCCESS)
+	{
+		printf("Batch of %d products failed. Error: %d\n", count, err);
+		return false;
+	}
+	return true;
+}
+
+//small jobs of one kernel_params and the same scalars may share a launch
+static bool batchable(const service_request* r)
+{
+	return 2.0 * r->m * r->n * r->k <= GEMMD_BATCH_MAX_FLOPS;
+}
+
+static bool compatible(const service_request* a, const service_request* b)
+{
+	return a->dtype == b->dtype && a->m == b->m && a->n == b->n && a->k == b->k && a->transa == b->transa &&
+		a->transb == b->transb && a->alpha == b->alpha && a->beta == b->beta;
+}
+
+//moves the queued jobs that fit the first one of the batch into it, as long as the element offsets of
+//batch_offsets stay below 2^32
+static void take_compatible(std::deque<daemon_job*>* queue, std::vector<daemon_job*>* batch)
+{
+	const service_request* first = &(*batch)[0]->request;
+	size_t sa = (size_t)first->m * first->k, sb = (size_t)first->k * first->n, sc = (size_t)first->m * first->n;
+	size_t largest = sa > sb ? (sa > sc ? sa : sc) : (sb > sc ? sb : sc);
+
+	for (std::deque<daemon_job*>::iterator it = queue->begin(); it != queue->end() && (int)batch->size() < max_batch; )
+	{
+		if (compatible(first, &(*it)->request) && (batch->size() + 1) * largest <= UINT32_MAX)
+		{
+			batch->push_back(*it);
+			it = queue->erase(it);
+		}
+		else ++it;
+	}
+}
+
+//a device run of flops that did not build a program updates the measured rate
+static void measured(double flops, double ms)
+{
+	if (built || ms <= 0) return;
+	device_rate = device_rate > 0 ? 0.8 * device_rate + 0.2 * flops / ms : flops / ms;
+}
+
+//the jobs of one batch (one job or compatible ones), each gets its reply
+static void run_batch(daemon_job* const* jobs, int count)
+{
+	const service_request* r = &jobs[0]->request;
+	kernel_params p;
+	double start = now_ms();
+	bool ok = kernel_params_init(&p, (int)r->dtype, r->m, r->n, r->k, r->transa, r->transb, vec, tile, wpt, pad, stage_bt);
+	bool device = false;
+	int lda = r->transa ? r->m : r->k, ldb = r->transb ? r->k : r->n;
+
+	built = false;
+	if (ok && count > 1) device = device_gemm_batched(&p, r->alpha, r->beta, jobs, count);
+	else if (ok)
+	{
+		char* base = jobs[0]->base;
+		bool lost = false;
+		device = device_gemm(&p, r->alpha, base + r->a_offset, lda, base + r->b_offset, ldb, r->beta, base + r->c_offset, r->n, &lost);
+		if (device) measured(2.0 * r->m * r->n * r->k, now_ms() - start);
+		ok = !lost;
+	}
+	for (int b = 0; ok && !device && b < count; ++b)
+	{
+		char* base = jobs[b]->base;
+		host_gemm_dtype(p.dtype, true, p.transa, p.transb, p.m, p.n, p.k, r->alpha, base + r->a_offset, lda,
+			base + r->b_offset, ldb, r->beta, base + r->c_offset, p.n, 0);
+	}
+
+	double end = now_ms();
+	for (int b = 0; b < count; ++b)
+	{
+		service_reply* reply = &jobs[b]->reply;
+		reply->status = ok ? SERVICE_OK : SERVICE_FAILED;
+		reply->device = device ? 1 : 0;
+		reply->batch = count;
+		reply->slices = 1;
+		reply->queue_ms = start - jobs[b]->arrival;
+		reply->run_ms = end - start;
+	}
+}
+
+//the next slice of rows of C of a large job, true once it was the last one
+static bool run_slice(daemon_job* job)
+{
+	const service_request* r = &job->request;
+	service_reply* reply = &job->reply;
+	size_t es = dtype_size((int)r->dtype);
+	int i0 = job->next_row, rows = job->slice < r->m - i0 ? job->slice : r->m - i0;
+	int lda = r->transa ? r->m : r->k, ldb = r->transb ? r->k : r->n;
+	kernel_params p;
+	double start = now_ms();
+
+	if (job->started == 0)
+	{
+		job->started = start;
+		job->device = true;
+		reply->queue_ms = start - job->arrival;
+		reply->status = SERVICE_OK;
+	}
+	if (!kernel_params_init(&p, (int)r->dtype, rows, r->n, r->k, r->transa, r->transb, vec, tile, wpt, pad, stage_bt))
+	{
+		reply->status = SERVICE_FAILED;
+		job->next_row = r->m;
+		return true;
+	}
+
+	// rows i0 .. i0 + rows of op(A) are columns of a transposed A, C and B are used as they are
+	const char* A = job->base + r->a_offset + (r->transa ? (size_t)i0 : (size_t)i0 * r->k) * es;
+	const char* B = job->base + r->b_offset;
+	char* C = job->base + r->c_offset + (size_t)i0 * r->n * es;
+	built = false;
+	bool lost = false;
+	bool device = device_gemm(&p, r->alpha, A, lda, B, ldb, r->beta, C, r->n, &lost);
+	if (lost)
+	{
+		reply->status = SERVICE_FAILED;
+		job->next_row = r->m;
+		return true;
+	}
+	if (device) measured(2.0 * rows * r->n * r->k, now_ms() - start);
+	else host_gemm_dtype(p.dtype, true, p.transa, p.transb, p.m, p.n, p.k, r->alpha, A, lda, B, ldb, r->beta, C, r->n, 0);
+
+	job->device = job->device && device;
+	job->next_row = i0 + rows;
+	reply->slices++;
+	reply->run_ms += now_ms() - start;
+	if (job->next_row < r->m) return false;
+
+	reply->device = job->device ? 1 : 0;
+	reply->batch = 1;
+	return true;
+}
+
+//rows of C per slice of a job, a power of two so the slices of different jobs share programs, 0 if it runs whole
+static int slice_rows(const service_request* r)
+{
+	double budget = device_rate > 0 ? device_rate * slice_ms : GEMMD_SLICE_FLOPS, per_row = 2.0 * r->n * r->k;
+	int rows = GEMMD_MIN_SLICE;
+
+	if (per_row * r->m <= budget || r->m <= GEMMD_MIN_SLICE) return 0;
+	while (rows * 2 < r->m && per_row * rows * 2 <= budget) rows *= 2;
+	return rows;
+}
+
+//the next step of the device thread, the class with work first, high before low: a slice of its large job or
+//jobs of its queue, within a class they take turns so small jobs do not wait for all slices of a large one
+//a large job at the front of a queue starts being sliced when its class has none, the others wait their turn
+//returns the class, or -1 if there is nothing to do
+static int next_step(std::vector<daemon_job*>* batch, daemon_job** slice)
+{
+	for (int c = 0; c < NUM_SERVICE_PRIORITIES; ++c)
+	{
+		job_class* jc = &classes[c];
+
+		if (!jc->queue.empty() && (jc->sliced == NULL || jc->queue_turn))
+			for (std::deque<daemon_job*>::iterator it = jc->queue.begin(); it != jc->queue.end(); ++it)
+			{
+				daemon_job* job = *it;
+				int rows = slice_rows(&job->request);
+				if (rows == 0)
+				{
+					batch->push_back(job);
+					jc->queue.erase(it);
+					jc->queue_turn = false;
+					return c;
+				}
+				if (jc->sliced == NULL)
+				{
+					job->slice = rows;
+					jc->sliced = job;
+					jc->queue.erase(it);
+					break;
+				}
+			}
+		if (jc->sliced != NULL)
+		{
+			*slice = jc->sliced;
+			jc->queue_turn = true;
+			return c;
+		}
+	}
+	return -1;
+}
+
+static bool other_work(void)
+{
+	for (int c = 0; c < NUM_SERVICE_PRIORITIES; ++c)
+		if (!classes[c].queue.empty() || classes[c].sliced != NULL) return true;
+	return false;
+}
+
+static void finish(int c, daemon_job* job, double now)
+{
+	job_class* jc = &classes[c];
+
+	jc->latencies[jc->jobs % GEMMD_LATENCY_SAMPLES] = now - job->arrival;
+	++jc->jobs;
+	job->done = true;
+}
+
+static void device_thread(void)
+{
+	std::vector<daemon_job*> batch;
+	daemon_job* slice;
+	int c = -1;
+
+	for (;;)
+	{
+		std::unique_lock<std::mutex> guard(queue_lock);
+		batch.clear();
+		slice = NULL;
+		queue_ready.wait(guard, [&]() { return (c = next_step(&batch, &slice)) >= 0; });
+
+		// a small job waits for company until the window after its arrival closes, the batch is full or other
+		// work is waiting, so the delay stays bounded and other work is not held up
+		if (slice == NULL && batchable(&batch[0]->request))
+		{
+			double deadline = batch[0]->arrival + window_ms;
+			for (;;)
+			{
+				take_compatible(&classes[c].queue, &batch);
+				double left = deadline - now_ms();
+				if ((int)batch.size() >= max_batch || other_work() || left <= 0) break;
+				queue_ready.wait_for(guard, std::chrono::duration<double, std::milli>(left));
+			}
+		}
+		guard.unlock();
+
+		bool last = slice != NULL ? run_slice(slice) : (run_batch(batch.data(), (int)batch.size()), true);
+
+		guard.lock();
+		double now = now_ms();
+		if (slice != NULL && last)
+		{
+			classes[c].sliced = NULL;
+			finish(c, slice, now);
+		}
+		for (size_t b = 0; b < batch.size(); ++b) finish(c, batch[b], now);
+		job_done.notify_all();
+	}
+}
+
+//nearest rank
+static double percentile(const std::vector<double>& sorted, double q)
+{
+	size_t rank = (size_t)ceil(q * sorted.size());
+
+	return sorted.empty() ? 0 : sorted[rank > 0 ? rank - 1 : 0];
+}
+
+//under queue_lock
+static void class_stats(int c, service_class_stats* s)
+{
+	const job_class* jc = &classes[c];
+	size_t count = jc->jobs < GEMMD_LATENCY_SAMPLES ? (size_t)jc->jobs : GEMMD_LATENCY_SAMPLES;
+	std::vector<double> sorted(jc->latencies, jc->latencies + count);
+
+	std::sort(sorted.begin(), sorted.end());
+	s->jobs = jc->jobs;
+	s->samples = count;
+	s->p50_ms = percentile(sorted, 0.50);
+	s->p90_ms = percentile(sorted, 0.90);
+	s->p99_ms = percentile(sorted, 0.99);
+	s->max_ms = sorted.empty() ? 0 : sorted.back();
+}
+
+//rows x cols elements of es bytes, false if that does not fit 64 bits
+static bool matrix_bytes(uint64_t rows, uint64_t cols, uint64_t es, uint64_t* bytes)
+{
+	uint64_t elements;
+
+	return !__builtin_mul_overflow(rows, cols, &elements) && !__builtin_mul_overflow(elements, es, bytes);
+}
+
+//the sizes fit in int, the element type is known and the matrices lie inside shm_bytes
+static bool valid_request(const service_request* r)
+{
+	if (r->magic != SERVICE_MAGIC || r->version != SERVICE_VERSION || r->kind != SERVICE_GEMM || r->dtype >= NUM_DTYPES ||
+		r->priority >= NUM_SERVICE_PRIORITIES)
+		return false;
+	if (r->m <= 0 || r->n <= 0 || r->k <= 0 || r->shm[0] != '/' || memchr(r->shm, 0, sizeof(r->shm)) == NULL) return false;
+
+	// a size that wraps around would pass the bounds below with a small shared memory
+	uint64_t es = dtype_size((int)r->dtype), a_bytes, b_bytes, c_bytes;
+	if (!matrix_bytes(r->m, r->k, es, &a_bytes) || !matrix_bytes(r->k, r->n, es, &b_bytes) || !matrix_bytes(r->m, r->n, es, &c_bytes))
+		return false;
+	return r->a_offset <= r->shm_bytes && a_bytes <= r->shm_bytes - r->a_offset &&
+		r->b_offset <= r->shm_bytes && b_bytes <= r->shm_bytes - r->b_offset &&
+		r->c_offset <= r->shm_bytes && c_bytes <= r->shm_bytes - r->c_offset;
+}
+
+//the shared memory of a request, NULL if it is missing or smaller than the request says
+static char* map_shm(const service_request* r)
+{
+	struct stat st;
+	int fd = shm_open(r->shm, O_RDWR, 0);
+
+	if (fd < 0) return NULL;
+	if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < r->shm_bytes)
+	{
+		close(fd);
+		return NULL;
+	}
+	void* base = mmap(NULL, (size_t)r->shm_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	return base == MAP_FAILED ? NULL : (char*)base;
+}
+
+static void connection_thread(int fd)
+{
+	daemon_job job;
+
+	while (service_recv(fd, &job.request, sizeof(job.request)))
+	{
+		if (job.request.magic == SERVICE_MAGIC && job.request.version == SERVICE_VERSION && job.request.kind == SERVICE_STATS)
+		{
+			service_stats stats;
+			memset(&stats, 0, sizeof(stats));
+			stats.magic = SERVICE_MAGIC;
+			stats.status = SERVICE_OK;
+			std::unique_lock<std::mutex> guard(queue_lock);
+			for (int c = 0; c < NUM_SERVICE_PRIORITIES; ++c) class_stats(c, &stats.classes[c]);
+			guard.unlock();
+			if (!service_send(fd, &stats, sizeof(stats))) break;
+			continue;
+		}
+
+		job.arrival = now_ms();
+		memset(&job.reply, 0, sizeof(job.reply));
+		job.reply.magic = SERVICE_MAGIC;
+		job.started = 0;
+		job.slice = 0;
+		job.next_row = 0;
+		job.device = false;
+		job.done = false;
+
+		job.base = NULL;
+		if (!valid_request(&job.request)) job.reply.status = SERVICE_BAD_REQUEST;
+		else if ((job.base = map_shm(&job.request)) == NULL) job.reply.status = SERVICE_NO_SHM;
+		else
+		{
+			std::unique_lock<std::mutex> guard(queue_lock);
+			classes[job.request.priority].queue.push_back(&job);
+			queue_ready.notify_one();
+			job_done.wait(guard, [&job]() { return job.done; });
+		}
+		if (job.base != NULL) munmap(job.base, (size_t)job.request.shm_bytes);
+
+		if (!service_send(fd, &job.reply, sizeof(job.reply))) break;
+	}
+	close(fd);
+}
+
+static void stop(int)
+{
+	unlink(socket_path);
+	_exit(0);
+}
+
+int main(int argc, char** argv)
+{
+	bool use_device = true;
+
+	for (int a = 1; a < argc; ++a)
+	{
+		if (strcmp(argv[a], "--socket") == 0 && a + 1 < argc) socket_path = argv[++a];
+		else if (strcmp(argv[a], "--vec") == 0 && a + 1 < argc) vec = atoi(argv[++a]);
+		else if (strcmp(argv[a], "--tile") == 0 && a + 1 < argc) tile = atoi(argv[++a]);
+		else if (strcmp(argv[a], "--wpt") == 0 && a + 1 < argc) wpt = atoi(argv[++a]);
+		else if (strcmp(argv[a], "--no-pad") == 0) pad = 0;
+		else if (strcmp(argv[a], "--stage-bt") == 0) stage_bt = 1;
+		else if (strcmp(argv[a], "--host") == 0) use_device = false;
+		else if (strcmp(argv[a], "--window") == 0 && a + 1 < argc && atoi(argv[a + 1]) >= 0) window_ms = atoi(argv[++a]) / 1000.0;
+		else if (strcmp(argv[a], "--max-batch") == 0 && a + 1 < argc && atoi(argv[a + 1]) > 0) max_batch = atoi(argv[++a]);
+		else if (strcmp(argv[a], "--slice") == 0 && a + 1 < argc && atof(argv[a + 1]) > 0) slice_ms = atof(argv[++a]);
+		else
+		{
+			printf("usage: %s [--socket <path>] [--vec <2|4|8|16>] [--tile <4|8|16|32>] [--wpt <1|2|4|8>] [--no-pad] [--stage-bt] [--host]\n"
+				"       [--window <us>] [--max-batch <n>] [--slice <ms>]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	// the context is set up once, every job after that finds it warm
+	available = use_device && ocl_init(&env);
+	if (!available) printf("Running every job on the host\n");
+	// checked once, a double build would fail on every job and evict a program of the cache each time
+	fp64 = available && ocl_has_extension(&env, "cl_khr_fp64");
+	if (available && !fp64) printf("No cl_khr_fp64 on the device, running double jobs on the host\n");
+
+	int listener = service_listen(socket_path);
+	if (listener < 0) return 1;
+	signal(SIGINT, stop);
+	signal(SIGTERM, stop);
+	printf("Listening at %s\n", socket_path);
+	fflush(stdout);
+
+	std::thread(device_thread).detach();
+	for (;;)
+	{
+		int fd = accept(listener, NULL, NULL);
+		if (fd >= 0) std::thread(connection_thread, fd).detach();
+	}
+}
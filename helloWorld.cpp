@@ -1,309 +1,1025 @@
 // compile in Linux with gcc:
-// g++ hello_world.cpp -lOpenCL
+// g++ helloWorld.cpp async.cpp matrix.cpp ocl.cpp kernels.cpp kernelgen.cpp host_gemm.cpp host_igemm.cpp host_mapped.cpp launch.cpp matfile.cpp ooc.cpp pack.cpp precision.cpp prebuilt.cpp prebuilt_data.cpp service.cpp stream.cpp bench.cpp -lOpenCL -pthread -lrt
+// benchmark driver for all kernel variants of kernels.cpp, run with --list to see them and their launch geometry,
+// --kernel <name>[,<name>...] to pick some (default all that fit the shape, auto picks by shape), --size <n> or
+// --size <m>x<n>x<k> multiplies an m x k by a k x n matrix (default 1000), --vec <2|4|8|16>, --tile <4|8|16|32>, --wpt <1|2|4|8>,
+// --no-pad and --stage-bt change their build options, --local-bench adds the local memory bank micro benchmark
+// --transa / --transb multiply with the transpose of A (stored k x m) / B (stored n x k), --alpha and --beta scale
+// the product and the old C as in SGEMM: C = alpha * op(A) * op(B) + beta * C, --dtype <float|double|half|bf16>
+// picks the element type (half and bf16 are stored as such and computed in float, double needs cl_khr_fp64)
+// run with --save-baseline to store the kernel timings of this machine, with --compare to check against them
+// (--baseline-dir <dir> changes the store, default is ./baselines)
+// --packed uploads A and B 4 bits per element when their values allow it (unpack4 widens them on the device)
+// --batch <count> multiplies count independent matrices of the --size shape in one launch (and batched on the host)
+// --tune also times a grid of kernels from the source generator (kernelgen.h), each built on first use
+// --mapped <dir> also writes A, B and C to files in dir and multiplies them on the host through mmap (host_mapped.h),
+// then once more with B stored the other way round and a step budget small enough to cut the product into steps
+// --load-a <file> --load-b <file> [--load-c <file>] multiply matrices of files (matfile.h) instead of random ones, their
+// sizes replace --size, --verify-files checks their checksums first (that reads every element), --save-c <file>
+// writes the serial product C
+// --stream <list> multiplies every job of a list (lines of <A file> <B file> <C file>) in a pipeline that reads, uploads,
+// multiplies, downloads and writes different jobs at once (stream.h), --alpha, --dtype and the transposes apply to all
+// --daemon <socket> also sends the product to a running GEMM daemon (gemmd.cpp) through shared memory, as a bulk job
+// with --low-priority, and prints the latency percentiles of the daemon
+// --ooc <MB> also runs the product block by block through at most MB of device memory (ooc.h, 0 takes the device limits)
+// --async also runs the product through async.h, which returns a future instead of blocking, and for square shapes
+// chains C * C on its event while the host computes the reference of that
+// --int8 runs the exact integer product instead (int8 A and B, int32 C) on every host instruction set and the device
 
 #include "CL/cl.h"                              //includes open CL library to enable open CL functionality
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <chrono> //using this for sequential version speed test
 
-#define DATA_SIZE   1000                         //prepare matrix size
-#define MEM_SIZE    DATA_SIZE * DATA_SIZE * sizeof(float)   //prepares memory needed to store a matrix of given size containing float values
-
-/** kernel's source text as string **/
-const char* KernelSource =
-
-"#define DATA_SIZE 1000																	\n"
-"__kernel void matmult(__global float* Ap, __global float* Bp, __global float* Cp)		\n"
-"{																						\n"
-"	int i, j, k;																		\n"
-"	float sum = 0.f;																	\n"
-"	i = get_global_id(0);																\n" //past a certain threshhold of matrix size, doubling the matrix size causes an eightfold increase in compile time, suggesting that we eventually reach the maximum possible parallelization and return to a structure equivalent to 3 nested loops, up until that point it is significantly faster though (for us this happened when going from size 1000 to 2000)
-"	j = get_global_id(1);																\n"
-"	for (k = 0; k < DATA_SIZE; ++k)														\n"
-"	{																					\n"
-"		sum += Ap[i * DATA_SIZE + k] * Bp[k * DATA_SIZE + j];							\n"
-"	}																					\n"
-"	Cp[i * DATA_SIZE + j] = sum;														\n"
-"}																						\n"
-"																						\n";
-
-//"#define DATA_SIZE 3												\n"
-//"__kernel void test(__global float *input, __global float *input2, __global float *output)  \n"
-//"{																	\n"
-//"	size_t i = get_global_id(0);									\n"
-//"	output[i] = input[i] * input2[i];								\n"
-//"}																	\n"
-//"\n";
-
-float** alloc_mat(int row, int col)
+#include "async.h"   //products that return a future
+#include "bench.h"   //baseline store and regression test for the kernel timings
+#include "host_gemm.h"
+#include "host_igemm.h"
+#include "host_mapped.h"
+#include "kernelgen.h"
+#include "kernels.h" //kernel source and the registry of variants
+#include "launch.h"
+#include "matfile.h"
+#include "matrix.h"
+#include "ocl.h"
+#include "ooc.h"
+#include "pack.h"
+#include "prebuilt.h" //kernel programs compiled ahead of time by kernelc
+#include "service.h"
+#include "stream.h"
+
+#define DATA_SIZE   1000                         //default matrix size
+#define MAX_SELECTED 64
+#define VERIFY_TOL  1e-5f                        //accepted relative difference to the serial product when alpha or beta reorder the rounding
+#define VERIFY_ULPS 8                            //or this many units in the last place of a coarser element type
+
+struct variant_result
 {
-	float** A1, * A2;
+	const kernel_variant* variant;
+	double median;      //ms
+	bool equal;         //matches the serial product
+};
 
-	A1 = (float**)calloc(row, sizeof(float*));	 // pointer on rows
-	A2 = (float*)calloc(row * col, sizeof(float));    // all matrix elements
-	for (int i = 0; i < row; i++)
-		A1[i] = A2 + i * col;
+//exact match, or within the tolerance of the element type, prints the verdict after the timing
+static bool check_result(float** C, float** ref, int m, int n, int dtype)
+{
+	float tol = VERIFY_ULPS * dtype_epsilon(dtype) > VERIFY_TOL ? (float)(VERIFY_ULPS * dtype_epsilon(dtype)) : VERIFY_TOL;
 
-	return A1;
+	if (compare_mat(C, ref, m, n))
+	{
+		printf("matrices are equal\n");
+		return true;
+	}
+
+	float diff = max_rel_diff(C, ref, m, n);
+	printf("matrices are %s (max relative difference %g)\n", diff <= tol ? "equal within rounding" : "not equal", diff);
+	return diff <= tol;
+}
+
+//copy of a float matrix in the stored format of dtype
+//a matrix of a file (--load-a ...) or of init_mat: a dense float file is used in place through row pointers into
+//its mapping, anything else is converted into a copy
+static float** input_matrix(const char* path, const matfile* f, int rows, int cols)
+{
+	if (path != NULL) return matfile_dense_float(f) ? matfile_rows(f) : matfile_to_mat(f);
+
+	float** X = alloc_mat(rows, cols);
+	init_mat(X, rows, cols);
+	return X;
+}
+
+static void free_input_matrix(float** X, int rows, const char* path, matfile* f)
+{
+	if (path != NULL && matfile_dense_float(f)) free(X); //the elements belong to the mapping
+	else free_mat(X, rows);
+	if (path != NULL) matfile_close(f);
 }
 
-void init_mat(float** A, int row, int col)
+static void* typed_copy(int dtype, float** X, int rows, int cols)
 {
-	for (int i = 0; i < row * col; i++)
-		A[0][i] = (float)(rand() % 10);
+	void* T = malloc((size_t)rows * cols * dtype_size(dtype));
+	to_dtype(dtype, X[0], T, (size_t)rows * cols);
+	return T;
 }
 
-void init_zero(float** A, int row, int col)
+//int8 copy of a matrix of small integers (init_mat)
+static int8_t* int8_copy(float** X, int rows, int cols, int ld)
 {
-	for (int i = 0; i < row * col; i++)
-		A[0][i] = 0;
+	int8_t* T = (int8_t*)calloc((size_t)rows * ld, 1);
+	for (int i = 0; i < rows; i++)
+		for (int j = 0; j < cols; j++) T[(size_t)i * ld + j] = (int8_t)X[i][j];
+	return T;
 }
 
-void print_mat(float** A, int row, int col, char const* tag)
+//--int8: every host instruction set against the scalar product, then the device kernel, all results must be exact
+static int run_int8(const kernel_params* p, const char* baseline_dir, bool save_baseline, bool compare_baseline)
 {
-	int i, j;
+	int m = p->m, n = p->n, k = p->k, kp = p->kp;
+	float** A = alloc_mat(m, k); init_mat(A, m, k);
+	float** B = alloc_mat(k, n); init_mat(B, k, n);
+	int8_t* Ai = int8_copy(A, m, k, k);
+	int8_t* Bi = int8_copy(B, k, n, n);
+	int32_t* ref = (int32_t*)malloc((size_t)m * n * sizeof(int32_t));
+	int32_t* C = (int32_t*)malloc((size_t)m * n * sizeof(int32_t));
+	size_t c_size = (size_t)m * n * sizeof(int32_t);
+	bool regression = false;
 
-	printf("Matrix %s:\n", tag);
-	for (i = 0; i < row; i++)
+	for (int isa = IGEMM_SCALAR; isa < NUM_IGEMM_ISAS; ++isa)
 	{
-		for (j = 0; j < col; j++)
-			printf("%6.1f   ", A[i][j]);
+		if (!igemm_isa_supported(isa)) continue;
+		std::chrono::milliseconds start = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch());
+
+		host_igemm(m, n, k, Ai, k, Bi, n, isa == IGEMM_SCALAR ? ref : C, n, isa, 0);
+
+		std::chrono::milliseconds end = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch());
+
+		printf("int8 host (%s) Time Taken in Milliseconds: %lld", igemm_isa_name(isa), (long long)(end.count() - start.count()));
+		if (isa != IGEMM_SCALAR) printf(", matrices are %s", memcmp(C, ref, c_size) == 0 ? "equal" : "not equal");
 		printf("\n");
 	}
-}
 
-void free_mat(float** A, int num_rows) {
-	free(A[0]);
-	free(A);
-}
+	ocl_env env;
+	cl_int err;
+	char options[512];
+
+	if (ocl_init(&env))
+	{
+		kernel_build_options(p, options, sizeof(options));
+		cl_program program = prebuilt_build(&env, KernelSource, options, &err);
+		cl_kernel kernel = program != NULL ? clCreateKernel(program, int8_variant.entry, &err) : NULL;
 
-bool compare_mat(float** A, float** B, int row, int col) {
-	for(int i = 0; i < row; ++i)
-		for (int j = 0; j < col; ++j)
+		if (kernel != NULL)
 		{
-			if (A[i][j] != B[i][j]) return false; //iterate through all elements, if any are different return that they are not equal
+			// A and B transposed, zero padded to kp along k so every work item reads whole char4
+			int8_t* Apad = int8_copy(A, m, k, kp);
+			int8_t* Btpad = (int8_t*)calloc((size_t)n * kp, 1);
+			size_t global[MAX_WORK_DIM], local[MAX_WORK_DIM];
+			launch_plan plan;
+			double samples[BENCH_REPS];
+			char label[128];
+
+			for (int l = 0; l < k; ++l)
+				for (int j = 0; j < n; ++j) Btpad[(size_t)j * kp + l] = Bi[(size_t)l * n + j];
+
+			cl_mem Ap = clCreateBuffer(env.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, (size_t)m * kp, Apad, &err);
+			cl_mem Bp = clCreateBuffer(env.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, (size_t)n * kp, Btpad, &err);
+			cl_mem Cp = clCreateBuffer(env.context, CL_MEM_WRITE_ONLY, c_size, NULL, &err);
+
+			clSetKernelArg(kernel, 0, sizeof(cl_mem), &Ap);
+			clSetKernelArg(kernel, 1, sizeof(cl_mem), &Bp);
+			clSetKernelArg(kernel, 2, sizeof(cl_mem), &Cp);
+			int8_variant.geometry(p, global, local);
+			variant_label(&int8_variant, p, label, sizeof(label));
+			if (launch_plan_init(&env, kernel, int8_variant.dim, global, local, &plan)
+				&& bench_kernel(env.queue, kernel, int8_variant.dim, plan.global, plan.local[0] ? plan.local : NULL, samples, BENCH_REPS) == CL_SUCCESS)
+			{
+				clEnqueueReadBuffer(env.queue, Cp, CL_TRUE, 0, c_size, C, 0, NULL, NULL);
+				printf("%-24s OpenCL time = %8.1f ms (median of %d runs), matrices are %s\n", label, median(samples, BENCH_REPS), BENCH_REPS,
+					memcmp(C, ref, c_size) == 0 ? "equal" : "not equal");
+				regression = bench_baseline(baseline_dir, env.device, label, samples, BENCH_REPS, save_baseline, compare_baseline);
+			}
+			else printf("%s skipped\n", label);
+
+			clReleaseMemObject(Ap);
+			clReleaseMemObject(Bp);
+			clReleaseMemObject(Cp);
+			clReleaseKernel(kernel);
+			free(Apad);
+			free(Btpad);
 		}
+		if (program != NULL) clReleaseProgram(program);
+		ocl_release(&env);
+	}
 
-	return true; //if we reached this point we haven't found any differences as we would have otherwise returned false already, so we can return true
-}
+	free_mat(A, m);
+	free_mat(B, k);
+	free(Ai);
+	free(Bi);
+	free(ref);
+	free(C);
 
+	return regression ? 1 : 0;
+}
 
-/** Body of the main code **/
-int main(void)
+//--batch: count products of the shape of p, the batched host backend against a loop of serial products, then
+//matmult_batched against the same reference, all of them in one launch
+static int run_batched(const kernel_params* p, int count, double alpha, double beta, const char* baseline_dir, bool save_baseline, bool compare_baseline)
 {
-	//prepare matrices
-	float** A = alloc_mat(DATA_SIZE, DATA_SIZE); init_mat(A, DATA_SIZE, DATA_SIZE);
-	float** B = alloc_mat(DATA_SIZE, DATA_SIZE); init_mat(B, DATA_SIZE, DATA_SIZE);
-	float** serialC = alloc_mat(DATA_SIZE, DATA_SIZE);
-	//Serial variant in here
+	int m = p->m, n = p->n, k = p->k, dtype = p->dtype;
+	int a_rows = p->transa ? k : m, a_cols = p->transa ? m : k;
+	int b_rows = p->transb ? n : k, b_cols = p->transb ? k : n;
+	size_t sa = (size_t)m * k, sb = (size_t)k * n, sc = (size_t)m * n, es = dtype_size(dtype);
+	float** A = alloc_mat(count * a_rows, a_cols); init_mat(A, count * a_rows, a_cols);
+	float** B = alloc_mat(count * b_rows, b_cols); init_mat(B, count * b_rows, b_cols);
+	float** C0 = alloc_mat(count * m, n); init_mat(C0, count * m, n);
+	float** ref = alloc_mat(count * m, n);
+	float** C = alloc_mat(count * m, n);
+	void* At = typed_copy(dtype, A, count * a_rows, a_cols);
+	void* Bt = typed_copy(dtype, B, count * b_rows, b_cols);
+	void* Ct = typed_copy(dtype, C0, count * m, n);
+	bool regression = false;
+
+	//reference, one serial product after the other
 	{
 		std::chrono::milliseconds start = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch());
 
-		int i, j, k;
-		for (i = 0; i < DATA_SIZE; i++)
-			for (j = 0; j < DATA_SIZE; j++)
-				for (k = 0; k < DATA_SIZE; k++)
-					serialC[i][j] += A[i][k] * B[k][j];
+		for (int b = 0; b < count; ++b)
+			host_gemm_dtype(dtype, false, p->transa, p->transb, m, n, k, alpha, (char*)At + b * sa * es, a_cols, (char*)Bt + b * sb * es, b_cols,
+				beta, (char*)Ct + b * sc * es, n, 1);
 
 		std::chrono::milliseconds end = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch());
 
-		printf("\nSerial Time Taken in Milliseconds: %lld\n\n\n", end.count() - start.count());
+		printf("\nSerial loop over %d products Time Taken in Milliseconds: %lld\n", count, (long long)(end.count() - start.count()));
+		from_dtype(dtype, Ct, ref[0], count * sc);
 	}
-	//Everything past here is for the open cl version
+	//batched host backend, the products split over the hardware threads
+	{
+		free(Ct);
+		Ct = typed_copy(dtype, C0, count * m, n);
+		std::chrono::milliseconds start = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch());
 
+		host_gemm_batched_dtype(dtype, p->transa, p->transb, m, n, k, alpha, At, a_cols, sa, Bt, b_cols, sb, beta, Ct, n, sc, count, 0);
 
+		std::chrono::milliseconds end = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch());
 
+		printf("Batched host Time Taken in Milliseconds: %lld, ", (long long)(end.count() - start.count()));
+		from_dtype(dtype, Ct, C[0], count * sc);
+		check_result(C, ref, count * m, n, dtype);
+	}
 
+	ocl_env env;
+	cl_int err;
+	char options[512];
+	batch_offsets* offsets = (batch_offsets*)malloc(count * sizeof(batch_offsets));
 
-	cl_int				err;                      //stores information about success or failure of commands
-	cl_platform_id* platforms = NULL;         //id of the platform
-	char			    platform_name[1024];      //name of the platform
-	cl_device_id	    device_id = NULL;         //id of the device
-	cl_uint			    num_of_platforms = 0,     //number of platforms
-		num_of_devices = 0;       //number of devices
-	cl_context 			context;                  //context
-	cl_kernel 			kernel;                   //kernel
-	cl_command_queue	command_queue;            //queue storing commands
-	cl_program 			program;                  //stores generated program
-	//cl_mem				input, input2, output;            //stores necessary available memory
-	//float				data[DATA_SIZE] =         //prepare storage for data
-	//{ 1, 2, 3 , 4, 5, 6, 7, 8, 9, 10};
-	size_t				global[2] = { DATA_SIZE, DATA_SIZE };  //global storage for data size
-	float				results[DATA_SIZE] = { 0 }; //empty storage with enough space for future matrix data
+	// the device part needs every element of the batch within the 32 bit offsets of the kernel
+	if (batch_strided_offsets(offsets, count, sa, sb, sc) && ocl_init(&env))
+	{
+		kernel_build_options(p, options, sizeof(options));
+		cl_program program = prebuilt_build(&env, KernelSource, options, &err);
+		cl_kernel kernel = program != NULL ? clCreateKernel(program, "matmult_batched", &err) : NULL;
 
-	cl_event event;
-	cl_ulong start, end;
+		if (kernel != NULL)
+		{
+			size_t global[3], local[3];
+			launch_plan plan;
+			double samples[BENCH_REPS], verify_ms;
+			char label[128];
+			void* C0t = typed_copy(dtype, C0, count * m, n);
 
-	/* 1) */
+			cl_mem Ap = clCreateBuffer(env.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, count * sa * es, At, &err);
+			cl_mem Bp = clCreateBuffer(env.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, count * sb * es, Bt, &err);
+			cl_mem Cp = clCreateBuffer(env.context, CL_MEM_READ_WRITE, count * sc * es, NULL, &err);
+			cl_mem Op = clCreateBuffer(env.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, count * sizeof(batch_offsets), offsets, &err);
 
-	// gets the number of available platforms, returning if it was successful
-	err = clGetPlatformIDs(0, NULL, &num_of_platforms);
-	if (err != CL_SUCCESS)
-	{
-		printf("No platforms found. Error: %d\n", err);
-		return 0;
-	}
+			clSetKernelArg(kernel, 0, sizeof(cl_mem), &Ap);
+			clSetKernelArg(kernel, 1, sizeof(cl_mem), &Bp);
+			clSetKernelArg(kernel, 2, sizeof(cl_mem), &Cp);
+			kernel_set_scalar(kernel, 3, p, alpha);
+			kernel_set_scalar(kernel, 4, p, beta);
+			clSetKernelArg(kernel, 5, sizeof(cl_mem), &Op);
+			batched_geometry(p, count, global, local);
+			snprintf(label, sizeof(label), "batched%d_", count);
+			variant_label(&kernel_variants[0], p, label + strlen(label), sizeof(label) - strlen(label)); //naive only adds the shape
+			if (launch_plan_init(&env, kernel, 3, global, local, &plan) && bench_kernel(env.queue, kernel, 3, plan.global, plan.local[0] ? plan.local : NULL, samples, BENCH_REPS) == CL_SUCCESS)
+			{
+				// one more launch on C0 gives the result to check
+				clEnqueueWriteBuffer(env.queue, Cp, CL_TRUE, 0, count * sc * es, C0t, 0, NULL, NULL);
+				bench_kernel(env.queue, kernel, 3, plan.global, plan.local[0] ? plan.local : NULL, &verify_ms, 1);
+				clEnqueueReadBuffer(env.queue, Cp, CL_TRUE, 0, count * sc * es, Ct, 0, NULL, NULL);
+				from_dtype(dtype, Ct, C[0], count * sc);
+				printf("%-24s OpenCL time = %8.3f ms (median of %d runs, one launch for %d products), ", label, median(samples, BENCH_REPS), BENCH_REPS, count);
+				check_result(C, ref, count * m, n, dtype);
+				regression = bench_baseline(baseline_dir, env.device, label, samples, BENCH_REPS, save_baseline, compare_baseline);
+			}
+			else printf("%s skipped\n", label);
 
-	// gets the id of the current platform
-	platforms = (cl_platform_id*)malloc(num_of_platforms);
-	err = clGetPlatformIDs(num_of_platforms, platforms, NULL);
-	if (err != CL_SUCCESS)
-	{
-		printf("No platforms found. Error: %d\n", err);
-		return 0;
+			clReleaseMemObject(Ap);
+			clReleaseMemObject(Bp);
+			clReleaseMemObject(Cp);
+			clReleaseMemObject(Op);
+			clReleaseKernel(kernel);
+			free(C0t);
+		}
+		if (program != NULL) clReleaseProgram(program);
+		ocl_release(&env);
 	}
-	else
-	{
-		int nvidia_platform = 0;
 
-		// For every platform
-		for (unsigned int i = 0; i < num_of_platforms; i++)
+	free_mat(A, count * a_rows);
+	free_mat(B, count * b_rows);
+	free_mat(C0, count * m);
+	free_mat(ref, count * m);
+	free_mat(C, count * m);
+	free(At);
+	free(Bt);
+	free(Ct);
+	free(offsets);
+
+	return regression ? 1 : 0;
+}
+
+//--tune: a grid of generated kernels on the unpadded buffers, each one is generated and built on first use, timed and
+//checked against the serial product like the variants of the registry
+static void tune_generated(ocl_env* env, const kernel_params* p, double alpha, double beta, cl_mem Ap, cl_mem Bp, cl_mem Cp,
+	const void* C0t, float** ref)
+{
+	static const int tiles[] = { 32, 64 }, steps[] = { 8, 16 }, wpts[] = { 2, 4, 8 }, vecs[] = { 1, 4 };
+	int epilogue = beta == 0 ? GEN_EPILOGUE_STORE : GEN_EPILOGUE_AXPBY;
+	size_t c_size = (size_t)p->m * p->n * dtype_size(p->dtype);
+	void* Ct = malloc(c_size);
+	float** C = alloc_mat(p->m, p->n);
+	double samples[BENCH_REPS], verify_ms, best_ms = 0;
+	char label[128], best[128] = "";
+	cl_int err;
+
+	printf("\n");
+	for (int tm : tiles) for (int tn : tiles) for (int tk : steps)
+		for (int wm : wpts) for (int wn : wpts) for (int v : vecs)
 		{
-			// Attempt to get its information
-			clGetPlatformInfo(platforms[i], CL_PLATFORM_NAME, sizeof(platform_name), platform_name, NULL);
-			if (err != CL_SUCCESS)
+			gen_params g;
+			size_t global[MAX_WORK_DIM], local[MAX_WORK_DIM];
+			launch_plan plan;
+
+			if (wn % v != 0 || (tm / wm) * (tn / wn) > GEN_MAX_GROUP) continue;
+			if (!gen_params_init(&g, p->dtype, p->m, p->n, p->k, p->transa, p->transb, tm, tn, tk, wm, wn, v, 1, epilogue)) continue;
+			cl_kernel kernel = gen_kernel(env, &g, &err);
+			if (kernel == NULL) continue;
+
+			clSetKernelArg(kernel, 0, sizeof(cl_mem), &Ap);
+			clSetKernelArg(kernel, 1, sizeof(cl_mem), &Bp);
+			clSetKernelArg(kernel, 2, sizeof(cl_mem), &Cp);
+			kernel_set_scalar(kernel, 3, p, alpha);
+			kernel_set_scalar(kernel, 4, p, beta);
+			gen_geometry(&g, global, local);
+			gen_label(&g, label, sizeof(label));
+			if (!launch_plan_init(env, kernel, 2, global, local, &plan) || bench_kernel(env->queue, kernel, 2, plan.global, plan.local[0] ? plan.local : NULL, samples, BENCH_REPS) != CL_SUCCESS)
 			{
-				printf("Could not get information about platform. Error: %d\n", err);
-				return 0;
+				printf("%s skipped\n", label);
+				continue;
 			}
 
-			// check if using nvidia
-			if (strstr(platform_name, "NVIDIA") != NULL)
+			clEnqueueWriteBuffer(env->queue, Cp, CL_TRUE, 0, c_size, C0t, 0, NULL, NULL);
+			bench_kernel(env->queue, kernel, 2, plan.global, plan.local[0] ? plan.local : NULL, &verify_ms, 1);
+			clEnqueueReadBuffer(env->queue, Cp, CL_TRUE, 0, c_size, Ct, 0, NULL, NULL);
+			from_dtype(p->dtype, Ct, C[0], (size_t)p->m * p->n);
+
+			double ms = median(samples, BENCH_REPS);
+			printf("%-40s OpenCL time = %8.1f ms (median of %d runs), ", label, ms, BENCH_REPS);
+			if (check_result(C, ref, p->m, p->n, p->dtype) && (best[0] == 0 || ms < best_ms))
 			{
-				nvidia_platform = i;
-				break;
+				best_ms = ms;
+				snprintf(best, sizeof(best), "%s", label);
 			}
 		}
+	if (best[0] != 0) printf("Fastest generated kernel: %s (%.1f ms)\n", best, best_ms);
 
-		// Get ID of current device, and maximum available numbers
-		err = clGetDeviceIDs(platforms[nvidia_platform], CL_DEVICE_TYPE_GPU, 1, &device_id, &num_of_devices);
-		if (err != CL_SUCCESS)
+	gen_cache_release();
+	free_mat(C, p->m);
+	free(Ct);
+}
+
+//--ooc: the product block by block through at most mem_limit bytes of device memory, as for matrices that do not
+//fit the device, checked against the serial product
+static void run_ooc(ocl_env* env, const kernel_params* p, size_t mem_limit, double alpha, double beta, const void* At,
+	const void* Bt, const void* C0t, float** ref)
+{
+	size_t c_size = (size_t)p->m * p->n * dtype_size(p->dtype);
+	int a_cols = p->transa ? p->m : p->k, b_cols = p->transb ? p->k : p->n;
+	void* Ct = malloc(c_size);
+	float** C = alloc_mat(p->m, p->n);
+	ooc_blocks blocks;
+	ooc_stats stats;
+
+	memcpy(Ct, C0t, c_size);
+	if (ooc_plan(env, p, mem_limit, &blocks))
+	{
+		std::chrono::milliseconds start = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch());
+		bool ok = ooc_gemm(env, p, mem_limit, alpha, At, a_cols, Bt, b_cols, beta, Ct, p->n, &stats);
+		std::chrono::milliseconds end = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch());
+
+		printf("Out-of-core %d x %d x %d blocks of %d x %d x %d (%.1f MB on the device): ", blocks.count_m, blocks.count_n, blocks.count_k,
+			blocks.block.m, blocks.block.n, blocks.block.k, blocks.bytes / 1048576.0);
+		if (ok)
 		{
-			printf("Could not get device in platform. Error: %d\n", err);
-			return 0;
+			printf("%lld ms with the build, %d launches, %.1f MB up, %.1f MB down, ", (long long)(end.count() - start.count()),
+				stats.launches, stats.uploaded / 1048576.0, stats.downloaded / 1048576.0);
+			from_dtype(p->dtype, Ct, C[0], (size_t)p->m * p->n);
+			check_result(C, ref, p->m, p->n, p->dtype);
 		}
+		else printf("failed\n");
 	}
 
-	// Open Context
-	context = clCreateContext(0, 1, &device_id, NULL, NULL, &err);
-	if (err != CL_SUCCESS)
+	free_mat(C, p->m);
+	free(Ct);
+}
+
+//--async: the product through async.h, the host computes the reference of the chained product while the device runs,
+//for square shapes D = C * C follows on the device after the download of C without the host waiting in between
+static void run_async(ocl_env* env, const kernel_params* p, double alpha, double beta, const void* At, const void* Bt,
+	const void* C0t, float** ref)
+{
+	size_t c_size = (size_t)p->m * p->n * dtype_size(p->dtype);
+	bool chain = p->m == p->n && p->n == p->k;
+	void* Ct = malloc(c_size);
+	void* Dt = chain ? malloc(c_size) : NULL;
+	void* Dref = NULL;
+	kernel_params p2;
+	async_op first, second;
+
+	memcpy(Ct, C0t, c_size);
+	if (chain && !kernel_params_init(&p2, p->dtype, p->m, p->m, p->m, 0, 0, p->vec, p->tile, p->wpt, p->pad, p->stage_bt)) chain = false;
+	std::chrono::milliseconds start = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch());
+	if (!async_gemm(env, p, alpha, At, Bt, beta, Ct, NULL, 0, &first))
 	{
-		printf("Unable to create context. Error: %d\n", err);
-		return 0;
+		free(Ct);
+		free(Dt);
+		return;
 	}
+	if (chain && !async_gemm(env, &p2, 1.0, Ct, Ct, 0.0, Dt, &first.done, 1, &second)) chain = false;
+	std::chrono::milliseconds enqueued = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch());
 
-	// Creates a queue (FIFO)
-	command_queue = clCreateCommandQueue(context, device_id, CL_QUEUE_PROFILING_ENABLE, &err);
-	if (err != CL_SUCCESS)
+	//host work that overlaps the device, the serial C * C
+	if (chain)
 	{
-		printf("Unable to create command queue. Error: %d\n", err);
-		return 0;
+		Dref = typed_copy(p->dtype, ref, p->m, p->n);
+		void* Dtmp = malloc(c_size);
+		host_gemm_dtype(p->dtype, true, 0, 0, p->m, p->m, p->m, 1.0, Dref, p->m, Dref, p->m, 0.0, Dtmp, p->m, 0);
+		free(Dref);
+		Dref = Dtmp;
 	}
+	std::chrono::milliseconds host_done = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch());
 
-	// Generate online program
-	program = clCreateProgramWithSource(context, 1, (const char**)&KernelSource, NULL, &err);
-	if (err != CL_SUCCESS)
+	bool ok = first.result.get();
+	std::chrono::milliseconds end = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch());
+	float** C = alloc_mat(p->m, p->n);
+	printf("Async enqueued in %lld ms, C ready after %lld ms (host busy %lld ms meanwhile), ", (long long)(enqueued.count() - start.count()),
+		(long long)(end.count() - start.count()), (long long)(host_done.count() - enqueued.count()));
+	if (ok)
 	{
-		printf("Unable to create program. Error: %d\n", err);
-		return 0;
+		from_dtype(p->dtype, Ct, C[0], (size_t)p->m * p->n);
+		check_result(C, ref, p->m, p->n, p->dtype);
 	}
+	else printf("failed\n");
 
-	// Compile and link the kernel source text
-	err = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
-	if (err != CL_SUCCESS)
+	if (chain)
 	{
-		printf("Error building program. Error: %d\n", err);
-		return 0;
+		ok = second.result.get();
+		end = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch());
+		printf("Async chained C * C ready after %lld ms, ", (long long)(end.count() - start.count()));
+		if (ok)
+		{
+			float** D = alloc_mat(p->m, p->n);
+			float** R = alloc_mat(p->m, p->n);
+			from_dtype(p->dtype, Dt, D[0], (size_t)p->m * p->n);
+			from_dtype(p->dtype, Dref, R[0], (size_t)p->m * p->n);
+			check_result(D, R, p->m, p->n, p->dtype);
+			free_mat(D, p->m);
+			free_mat(R, p->m);
+		}
+		else printf("failed\n");
+		async_release(&second);
+	}
+	async_release(&first);
+
+	free_mat(C, p->m);
+	free(Ct);
+	free(Dt);
+	free(Dref);
+}
+
+//A, B (as stored for transb) and C0 written to files in dir and multiplied on their mappings by the out-of-core host
+//product with at most budget bytes per step (0 the default), C stays in dir/C.bin
+static void mapped_product(const kernel_params* p, const char* dir, bool transb, size_t budget, const char* label, double alpha,
+	double beta, const void* At, const void* Bs, const void* C0t, float** ref)
+{
+	int a_rows = p->transa ? p->k : p->m, a_cols = p->transa ? p->m : p->k;
+	int b_rows = transb ? p->n : p->k, b_cols = transb ? p->k : p->n;
+	mapped_matrix A, B, C;
+	char path[3][512];
+
+	snprintf(path[0], sizeof(path[0]), "%s/A.bin", dir);
+	snprintf(path[1], sizeof(path[1]), "%s/B.bin", dir);
+	snprintf(path[2], sizeof(path[2]), "%s/C.bin", dir);
+	if (!mapped_open(&A, path[0], a_rows, a_cols, p->dtype, true)) return;
+	if (!mapped_open(&B, path[1], b_rows, b_cols, p->dtype, true) || !mapped_open(&C, path[2], p->m, p->n, p->dtype, true))
+	{
+		mapped_close(&A);
+		mapped_close(&B);
+		return;
+	}
+	memcpy(A.data, At, A.bytes);
+	memcpy(B.data, Bs, B.bytes);
+	memcpy(C.data, C0t, C.bytes);
+	mapped_close(&A);
+	mapped_close(&B);
+
+	//read only from here on, as for inputs that were there before
+	mapped_open(&A, path[0], a_rows, a_cols, p->dtype, false);
+	mapped_open(&B, path[1], b_rows, b_cols, p->dtype, false);
+	std::chrono::milliseconds start = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch());
+	bool ok = host_gemm_mapped(p->transa, transb, alpha, &A, &B, beta, &C, budget, 0);
+	std::chrono::milliseconds end = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch());
+
+	if (ok)
+	{
+		float** Cf = alloc_mat(p->m, p->n);
+		printf("%s Time Taken in Milliseconds: %lld, ", label, (long long)(end.count() - start.count()));
+		from_dtype(p->dtype, C.data, Cf[0], (size_t)p->m * p->n);
+		check_result(Cf, ref, p->m, p->n, p->dtype);
+		free_mat(Cf, p->m);
 	}
+	mapped_close(&A);
+	mapped_close(&B);
+	mapped_close(&C);
+}
+
+//--mapped: the product on mapped files, then once more with B stored the other way round (transposed slabs of B or
+//rows of B) and half the bytes of A, B and C per step, so the panels and chunks of k get used
+static void run_mapped(const kernel_params* p, const char* dir, double alpha, double beta, const void* At, const void* Bt,
+	const void* C0t, float** ref)
+{
+	size_t es = dtype_size(p->dtype);
+	int b_rows = p->transb ? p->n : p->k, b_cols = p->transb ? p->k : p->n;
+	char* flipped = (char*)malloc((size_t)b_rows * b_cols * es);
+
+	mapped_product(p, dir, p->transb, 0, "Mapped host", alpha, beta, At, Bt, C0t, ref);
+	for (int i = 0; i < b_rows; ++i)
+		for (int j = 0; j < b_cols; ++j)
+			memcpy(flipped + ((size_t)j * b_rows + i) * es, (const char*)Bt + ((size_t)i * b_cols + j) * es, es);
+	mapped_product(p, dir, !p->transb, ((size_t)p->m * p->k + (size_t)p->k * p->n + (size_t)p->m * p->n) * es / 2,
+		p->transb ? "Mapped host, B as stored, in steps" : "Mapped host, B transposed, in steps", alpha, beta, At, flipped, C0t, ref);
+	free(flipped);
+}
+
+//--daemon: the product by the GEMM daemon at socket_path (gemmd.cpp), the operands go through shared memory, then
+//the latency percentiles of the daemon
+static void run_daemon(const kernel_params* p, const char* socket_path, int priority, double alpha, double beta, const void* At,
+	const void* Bt, const void* C0t, float** ref)
+{
+	size_t es = dtype_size(p->dtype);
+	service_request request;
+	service_reply reply;
+	service_shm shm;
 
-	// Specify kernel
-	kernel = clCreateKernel(program, "matmult", &err);
-	if (err != CL_SUCCESS)
+	size_t bytes = service_layout(&request, p->dtype, p->m, p->n, p->k, p->transa, p->transb, alpha, beta);
+	if (!service_shm_create(&shm, bytes)) return;
+	request.priority = (uint32_t)priority;
+	snprintf(request.shm, sizeof(request.shm), "%s", shm.name);
+	memcpy((char*)shm.data + request.a_offset, At, (size_t)p->m * p->k * es);
+	memcpy((char*)shm.data + request.b_offset, Bt, (size_t)p->k * p->n * es);
+	memcpy((char*)shm.data + request.c_offset, C0t, (size_t)p->m * p->n * es);
+
+	int fd = service_connect(socket_path);
+	if (fd >= 0)
 	{
-		printf("Error setting kernel. Error: %d\n", err);
+		std::chrono::milliseconds start = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch());
+		bool ok = service_submit(fd, &request, &reply);
+		std::chrono::milliseconds end = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch());
+
+		if (!ok) printf("The GEMM daemon closed the connection\n");
+		else if (reply.status != SERVICE_OK) printf("The GEMM daemon refused the job: %s\n", service_status_name(reply.status));
+		else
+		{
+			float** C = alloc_mat(p->m, p->n);
+			printf("Daemon (%s, %s priority, batch of %d, %d slices) Time Taken in Milliseconds: %lld (%.1f queued, %.1f running), ",
+				reply.device ? "device" : "host", service_priority_name(priority), reply.batch, reply.slices,
+				(long long)(end.count() - start.count()), reply.queue_ms, reply.run_ms);
+			from_dtype(p->dtype, (char*)shm.data + request.c_offset, C[0], (size_t)p->m * p->n);
+			check_result(C, ref, p->m, p->n, p->dtype);
+			free_mat(C, p->m);
+		}
+
+		service_stats stats;
+		if (ok && service_query_stats(fd, &stats))
+			for (int c = 0; c < NUM_SERVICE_PRIORITIES; ++c)
+				printf("  %-4s priority: %llu jobs, latency p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms (last %llu)\n",
+					service_priority_name(c), (unsigned long long)stats.classes[c].jobs, stats.classes[c].p50_ms, stats.classes[c].p90_ms,
+					stats.classes[c].p99_ms, stats.classes[c].max_ms, (unsigned long long)stats.classes[c].samples);
+		close(fd);
+	}
+	service_shm_destroy(&shm);
+}
+
+//--stream: the jobs of a list through the pipeline of stream.h, the shape comes from the files of the first job
+static int run_stream(const kernel_params* tmpl, const char* list, double alpha)
+{
+	stream_job* jobs;
+	char* text;
+	kernel_params p;
+	stream_stats stats;
+	ocl_env env;
+	int count = stream_read_list(list, &jobs, &text), status = 1;
+
+	if (count == 0) printf("%s holds no jobs\n", list);
+	if (count > 0 && stream_params(&jobs[0], tmpl, &p) && ocl_init(&env))
+	{
+		printf("Streaming %d jobs of %d x %d x %d (%s) with kernel %s\n", count, p.m, p.n, p.k, dtype_name(p.dtype), select_variant(&p)->name);
+		if (stream_run(&env, &p, alpha, jobs, count, &stats))
+		{
+			printf("%d done, %d failed in %.1f ms, %.2f jobs/s\n", stats.done, stats.failed, stats.wall_ms,
+				stats.wall_ms > 0 ? 1000.0 * stats.done / stats.wall_ms : 0.0);
+			for (int stage = 0; stage < 5; ++stage)
+				printf("  %-8s busy %8.1f ms (%.0f%%)\n", stream_stage_names[stage], stats.busy_ms[stage],
+					stats.wall_ms > 0 ? 100.0 * stats.busy_ms[stage] / stats.wall_ms : 0.0);
+			status = stats.failed > 0 ? 1 : 0;
+		}
+		ocl_release(&env);
+	}
+	free(jobs);
+	free(text);
+	return status;
+}
+
+/** Body of the main code **/
+int main(int argc, char** argv)
+{
+	bool save_baseline = false, compare_baseline = false, list = false, local_bench = false, int8 = false, packed = false, tune = false;
+	bool async = false, verify_files = false;
+	const char* baseline_dir = BENCH_DIR;
+	const char* selection = NULL;
+	const char* mapped_dir = NULL;
+	const char* load[3] = { NULL, NULL, NULL }; //A, B and C0 from files
+	const char* save_c = NULL;
+	const char* stream_list = NULL;
+	const char* daemon_socket = NULL;
+	int daemon_priority = SERVICE_PRIORITY_HIGH;
+	matfile files[3];
+	int vec = 4, tile = 16, wpt = 4, pad = 1, stage_bt = 0;
+	int m = DATA_SIZE, n = DATA_SIZE, k = DATA_SIZE;
+	int transa = 0, transb = 0, dtype = DTYPE_FLOAT, batch = 0, ooc_mb = -1;
+	double alpha = 1.0, beta = 0.0;
+	kernel_params params;
+
+	for (int a = 1; a < argc; ++a)
+	{
+		if (strcmp(argv[a], "--save-baseline") == 0) save_baseline = true;
+		else if (strcmp(argv[a], "--compare") == 0) compare_baseline = true;
+		else if (strcmp(argv[a], "--baseline-dir") == 0 && a + 1 < argc) baseline_dir = argv[++a];
+		else if (strcmp(argv[a], "--kernel") == 0 && a + 1 < argc) selection = argv[++a];
+		else if (strcmp(argv[a], "--list") == 0) list = true;
+		else if (strcmp(argv[a], "--size") == 0 && a + 1 < argc)
+		{
+			if (sscanf(argv[++a], "%dx%dx%d", &m, &n, &k) != 3)
+				n = k = m = atoi(argv[a]);
+		}
+		else if (strcmp(argv[a], "--local-bench") == 0) local_bench = true;
+		else if (strcmp(argv[a], "--vec") == 0 && a + 1 < argc) vec = atoi(argv[++a]);
+		else if (strcmp(argv[a], "--tile") == 0 && a + 1 < argc) tile = atoi(argv[++a]);
+		else if (strcmp(argv[a], "--wpt") == 0 && a + 1 < argc) wpt = atoi(argv[++a]);
+		else if (strcmp(argv[a], "--no-pad") == 0) pad = 0;
+		else if (strcmp(argv[a], "--stage-bt") == 0) stage_bt = 1;
+		else if (strcmp(argv[a], "--transa") == 0) transa = 1;
+		else if (strcmp(argv[a], "--transb") == 0) transb = 1;
+		else if (strcmp(argv[a], "--alpha") == 0 && a + 1 < argc) alpha = atof(argv[++a]);
+		else if (strcmp(argv[a], "--beta") == 0 && a + 1 < argc) beta = atof(argv[++a]);
+		else if (strcmp(argv[a], "--dtype") == 0 && a + 1 < argc && dtype_from_name(argv[a + 1]) >= 0) dtype = dtype_from_name(argv[++a]);
+		else if (strcmp(argv[a], "--int8") == 0) int8 = true;
+		else if (strcmp(argv[a], "--packed") == 0) packed = true;
+		else if (strcmp(argv[a], "--tune") == 0) tune = true;
+		else if (strcmp(argv[a], "--mapped") == 0 && a + 1 < argc) mapped_dir = argv[++a];
+		else if (strcmp(argv[a], "--load-a") == 0 && a + 1 < argc) load[0] = argv[++a];
+		else if (strcmp(argv[a], "--load-b") == 0 && a + 1 < argc) load[1] = argv[++a];
+		else if (strcmp(argv[a], "--load-c") == 0 && a + 1 < argc) load[2] = argv[++a];
+		else if (strcmp(argv[a], "--save-c") == 0 && a + 1 < argc) save_c = argv[++a];
+		else if (strcmp(argv[a], "--verify-files") == 0) verify_files = true;
+		else if (strcmp(argv[a], "--stream") == 0 && a + 1 < argc) stream_list = argv[++a];
+		else if (strcmp(argv[a], "--daemon") == 0 && a + 1 < argc) daemon_socket = argv[++a];
+		else if (strcmp(argv[a], "--low-priority") == 0) daemon_priority = SERVICE_PRIORITY_LOW;
+		else if (strcmp(argv[a], "--async") == 0) async = true;
+		else if (strcmp(argv[a], "--ooc") == 0 && a + 1 < argc && atoi(argv[a + 1]) >= 0) ooc_mb = atoi(argv[++a]);
+		else if (strcmp(argv[a], "--batch") == 0 && a + 1 < argc && atoi(argv[a + 1]) > 0) batch = atoi(argv[++a]);
+		else
+		{
+			printf("usage: %s [--list] [--kernel <name>[,<name>...]|auto] [--size <n>|<m>x<n>x<k>] [--vec <2|4|8|16>] [--tile <4|8|16|32>] [--wpt <1|2|4|8>]\n"
+				"       [--no-pad] [--stage-bt] [--transa] [--transb] [--alpha <x>] [--beta <x>] [--dtype <float|double|half|bf16>]\n"
+				"       [--packed] [--batch <count>] [--int8] [--tune] [--ooc <MB>] [--async] [--mapped <dir>] [--local-bench]\n"
+				"       [--load-a <file> --load-b <file> [--load-c <file>] [--verify-files]] [--save-c <file>] [--stream <list>]\n"
+				"       [--daemon <socket> [--low-priority]] [--save-baseline] [--compare] [--baseline-dir <dir>]\n", argv[0]);
+			return 1;
+		}
+	}
+	// matrices from files bring their sizes, op() applies to them as stored
+	if ((load[0] == NULL) != (load[1] == NULL))
+	{
+		printf("--load-a and --load-b go together\n");
+		return 1;
+	}
+	for (int f = 0; f < 3; ++f)
+		if (load[f] != NULL && !matfile_open(&files[f], load[f], verify_files)) return 1;
+	if (load[0] != NULL)
+	{
+		int a_rows = (int)files[0].header.rows, a_cols = (int)files[0].header.cols;
+		int b_rows = (int)files[1].header.rows, b_cols = (int)files[1].header.cols;
+		m = transa ? a_cols : a_rows; k = transa ? a_rows : a_cols;
+		n = transb ? b_rows : b_cols;
+		if ((transb ? b_cols : b_rows) != k)
+		{
+			printf("A (%d x %d) and B (%d x %d) of the files do not fit\n", a_rows, a_cols, b_rows, b_cols);
+			return 1;
+		}
+	}
+	if (load[2] != NULL && (load[0] == NULL || (int)files[2].header.rows != m || (int)files[2].header.cols != n))
+	{
+		printf("--load-c needs --load-a and --load-b and an m x n matrix\n");
+		return 1;
+	}
+	if (!kernel_params_init(&params, dtype, m, n, k, transa, transb, vec, tile, wpt, pad, stage_bt)) return 1;
+
+	if (list)
+	{
+		print_variants(&params);
 		return 0;
 	}
+	if (stream_list != NULL) return run_stream(&params, stream_list, alpha);
+	if (int8) return run_int8(&params, baseline_dir, save_baseline, compare_baseline);
+	if (batch > 0) return run_batched(&params, batch, alpha, beta, baseline_dir, save_baseline, compare_baseline);
+
+	// pick the variants, comma separated names, by default everything that supports the shape
+	const kernel_variant* selected[MAX_SELECTED];
+	int num_selected = 0;
+	if (selection == NULL)
+	{
+		for (int v = 0; v < num_kernel_variants && num_selected < MAX_SELECTED; ++v)
+			if (kernel_variants[v].supports(&params)) selected[num_selected++] = &kernel_variants[v];
+	}
+	else if (strcmp(selection, "auto") == 0)
+		selected[num_selected++] = select_variant(&params);
+	else
+	{
+		char names[256];
+		snprintf(names, sizeof(names), "%s", selection);
+		for (char* name = strtok(names, ","); name != NULL && num_selected < MAX_SELECTED; name = strtok(NULL, ","))
+		{
+			selected[num_selected] = find_variant(name);
+			if (selected[num_selected] == NULL)
+			{
+				printf("Unknown kernel %s, --list shows the available ones\n", name);
+				return 1;
+			}
+			if (!selected[num_selected]->supports(&params))
+			{
+				printf("Kernel %s does not support a %d x %d x %d %s product\n", name, m, n, k, dtype_name(dtype));
+				return 1;
+			}
+			++num_selected;
+		}
+	}
 
+	//The OpenCL program compiles on a thread of its own while the input matrices are generated or loaded, it is
+	//done before the host products are timed
+	ocl_env env;
+	cl_int err;
+	cl_program program;
+	char options[512];
+	bool opencl = ocl_init(&env);
+	prebuilt_job* build = NULL;
 
-	/* 2) */
+	if (opencl && dtype == DTYPE_DOUBLE && !ocl_has_extension(&env, "cl_khr_fp64"))
+	{
+		printf("The device does not support double precision (cl_khr_fp64)\n");
+		ocl_release(&env);
+		opencl = false;
+	}
+	if (opencl)
+	{
+		// Every variant lives in the same program, its sizes and tuning parameters are build options
+		kernel_build_options(&params, options, sizeof(options));
+		build = prebuilt_build_async(&env, KernelSource, options);
+	}
 
-	//float** A, ** B;
-	float** C;
-	cl_mem Ap, Bp, Cp;
+	//prepare matrices, A and B as they are stored (transposed if op() transposes them), C0 is the C that beta scales
+	//they are generated as floats, the products run on copies in the element type (At, Bt) and results come back as floats
+	int a_rows = transa ? k : m, a_cols = transa ? m : k;
+	int b_rows = transb ? n : k, b_cols = transb ? k : n;
+	float** A = input_matrix(load[0], &files[0], a_rows, a_cols);
+	float** B = input_matrix(load[1], &files[1], b_rows, b_cols);
+	float** C0 = input_matrix(load[2], &files[2], m, n);
+	float** serialC = alloc_mat(m, n);
+	void* At = typed_copy(dtype, A, a_rows, a_cols);
+	void* Bt = typed_copy(dtype, B, b_rows, b_cols);
+	void* C0t = typed_copy(dtype, C0, m, n);
+	//the build only overlaps the preparation, a compiler on the other cores would slow down the host timings below
+	//and their comparison with earlier runs
+	program = opencl ? prebuilt_build_wait(build, &err) : NULL;
+	//Serial variant in here, it is the reference for all others
+	{
+		void* Ct = typed_copy(dtype, C0, m, n);
+		std::chrono::milliseconds start = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch());
 
-	//A = alloc_mat(DATA_SIZE, DATA_SIZE); init_mat(A, DATA_SIZE, DATA_SIZE);
-	//B = alloc_mat(DATA_SIZE, DATA_SIZE); init_mat(B, DATA_SIZE, DATA_SIZE);
-	C = alloc_mat(DATA_SIZE, DATA_SIZE);
+		host_gemm_dtype(dtype, false, transa, transb, m, n, k, alpha, At, a_cols, Bt, b_cols, beta, Ct, n, 0);
 
-	Ap = clCreateBuffer(context, CL_MEM_READ_ONLY, MEM_SIZE, NULL, &err);
-	Bp = clCreateBuffer(context, CL_MEM_READ_ONLY, MEM_SIZE, NULL, &err);
-	Cp = clCreateBuffer(context, CL_MEM_READ_WRITE, MEM_SIZE, NULL, &err);
+		std::chrono::milliseconds end = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch());
 
-	clEnqueueWriteBuffer(command_queue, Ap, CL_TRUE, 0, MEM_SIZE, A[0], 0, NULL, NULL);
-	clEnqueueWriteBuffer(command_queue, Bp, CL_TRUE, 0, MEM_SIZE, B[0], 0, NULL, NULL);
+		printf("\nSerial Time Taken in Milliseconds: %lld\n", (long long)(end.count() - start.count()));
+		from_dtype(dtype, Ct, serialC[0], (size_t)m * n);
+		if (save_c != NULL && matfile_write(save_c, dtype, m, n, n, Ct)) printf("C written to %s\n", save_c);
+		free(Ct);
+	}
+	//Blocked and threaded host backend
+	{
+		float** hostC = alloc_mat(m, n);
+		void* Ct = typed_copy(dtype, C0, m, n);
+		std::chrono::milliseconds start = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch());
+
+		host_gemm_dtype(dtype, true, transa, transb, m, n, k, alpha, At, a_cols, Bt, b_cols, beta, Ct, n, 0);
 
-	clSetKernelArg(kernel, 0, sizeof(cl_mem), &Ap);
-	clSetKernelArg(kernel, 1, sizeof(cl_mem), &Bp);
-	clSetKernelArg(kernel, 2, sizeof(cl_mem), &Cp);
+		std::chrono::milliseconds end = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch());
 
-	// Create Buffer for input and output
-	//input = clCreateBuffer(context, CL_MEM_READ_ONLY, MEM_SIZE, NULL, &err);
-	//input2 = clCreateBuffer(context, CL_MEM_READ_ONLY, MEM_SIZE, NULL, &err);
-	//output = clCreateBuffer(context, CL_MEM_WRITE_ONLY, MEM_SIZE, NULL, &err);
+		printf("Blocked host Time Taken in Milliseconds: %lld, ", (long long)(end.count() - start.count()));
+		from_dtype(dtype, Ct, hostC[0], (size_t)m * n);
+		check_result(hostC, serialC, m, n, dtype);
+		printf("\n\n");
+		free(Ct);
+		free_mat(hostC, m);
+	}
+	if (mapped_dir != NULL) run_mapped(&params, mapped_dir, alpha, beta, At, Bt, C0t, serialC);
+	if (daemon_socket != NULL) run_daemon(&params, daemon_socket, daemon_priority, alpha, beta, At, Bt, C0t, serialC);
+	//Everything past here is for the open cl version
 
-	//// Write related data from 'data' into 'input' buffer
-	//clEnqueueWriteBuffer(command_queue, input, CL_TRUE, 0, MEM_SIZE, data, 0, NULL, NULL);
-	//clEnqueueWriteBuffer(command_queue, input2, CL_TRUE, 0, MEM_SIZE, data, 0, NULL, NULL);
 
-	//// Define the order of operations of kernel arguments
-	//clSetKernelArg(kernel, 0, sizeof(cl_mem), &input);
-	//clSetKernelArg(kernel, 1, sizeof(cl_mem), &input2);
-	//clSetKernelArg(kernel, 2, sizeof(cl_mem), &output);
+	/* 1) */
+
+	if (program == NULL) return 0;
+
+
+	/* 2) */
+
+	// Unpadded buffers for the variants working on m x k and k x n, zero padded copies for the others
+	int mp = params.mp, np = params.np, kp = params.kp;
+	int apad_rows = transa ? kp : mp, apad_cols = transa ? mp : kp;
+	int bpad_rows = transb ? np : kp, bpad_cols = transb ? kp : np;
+	float** C = alloc_mat(mp, np);
+	float** Apad = pad_mat(A, a_rows, a_cols, apad_rows, apad_cols);
+	float** Bpad = pad_mat(B, b_rows, b_cols, bpad_rows, bpad_cols);
+	float** C0pad = pad_mat(C0, m, n, mp, np);
+	void* Apadt = typed_copy(dtype, Apad, apad_rows, apad_cols);
+	void* Bpadt = typed_copy(dtype, Bpad, bpad_rows, bpad_cols);
+	void* C0padt = typed_copy(dtype, C0pad, mp, np);
+	void* Ct = malloc((size_t)mp * np * dtype_size(dtype));
+	float** Cview = (float**)malloc(m * sizeof(float*)); //row pointers into C for either layout
+	size_t es = dtype_size(dtype);
+	size_t a_size = (size_t)m * k * es, b_size = (size_t)k * n * es;
+	size_t apad_size = (size_t)mp * kp * es, bpad_size = (size_t)kp * np * es;
+	size_t c_size = (size_t)m * n * es, cpad_size = (size_t)mp * np * es;
+	cl_mem Ap, Bp, Cp, Apadp, Bpadp;
+
+	// dense float files go to the device straight from their mapping
+	bool a_mapped = load[0] != NULL && matfile_dense_float(&files[0]) && dtype == DTYPE_FLOAT && !packed;
+	bool b_mapped = load[1] != NULL && matfile_dense_float(&files[1]) && dtype == DTYPE_FLOAT && !packed;
+	Ap = a_mapped ? matfile_buffer(&env, &files[0], &err) : clCreateBuffer(env.context, CL_MEM_READ_ONLY, a_size, NULL, &err);
+	Bp = b_mapped ? matfile_buffer(&env, &files[1], &err) : clCreateBuffer(env.context, CL_MEM_READ_ONLY, b_size, NULL, &err);
+	Apadp = clCreateBuffer(env.context, CL_MEM_READ_ONLY, apad_size, NULL, &err);
+	Bpadp = clCreateBuffer(env.context, CL_MEM_READ_ONLY, bpad_size, NULL, &err);
+	Cp = clCreateBuffer(env.context, CL_MEM_READ_WRITE, cpad_size, NULL, &err); //large enough for both layouts
+
+	if (packed)
+	{
+		size_t sent = pack4_upload(&env, program, &params, Ap, A[0], (size_t)m * k)
+			+ pack4_upload(&env, program, &params, Bp, B[0], (size_t)k * n)
+			+ pack4_upload(&env, program, &params, Apadp, Apad[0], (size_t)mp * kp)
+			+ pack4_upload(&env, program, &params, Bpadp, Bpad[0], (size_t)kp * np);
+		printf("Packed upload: %zu bytes instead of %zu\n", sent, a_size + b_size + apad_size + bpad_size);
+	}
+	else
+	{
+		if (!a_mapped) clEnqueueWriteBuffer(env.queue, Ap, CL_TRUE, 0, a_size, At, 0, NULL, NULL);
+		if (!b_mapped) clEnqueueWriteBuffer(env.queue, Bp, CL_TRUE, 0, b_size, Bt, 0, NULL, NULL);
+		clEnqueueWriteBuffer(env.queue, Apadp, CL_TRUE, 0, apad_size, Apadt, 0, NULL, NULL);
+		clEnqueueWriteBuffer(env.queue, Bpadp, CL_TRUE, 0, bpad_size, Bpadt, 0, NULL, NULL);
+	}
 
 
 	/* 3)  */
 
-	// Puts kernel into command queue and splits up instructions
-	clEnqueueNDRangeKernel(command_queue, kernel, 2, NULL, global, NULL, 0, NULL, &event);
+	// Every selected variant is launched BENCH_REPS times, checked against the serial product and compared with its baseline
+	// the timed launches keep updating C, so C0 is uploaded again for one more launch that gives the result to check
+	double samples[BENCH_REPS], verify_ms;
+	variant_result results[MAX_SELECTED];
+	int num_results = 0;
+	bool regression = false;
 
-	// Wait for queue to complete
-	clFinish(command_queue);
+	for (int s = 0; s < num_selected; ++s)
+	{
+		const kernel_variant* v = selected[s];
+		size_t global[MAX_WORK_DIM], local[MAX_WORK_DIM];
+		launch_plan plan;
+		char label[128];
+		int row_len = v->padded ? np : n, rows = v->padded ? mp : m;
+
+		cl_kernel kernel = clCreateKernel(program, v->entry, &err);
+		if (err != CL_SUCCESS)
+		{
+			printf("Error setting kernel %s. Error: %d\n", v->entry, err);
+			continue;
+		}
+
+		clSetKernelArg(kernel, 0, sizeof(cl_mem), v->padded ? &Apadp : &Ap);
+		clSetKernelArg(kernel, 1, sizeof(cl_mem), v->padded ? &Bpadp : &Bp);
+		clSetKernelArg(kernel, 2, sizeof(cl_mem), &Cp);
+		kernel_set_scalar(kernel, 3, &params, alpha);
+		kernel_set_scalar(kernel, 4, &params, beta);
+		if (v->local_arg) clSetKernelArg(kernel, 5, v->local_mem(&params), NULL);
+
+		v->geometry(&params, global, local);
+		variant_label(v, &params, label, sizeof(label));
+		if (!launch_plan_init(&env, kernel, v->dim, global, local, &plan)
+			|| bench_kernel(env.queue, kernel, v->dim, plan.global, plan.local[0] ? plan.local : NULL, samples, BENCH_REPS) != CL_SUCCESS)
+		{
+			printf("%s skipped\n", label);
+			clReleaseKernel(kernel);
+			continue;
+		}
+
+		// Launch once more on C0 and read the result back into C, its rows are row_len elements apart in the buffer
+		clEnqueueWriteBuffer(env.queue, Cp, CL_TRUE, 0, v->padded ? cpad_size : c_size, v->padded ? C0padt : C0t, 0, NULL, NULL);
+		bench_kernel(env.queue, kernel, v->dim, plan.global, plan.local[0] ? plan.local : NULL, &verify_ms, 1);
+		clEnqueueReadBuffer(env.queue, Cp, CL_TRUE, 0, (size_t)rows * row_len * es, Ct, 0, NULL, NULL);
+		from_dtype(dtype, Ct, C[0], (size_t)rows * row_len);
+		for (int i = 0; i < m; i++) Cview[i] = C[0] + (size_t)i * row_len;
+
+		results[num_results].variant = v;
+		results[num_results].median = median(samples, BENCH_REPS);
+		printf("%-24s ", label);
+		launch_plan_print(&plan);
+		printf("%-24s OpenCL time = %8.1f ms (median of %d runs), ", label, results[num_results].median, BENCH_REPS);
+		results[num_results].equal = check_result(Cview, serialC, m, n, dtype);
+		++num_results;
+
+		// Baseline store, kept per host/device so timings of different machines are never mixed
+		regression |= bench_baseline(baseline_dir, env.device, label, samples, BENCH_REPS, save_baseline, compare_baseline);
 
-	// Read and store results of output buffer into results
-	//clEnqueueReadBuffer(command_queue, output, CL_TRUE, 0, MEM_SIZE, results, 0, NULL, NULL);
-	clEnqueueReadBuffer(command_queue, Cp, CL_TRUE, 0, MEM_SIZE, C[0], 0, NULL, NULL);
-	// Display results
-	//for (unsigned int i = 0; i < DATA_SIZE; i++)
-	//	printf("%f\n", results[i]);
+		clReleaseKernel(kernel);
+	}
+
+	// Side by side, fastest first
+	for (int r = 1; r < num_results; ++r)
+		for (int q = r; q > 0 && results[q].median < results[q - 1].median; --q)
+		{
+			variant_result swap = results[q]; results[q] = results[q - 1]; results[q - 1] = swap;
+		}
+	printf("\n%-10s %10s %8s\n", "variant", "ms", "correct");
+	for (int r = 0; r < num_results; ++r)
+		printf("%-10s %10.1f %8s\n", results[r].variant->name, results[r].median, results[r].equal ? "yes" : "NO");
+	for (int r = 0; r < num_results; ++r)
+		if (results[r].equal)
+		{
+			printf("Fastest on this device: %s\n", results[r].variant->name);
+			break;
+		}
 
-	//print_mat(A, DATA_SIZE, DATA_SIZE, "A");
-	//print_mat(B, DATA_SIZE, DATA_SIZE, "B");
-	//print_mat(C, DATA_SIZE, DATA_SIZE, "C");
-	//print_mat(serialC, DATA_SIZE, DATA_SIZE, "sC");
+	if (tune) tune_generated(&env, &params, alpha, beta, Ap, Bp, Cp, C0t, serialC);
+	if (ooc_mb >= 0) run_ooc(&env, &params, (size_t)ooc_mb << 20, alpha, beta, At, Bt, C0t, serialC);
+	if (async) run_async(&env, &params, alpha, beta, At, Bt, C0t, serialC);
 
-	clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL);
-	clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL);
-	printf("OpenCL time = %.1f ms\n", ((end - start) / 1000000.0));
+	// Local memory micro benchmark, column reads with a tile stride of TS against TS + 1, the output goes to Cp
+	// which is large enough for one float per work item
+	if (local_bench)
+	{
+		cl_kernel kernel_local = clCreateKernel(program, "local_bench", &err);
+		size_t global_tiled[2] = { (size_t)np, (size_t)mp }, local_tiled[2] = { (size_t)tile, (size_t)tile };
+
+		for (int stride = tile; err == CL_SUCCESS && stride <= tile + 1; ++stride)
+		{
+			clSetKernelArg(kernel_local, 0, sizeof(cl_mem), &Cp);
+			clSetKernelArg(kernel_local, 1, sizeof(int), &stride);
+			if (bench_kernel(env.queue, kernel_local, 2, global_tiled, local_tiled, samples, BENCH_REPS) != CL_SUCCESS) break;
+
+			double bytes = (double)mp * np * LOCAL_BENCH_REPS * tile * sizeof(float); //every work item reads LOCAL_BENCH_REPS rows of TS floats
+			double ms = median(samples, BENCH_REPS);
+			printf("Local memory stride %d: %.1f ms, %.1f GB/s\n", stride, ms, bytes / (ms * 1e6));
+		}
+		if (kernel_local != NULL) clReleaseKernel(kernel_local);
+	}
 
-	printf("Matrices are %s", compare_mat(C, serialC, DATA_SIZE, DATA_SIZE) ? "equal" : "not equal");
 
 	/* 4) */
 	clReleaseMemObject(Ap);
 	clReleaseMemObject(Bp);
 	clReleaseMemObject(Cp);
-	//clReleaseMemObject(input);
-	//clReleaseMemObject(output);
+	clReleaseMemObject(Apadp);
+	clReleaseMemObject(Bpadp);
 	clReleaseProgram(program);
-	clReleaseKernel(kernel);
-	clReleaseCommandQueue(command_queue);
-	clReleaseContext(context);
+	ocl_release(&env);
 
-	free_mat(A, DATA_SIZE);
-	free_mat(B, DATA_SIZE);
-	free_mat(C, DATA_SIZE);
-	free_mat(serialC, DATA_SIZE);
+	free_input_matrix(A, a_rows, load[0], &files[0]);
+	free_input_matrix(B, b_rows, load[1], &files[1]);
+	free_mat(C, mp);
+	free_input_matrix(C0, m, load[2], &files[2]);
+	free_mat(C0pad, mp);
+	free_mat(Apad, apad_rows);
+	free_mat(Bpad, bpad_rows);
+	free_mat(serialC, m);
+	free(Cview);
+	free(At);
+	free(Bt);
+	free(C0t);
+	free(Apadt);
+	free(Bpadt);
+	free(C0padt);
+	free(Ct);
 
-	return 0;
+	return regression ? 1 : 0; //non-zero exit lets scripts catch slowdowns
 }
@@ -0,0 +1,257 @@
+#include "host_gemm.h"
+#include <string.h>
+
+#include <thread>
+#include <vector>
+
+#define HOST_BLOCK_K    256     //rows of B that stay in cache while a panel of C is updated
+#define HOST_BLOCK_N    512     //columns of C and B in one block
+
+//element (r, c) of op(X), widened to the arithmetic type
+template <typename T>
+static inline typename precision<T>::acc op_at(const T* X, int ldx, bool trans, int r, int c)
+{
+	return precision<T>::load(trans ? X[(size_t)c * ldx + r] : X[(size_t)r * ldx + c]);
+}
+
+template <typename T>
+void host_gemm_serial(bool transa, bool transb, int m, int n, int k, typename precision<T>::acc alpha, const T* A, int lda,
+	const T* B, int ldb, typename precision<T>::acc beta, T* C, int ldc)
+{
+	typedef typename precision<T>::acc acc;
+
+	for (int i = 0; i < m; i++)
+		for (int j = 0; j < n; j++)
+		{
+			acc sum = 0;
+			for (int l = 0; l < k; l++)
+				sum += op_at(A, lda, transa, i, l) * op_at(B, ldb, transb, l, j);
+			T* c = C + (size_t)i * ldc + j;
+			*c = precision<T>::store(beta == 0 ? alpha * sum : alpha * sum + beta * precision<T>::load(*c));
+		}
+}
+
+//rows [i0, i1) of C, the innermost loop runs along rows of the block of op(B) and of C so it vectorizes
+//the block of op(B) is copied into the arithmetic type first, in the same row order whether B is transposed or not,
+//and the panel is accumulated in a copy of the arithmetic type, so half and bfloat16 only round once at the end
+template <typename T>
+static void blocked_panel(bool transa, bool transb, int i0, int i1, int n, int k, typename precision<T>::acc alpha, const T* A, int lda,
+	const T* B, int ldb, typename precision<T>::acc beta, T* C, int ldc)
+{
+	typedef typename precision<T>::acc acc;
+	int bk = k < HOST_BLOCK_K ? k : HOST_BLOCK_K, bn = n < HOST_BLOCK_N ? n : HOST_BLOCK_N; //small products get a small block
+	std::vector<acc> panel((size_t)(i1 - i0) * n), block((size_t)bk * bn);
+
+	if (beta != 0)
+		for (int i = i0; i < i1; i++)
+		{
+			acc* p = &panel[(size_t)(i - i0) * n];
+			const T* c = C + (size_t)i * ldc;
+			for (int j = 0; j < n; j++) p[j] = beta * precision<T>::load(c[j]);
+		}
+
+	for (int j0 = 0; j0 < n; j0 += bn)
+	{
+		int j1 = j0 + bn < n ? j0 + bn : n;
+		for (int l0 = 0; l0 < k; l0 += bk)
+		{
+			int l1 = l0 + bk < k ? l0 + bk : k;
+
+			//read B along its stored rows in either case
+			if (transb)
+				for (int j = j0; j < j1; j++)
+					for (int l = l0; l < l1; l++) block[(size_t)(l - l0) * bn + j - j0] = op_at(B, ldb, true, l, j);
+			else
+				for (int l = l0; l < l1; l++)
+					for (int j = j0; j < j1; j++) block[(size_t)(l - l0) * bn + j - j0] = op_at(B, ldb, false, l, j);
+
+			for (int i = i0; i < i1; i++)
+			{
+				acc* c = &panel[(size_t)(i - i0) * n] + j0;
+				for (int l = l0; l < l1; l++)
+				{
+					acc a = alpha * op_at(A, lda, transa, i, l);
+					const acc* b = &block[(size_t)(l - l0) * bn];
+					for (int j = 0; j < j1 - j0; j++)
+						c[j] += a * b[j];
+				}
+			}
+		}
+	}
+
+	for (int i = i0; i < i1; i++)
+	{
+		const acc* p = &panel[(size_t)(i - i0) * n];
+		T* c = C + (size_t)i * ldc;
+		for (int j = 0; j < n; j++) c[j] = precision<T>::store(p[j]);
+	}
+}
+
+//op(A) and op(B) are widened into arrays of the arithmetic type first, the sums then run in the order of
+//host_gemm_serial (over l for each element) so both round the same way, the row loop over the constant N becomes
+//a few full vectors without remainder handling
+template <int M, int N, int K, typename T>
+static void gemm_fixed(bool transa, bool transb, typename precision<T>::acc alpha, const T* A, int lda,
+	const T* B, int ldb, typename precision<T>::acc beta, T* C, int ldc)
+{
+	typedef typename precision<T>::acc acc;
+	acc a[M][K], b[K][N], c[M][N] = {};
+
+	for (int i = 0; i < M; i++)
+		for (int l = 0; l < K; l++) a[i][l] = op_at(A, lda, transa, i, l);
+	for (int l = 0; l < K; l++)
+		for (int j = 0; j < N; j++) b[l][j] = op_at(B, ldb, transb, l, j);
+
+	for (int i = 0; i < M; i++)
+		for (int l = 0; l < K; l++)
+			for (int j = 0; j < N; j++) c[i][j] += a[i][l] * b[l][j];
+
+	for (int i = 0; i < M; i++)
+		for (int j = 0; j < N; j++)
+		{
+			T* p = C + (size_t)i * ldc + j;
+			*p = precision<T>::store(beta == 0 ? alpha * c[i][j] : alpha * c[i][j] + beta * precision<T>::load(*p));
+		}
+}
+
+//the dispatch over the sizes of HOST_SMALL_SIZES
+template <typename T, int S, int... Rest>
+static bool gemm_fixed_square(bool transa, bool transb, int size, typename precision<T>::acc alpha, const T* A, int lda,
+	const T* B, int ldb, typename precision<T>::acc beta, T* C, int ldc)
+{
+	if (size == S)
+	{
+		gemm_fixed<S, S, S, T>(transa, transb, alpha, A, lda, B, ldb, beta, C, ldc);
+		return true;
+	}
+	if constexpr (sizeof...(Rest) > 0) return gemm_fixed_square<T, Rest...>(transa, transb, size, alpha, A, lda, B, ldb, beta, C, ldc);
+	return false;
+}
+
+template <typename T>
+bool host_gemm_small(bool transa, bool transb, int m, int n, int k, typename precision<T>::acc alpha, const T* A, int lda,
+	const T* B, int ldb, typename precision<T>::acc beta, T* C, int ldc)
+{
+	if (m != n || n != k) return false;
+	return gemm_fixed_square<T, HOST_SMALL_SIZES>(transa, transb, m, alpha, A, lda, B, ldb, beta, C, ldc);
+}
+
+template <typename T>
+void host_gemm_blocked(bool transa, bool transb, int m, int n, int k, typename precision<T>::acc alpha, const T* A, int lda,
+	const T* B, int ldb, typename precision<T>::acc beta, T* C, int ldc, int threads)
+{
+	if (host_gemm_small<T>(transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc)) return;
+
+	if (threads <= 0) threads = (int)std::thread::hardware_concurrency();
+	if (threads <= 0) threads = 1;
+	if (threads > m) threads = m;
+
+	if (threads <= 1)
+	{
+		blocked_panel<T>(transa, transb, 0, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc);
+		return;
+	}
+
+	std::vector<std::thread> workers;
+	for (int t = 0; t < threads; t++)
+	{
+		int i0 = (int)((long long)m * t / threads), i1 = (int)((long long)m * (t + 1) / threads);
+		workers.emplace_back(blocked_panel<T>, transa, transb, i0, i1, n, k, alpha, A, lda, B, ldb, beta, C, ldc);
+	}
+	for (std::thread& w : workers) w.join();
+}
+
+//products [b0, b1) of a batch
+template <typename T>
+static void batch_range(bool transa, bool transb, int b0, int b1, int m, int n, int k, typename precision<T>::acc alpha, const T* const* A, int lda,
+	const T* const* B, int ldb, typename precision<T>::acc beta, T* const* C, int ldc)
+{
+	for (int b = b0; b < b1; ++b)
+		if (!host_gemm_small<T>(transa, transb, m, n, k, alpha, A[b], lda, B[b], ldb, beta, C[b], ldc))
+			blocked_panel<T>(transa, transb, 0, m, n, k, alpha, A[b], lda, B[b], ldb, beta, C[b], ldc);
+}
+
+template <typename T>
+void host_gemm_batched(bool transa, bool transb, int m, int n, int k, typename precision<T>::acc alpha, const T* const* A, int lda,
+	const T* const* B, int ldb, typename precision<T>::acc beta, T* const* C, int ldc, int count, int threads)
+{
+	if (threads <= 0) threads = (int)std::thread::hardware_concurrency();
+	if (threads <= 0) threads = 1;
+	if (threads > count) threads = count;
+
+	if (threads <= 1)
+	{
+		batch_range<T>(transa, transb, 0, count, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc);
+		return;
+	}
+
+	std::vector<std::thread> workers;
+	for (int t = 0; t < threads; t++)
+	{
+		int b0 = (int)((long long)count * t / threads), b1 = (int)((long long)count * (t + 1) / threads);
+		workers.emplace_back(batch_range<T>, transa, transb, b0, b1, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc);
+	}
+	for (std::thread& w : workers) w.join();
+}
+
+template <typename T>
+static void batched_as(bool transa, bool transb, int m, int n, int k, double alpha, const void* A, int lda, size_t stride_a,
+	const void* B, int ldb, size_t stride_b, double beta, void* C, int ldc, size_t stride_c, int count, int threads)
+{
+	typedef typename precision<T>::acc acc;
+	std::vector<const T*> As(count), Bs(count);
+	std::vector<T*> Cs(count);
+
+	for (int b = 0; b < count; ++b)
+	{
+		As[b] = (const T*)A + b * stride_a;
+		Bs[b] = (const T*)B + b * stride_b;
+		Cs[b] = (T*)C + b * stride_c;
+	}
+	host_gemm_batched<T>(transa, transb, m, n, k, (acc)alpha, As.data(), lda, Bs.data(), ldb, (acc)beta, Cs.data(), ldc, count, threads);
+}
+
+void host_gemm_batched_dtype(int dtype, bool transa, bool transb, int m, int n, int k, double alpha, const void* A, int lda, size_t stride_a,
+	const void* B, int ldb, size_t stride_b, double beta, void* C, int ldc, size_t stride_c, int count, int threads)
+{
+	switch (dtype)
+	{
+	case DTYPE_DOUBLE: batched_as<double>(transa, transb, m, n, k, alpha, A, lda, stride_a, B, ldb, stride_b, beta, C, ldc, stride_c, count, threads); break;
+	case DTYPE_HALF: batched_as<half_t>(transa, transb, m, n, k, alpha, A, lda, stride_a, B, ldb, stride_b, beta, C, ldc, stride_c, count, threads); break;
+	case DTYPE_BF16: batched_as<bf16_t>(transa, transb, m, n, k, alpha, A, lda, stride_a, B, ldb, stride_b, beta, C, ldc, stride_c, count, threads); break;
+	default: batched_as<float>(transa, transb, m, n, k, alpha, A, lda, stride_a, B, ldb, stride_b, beta, C, ldc, stride_c, count, threads); break;
+	}
+}
+
+template <typename T>
+static void gemm_as(bool blocked, bool transa, bool transb, int m, int n, int k, double alpha, const void* A, int lda,
+	const void* B, int ldb, double beta, void* C, int ldc, int threads)
+{
+	typedef typename precision<T>::acc acc;
+
+	if (blocked) host_gemm_blocked<T>(transa, transb, m, n, k, (acc)alpha, (const T*)A, lda, (const T*)B, ldb, (acc)beta, (T*)C, ldc, threads);
+	else host_gemm_serial<T>(transa, transb, m, n, k, (acc)alpha, (const T*)A, lda, (const T*)B, ldb, (acc)beta, (T*)C, ldc);
+}
+
+void host_gemm_dtype(int dtype, bool blocked, bool transa, bool transb, int m, int n, int k, double alpha, const void* A, int lda,
+	const void* B, int ldb, double beta, void* C, int ldc, int threads)
+{
+	switch (dtype)
+	{
+	case DTYPE_DOUBLE: gemm_as<double>(blocked, transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, threads); break;
+	case DTYPE_HALF: gemm_as<half_t>(blocked, transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, threads); break;
+	case DTYPE_BF16: gemm_as<bf16_t>(blocked, transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, threads); break;
+	default: gemm_as<float>(blocked, transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, threads); break;
+	}
+}
+
+//the element types of precision.h
+#define INSTANTIATE(T) \
+	template void host_gemm_serial<T>(bool, bool, int, int, int, precision<T>::acc, const T*, int, const T*, int, precision<T>::acc, T*, int); \
+	template void host_gemm_blocked<T>(bool, bool, int, int, int, precision<T>::acc, const T*, int, const T*, int, precision<T>::acc, T*, int, int); \
+	template bool host_gemm_small<T>(bool, bool, int, int, int, precision<T>::acc, const T*, int, const T*, int, precision<T>::acc, T*, int); \
+	template void host_gemm_batched<T>(bool, bool, int, int, int, precision<T>::acc, const T* const*, int, const T* const*, int, precision<T>::acc, T* const*, int, int, int);
+INSTANTIATE(float)
+INSTANTIATE(double)
+INSTANTIATE(half_t)
+INSTANTIATE(bf16_t)
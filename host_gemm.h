@@ -0,0 +1,42 @@
+// host (CPU) matrix products on row major arrays with leading dimensions, same semantics as the kernels:
+// C = alpha * op(A) * op(B) + beta * C with op(A) m x k, op(B) k x n, C m x n, a transposed A is stored k x m
+// (B n x k) and read in place, C is not read when beta == 0
+// templated on the element type T (float, double, half_t, bf16_t of precision.h), the sums are formed in
+// precision<T>::acc and rounded to T once per element of C
+// used as reference for verification and as fallback when there is no OpenCL device
+
+#pragma once
+
+#include "precision.h"
+
+//the three nested loops of the original serial variant
+template <typename T>
+void host_gemm_serial(bool transa, bool transb, int m, int n, int k, typename precision<T>::acc alpha, const T* A, int lda,
+	const T* B, int ldb, typename precision<T>::acc beta, T* C, int ldc);
+
+//cache blocked i-k-j loops, the rows of C are split into panels over threads (0 means one per hardware thread)
+template <typename T>
+void host_gemm_blocked(bool transa, bool transb, int m, int n, int k, typename precision<T>::acc alpha, const T* A, int lda,
+	const T* B, int ldb, typename precision<T>::acc beta, T* C, int ldc, int threads);
+
+//products of the square sizes HOST_SMALL_SIZES specialized at compile time, the sizes are template arguments so
+//every loop has a constant trip count and unrolls, returns false (and does nothing) for any other shape,
+//host_gemm_blocked and host_gemm_batched try it first
+#define HOST_SMALL_SIZES 4, 8, 16, 32
+template <typename T>
+bool host_gemm_small(bool transa, bool transb, int m, int n, int k, typename precision<T>::acc alpha, const T* A, int lda,
+	const T* B, int ldb, typename precision<T>::acc beta, T* C, int ldc);
+
+//count independent products of the same shape, C[b] = alpha * op(A[b]) * op(B[b]) + beta * C[b], the batch is split
+//over threads (0 means one per hardware thread) and every product runs single threaded, which suits many small ones
+template <typename T>
+void host_gemm_batched(bool transa, bool transb, int m, int n, int k, typename precision<T>::acc alpha, const T* const* A, int lda,
+	const T* const* B, int ldb, typename precision<T>::acc beta, T* const* C, int ldc, int count, int threads);
+
+//strided batch with the element type known at run time, product b starts at element b * stride of A, B and C
+void host_gemm_batched_dtype(int dtype, bool transa, bool transb, int m, int n, int k, double alpha, const void* A, int lda, size_t stride_a,
+	const void* B, int ldb, size_t stride_b, double beta, void* C, int ldc, size_t stride_c, int count, int threads);
+
+//either of them for matrices whose element type is only known at run time
+void host_gemm_dtype(int dtype, bool blocked, bool transa, bool transb, int m, int n, int k, double alpha, const void* A, int lda,
+	const void* B, int ldb, double beta, void* C, int ldc, int threads);
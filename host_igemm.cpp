@@ -0,0 +1,167 @@
+#include "host_igemm.h"
+#include <string.h>
+
+#include <thread>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define IGEMM_X86 1 //the SIMD paths are compiled with target attributes and chosen at run time
+#else
+#define IGEMM_X86 0
+#endif
+
+#define IGEMM_COLS 4 //columns of C per pass over a row of A, the row stays in L1 for all of them
+
+static const char* isa_names[NUM_IGEMM_ISAS] = { "scalar", "avx2", "avx-vnni" };
+
+const char* igemm_isa_name(int isa)
+{
+	return isa >= 0 && isa < NUM_IGEMM_ISAS ? isa_names[isa] : "unknown";
+}
+
+bool igemm_isa_supported(int isa)
+{
+#if IGEMM_X86
+	if (isa == IGEMM_AVX2) return __builtin_cpu_supports("avx2");
+	if (isa == IGEMM_VNNI) return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("avxvnni");
+#endif
+	return isa == IGEMM_SCALAR;
+}
+
+int igemm_best_isa(void)
+{
+	for (int isa = NUM_IGEMM_ISAS - 1; isa > IGEMM_SCALAR; --isa)
+		if (igemm_isa_supported(isa)) return isa;
+
+	return IGEMM_SCALAR;
+}
+
+//dot products of row a with the rows b, b + ldb, ... (cols of them) over [l0, k)
+static void dot_scalar(const int8_t* a, const int8_t* b, size_t ldb, int cols, int l0, int k, int32_t* out)
+{
+	for (int q = 0; q < cols; ++q)
+	{
+		int32_t sum = 0;
+		for (int l = l0; l < k; ++l) sum += (int32_t)a[l] * b[q * ldb + l];
+		out[q] += sum;
+	}
+}
+
+#if IGEMM_X86
+__attribute__((target("avx2")))
+static int32_t hsum(__m256i v)
+{
+	__m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+	s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4e));
+	s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xb1));
+	return _mm_cvtsi128_si32(s);
+}
+
+//16 pairs per step: both operands sign extended to int16, vpmaddwd adds neighbouring products into int32
+__attribute__((target("avx2")))
+static void dot_avx2(const int8_t* a, const int8_t* b, size_t ldb, int cols, int k, const int32_t* bsum, int32_t* out)
+{
+	__m256i acc[IGEMM_COLS];
+	int l = 0;
+
+	for (int q = 0; q < cols; ++q) acc[q] = _mm256_setzero_si256();
+	for (; l + 16 <= k; l += 16)
+	{
+		__m256i va = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(a + l)));
+		for (int q = 0; q < cols; ++q)
+		{
+			__m256i vb = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(b + q * ldb + l)));
+			acc[q] = _mm256_add_epi32(acc[q], _mm256_madd_epi16(va, vb));
+		}
+	}
+	for (int q = 0; q < cols; ++q) out[q] = hsum(acc[q]);
+	dot_scalar(a, b, ldb, cols, l, k, out);
+}
+
+//32 pairs per step: vpdpbusd multiplies unsigned by signed bytes, so a + 128 is used and 128 * sum(b) subtracted,
+//bsum holds the sums of the rows of b over the part done here (k rounded down to 32)
+__attribute__((target("avx2,avxvnni")))
+static void dot_vnni(const int8_t* a, const int8_t* b, size_t ldb, int cols, int k, const int32_t* bsum, int32_t* out)
+{
+	__m256i acc[IGEMM_COLS];
+	const __m256i shift = _mm256_set1_epi8((char)0x80);
+	int l = 0;
+
+	for (int q = 0; q < cols; ++q) acc[q] = _mm256_setzero_si256();
+	for (; l + 32 <= k; l += 32)
+	{
+		__m256i va = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(a + l)), shift);
+		for (int q = 0; q < cols; ++q)
+			acc[q] = _mm256_dpbusd_avx_epi32(acc[q], va, _mm256_loadu_si256((const __m256i*)(b + q * ldb + l)));
+	}
+	for (int q = 0; q < cols; ++q) out[q] = hsum(acc[q]) - 128 * bsum[q];
+	dot_scalar(a, b, ldb, cols, l, k, out);
+}
+#endif
+
+static void dot_plain(const int8_t* a, const int8_t* b, size_t ldb, int cols, int k, const int32_t* bsum, int32_t* out)
+{
+	memset(out, 0, cols * sizeof(int32_t));
+	dot_scalar(a, b, ldb, cols, 0, k, out);
+}
+
+typedef void (*dot_fn)(const int8_t* a, const int8_t* b, size_t ldb, int cols, int k, const int32_t* bsum, int32_t* out);
+
+//rows [i0, i1) of C
+static void igemm_panel(dot_fn dot, int i0, int i1, int n, int k, const int8_t* A, int lda, const int8_t* Bt, int ldbt,
+	const int32_t* bsum, int32_t* C, int ldc)
+{
+	for (int i = i0; i < i1; ++i)
+		for (int j = 0; j < n; j += IGEMM_COLS)
+		{
+			int cols = n - j < IGEMM_COLS ? n - j : IGEMM_COLS;
+			dot(A + (size_t)i * lda, Bt + (size_t)j * ldbt, ldbt, cols, k, bsum + j, C + (size_t)i * ldc + j);
+		}
+}
+
+void host_igemm_bt(int m, int n, int k, const int8_t* A, int lda, const int8_t* Bt, int ldbt, int32_t* C, int ldc, int isa, int threads)
+{
+	dot_fn dot = dot_plain;
+	std::vector<int32_t> bsum(n, 0);
+
+	if (isa < 0) isa = igemm_best_isa();
+	if (!igemm_isa_supported(isa)) isa = IGEMM_SCALAR;
+#if IGEMM_X86
+	if (isa == IGEMM_AVX2) dot = dot_avx2;
+	if (isa == IGEMM_VNNI)
+	{
+		dot = dot_vnni;
+		for (int j = 0; j < n; ++j)
+			for (int l = 0; l < (k & ~31); ++l) bsum[j] += Bt[(size_t)j * ldbt + l];
+	}
+#endif
+
+	if (threads <= 0) threads = (int)std::thread::hardware_concurrency();
+	if (threads <= 0) threads = 1;
+	if (threads > m) threads = m;
+
+	if (threads <= 1)
+	{
+		igemm_panel(dot, 0, m, n, k, A, lda, Bt, ldbt, bsum.data(), C, ldc);
+		return;
+	}
+
+	std::vector<std::thread> workers;
+	for (int t = 0; t < threads; t++)
+	{
+		int i0 = (int)((long long)m * t / threads), i1 = (int)((long long)m * (t + 1) / threads);
+		workers.emplace_back(igemm_panel, dot, i0, i1, n, k, A, lda, Bt, ldbt, bsum.data(), C, ldc);
+	}
+	for (std::thread& w : workers) w.join();
+}
+
+void host_igemm(int m, int n, int k, const int8_t* A, int lda, const int8_t* B, int ldb, int32_t* C, int ldc, int isa, int threads)
+{
+	std::vector<int8_t> Bt((size_t)n * k);
+
+	for (int l = 0; l < k; ++l)
+		for (int j = 0; j < n; ++j) Bt[(size_t)j * k + l] = B[(size_t)l * ldb + j];
+
+	host_igemm_bt(m, n, k, A, lda, Bt.data(), k, C, ldc, isa, threads);
+}
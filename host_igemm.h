@@ -0,0 +1,26 @@
+// exact integer products on the host: int8 A and B, int32 C = A * B, row major with leading dimensions
+// B is packed transposed once, so both operands of every dot product are contiguous and the SIMD paths can
+// multiply 16 (AVX2) or 32 (AVX-VNNI) pairs per instruction, the sums are exact as long as k * 127 * 128 < 2^31
+
+#pragma once
+
+#include <stdint.h>
+
+enum igemm_isa
+{
+	IGEMM_SCALAR,
+	IGEMM_AVX2,     //sign extension to int16 and vpmaddwd
+	IGEMM_VNNI,     //vpdpbusd of AVX-VNNI, A is shifted to unsigned and the shift is subtracted again
+	NUM_IGEMM_ISAS
+};
+
+//best instruction set the CPU supports
+int igemm_best_isa(void);
+bool igemm_isa_supported(int isa);
+const char* igemm_isa_name(int isa);
+
+//C = A * B with A m x k and B k x n, isa < 0 picks the best one, threads as in host_gemm_blocked
+void host_igemm(int m, int n, int k, const int8_t* A, int lda, const int8_t* B, int ldb, int32_t* C, int ldc, int isa, int threads);
+
+//the same with B already transposed (n x k, ldbt >= k)
+void host_igemm_bt(int m, int n, int k, const int8_t* A, int lda, const int8_t* Bt, int ldbt, int32_t* C, int ldc, int isa, int threads);
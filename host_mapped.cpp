@@ -0,0 +1,252 @@
+#include "host_mapped.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <thread>
+
+#include "host_gemm.h"
+
+#define MAPPED_MIN_CHUNK 256 //k is only cut below this many rows of B when even one row of C does not fit otherwise
+
+bool mapped_open(mapped_matrix* mm, const char* path, int rows, int cols, int dtype, bool create)
+{
+	size_t bytes = (size_t)rows * cols * dtype_size(dtype);
+	struct stat st;
+
+	memset(mm, 0, sizeof(*mm));
+	mm->fd = -1;
+	if (rows <= 0 || cols <= 0)
+	{
+		printf("Invalid matrix size %d x %d for %s\n", rows, cols, path);
+		return false;
+	}
+
+	int fd = open(path, create ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+	if (fd < 0)
+	{
+		printf("Unable to open %s\n", path);
+		return false;
+	}
+	if (create ? ftruncate(fd, (off_t)bytes) != 0 : fstat(fd, &st) != 0 || (size_t)st.st_size < bytes)
+	{
+		printf("%s does not hold %d x %d %s elements\n", path, rows, cols, dtype_name(dtype));
+		close(fd);
+		return false;
+	}
+
+	void* data = mmap(NULL, bytes, create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED)
+	{
+		printf("Unable to map %s\n", path);
+		close(fd);
+		return false;
+	}
+
+	mm->data = data;
+	mm->bytes = bytes;
+	mm->rows = rows;
+	mm->cols = cols;
+	mm->dtype = dtype;
+	mm->fd = fd;
+	mm->writable = create;
+	return true;
+}
+
+void mapped_close(mapped_matrix* mm)
+{
+	if (mm->data != NULL)
+	{
+		if (mm->writable) msync(mm->data, mm->bytes, MS_SYNC);
+		munmap(mm->data, mm->bytes);
+	}
+	if (mm->fd >= 0) close(mm->fd);
+	memset(mm, 0, sizeof(*mm));
+	mm->fd = -1;
+}
+
+static const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+//bytes [first, last) of a mapped matrix, the start rounded down to a page as madvise wants it
+struct row_range
+{
+	char* start;
+	size_t len;
+	char* first;    //the byte first itself, reads start here, the bytes before it may belong to rows in use elsewhere
+};
+
+static row_range bytes_of(const mapped_matrix* mm, size_t first, size_t last)
+{
+	size_t begin = first / page * page;
+	row_range r = { (char*)mm->data + begin, last > begin ? last - begin : 0, (char*)mm->data + first };
+
+	return r;
+}
+
+static row_range rows_of(const mapped_matrix* mm, size_t first, size_t last)
+{
+	size_t row_bytes = (size_t)mm->cols * dtype_size(mm->dtype);
+
+	return bytes_of(mm, first * row_bytes, last * row_bytes);
+}
+
+static void advise(row_range r, int advice)
+{
+	if (r.len > 0) madvise(r.start, r.len, advice);
+}
+
+//rows [r0, r1) and columns [c0, c1) of a matrix as stored, whole rows are one range of the mapping and a slab of
+//columns (of a transposed operand) one range per row
+struct mapped_slab
+{
+	const mapped_matrix* mm;
+	size_t r0, r1, c0, c1;
+};
+
+//madvise on the pages of a slab and, with read, one read per page, so it is resident before the product gets to it
+static void slab_advise(mapped_slab s, int advice, bool read)
+{
+	size_t es = dtype_size(s.mm->dtype), row_bytes = (size_t)s.mm->cols * es;
+	volatile char sink = 0;
+
+	for (size_t r = s.r0; r < s.r1; ++r)
+	{
+		bool whole = s.c0 == 0 && s.c1 == (size_t)s.mm->cols;
+		row_range part = whole ? rows_of(s.mm, s.r0, s.r1) : bytes_of(s.mm, r * row_bytes + s.c0 * es, r * row_bytes + s.c1 * es);
+
+		advise(part, advice);
+		if (read && part.start + part.len > part.first)
+		{
+			sink += *part.first;
+			for (size_t o = page; o < part.len; o += page)
+				if (part.start + o > part.first) sink += part.start[o];
+			sink += part.start[part.len - 1];
+		}
+		if (whole) break;
+	}
+	(void)sink;
+}
+
+static void prefetch(mapped_slab s)
+{
+	slab_advise(s, MADV_WILLNEED, true);
+}
+
+//a read fault maps the cached pages around it as well (fault-around), which brings back pages of slabs to the left
+//that were released before, so a release takes each row from its start to the end of the slab
+static void release(mapped_slab s)
+{
+	s.c0 = 0;
+	slab_advise(s, MADV_DONTNEED, false);
+}
+
+//what one step reads: columns k0..k1 of the panel of rows of A (rows k0..k1 and columns i0..i1 of a transposed A),
+//rows k0..k1 of B (columns k0..k1 of a transposed B) and the panel of rows of C
+struct mapped_step
+{
+	mapped_slab a, b, c;
+};
+
+static mapped_step step_ranges(bool transa, bool transb, const mapped_matrix* A, const mapped_matrix* B, const mapped_matrix* C,
+	size_t i0, size_t i1, size_t k0, size_t k1)
+{
+	mapped_step s;
+
+	s.a = transa ? mapped_slab{ A, k0, k1, i0, i1 } : mapped_slab{ A, i0, i1, k0, k1 };
+	s.b = transb ? mapped_slab{ B, 0, (size_t)B->rows, k0, k1 } : mapped_slab{ B, k0, k1, 0, (size_t)B->cols };
+	s.c = mapped_slab{ C, i0, i1, 0, (size_t)C->cols };
+	return s;
+}
+
+//bytes a slab of rows x cols elements keeps resident when each of its rows is a part of a stored row of row_cols
+//elements: whole pages, and a page more where the part does not start on one
+static size_t slab_bytes(size_t rows, size_t cols, size_t row_cols, size_t es)
+{
+	if (cols >= row_cols) return rows * cols * es;
+	size_t part = (cols * es + page - 1) / page * page + page;
+	return rows * (part < row_cols * es ? part : row_cols * es);
+}
+
+bool host_gemm_mapped(bool transa, bool transb, double alpha, const mapped_matrix* A, const mapped_matrix* B, double beta,
+	mapped_matrix* C, size_t budget, int threads)
+{
+	int m = C->rows, n = C->cols, k = transa ? A->rows : A->cols;
+
+	if ((transa ? A->cols : A->rows) != m || (transb ? B->rows : B->cols) != n || (transb ? B->cols : B->rows) != k)
+	{
+		printf("Mapped matrices do not fit: A %d x %d, B %d x %d, C %d x %d\n", A->rows, A->cols, B->rows, B->cols, m, n);
+		return false;
+	}
+	if (A->dtype != C->dtype || B->dtype != C->dtype || !C->writable)
+	{
+		printf("Mapped matrices need one element type and a writable C\n");
+		return false;
+	}
+	if (budget == 0) budget = MAPPED_BUDGET;
+
+	// a panel of pm rows of C and A and a chunk of kc rows of B per step, B is read once per panel so the panel
+	// shrinks last; a transposed operand is read in slabs of columns, whose rows take whole pages
+	size_t es = dtype_size(C->dtype), rows = (size_t)m, depth = (size_t)k, pm = rows, kc = depth;
+	auto step_bytes = [&](size_t panel, size_t chunk)
+	{
+		size_t a_bytes = transa ? slab_bytes(chunk, panel, rows, es) : slab_bytes(panel, chunk, depth, es);
+		size_t b_bytes = transb ? slab_bytes(n, chunk, depth, es) : chunk * n * es;
+		return a_bytes + b_bytes + panel * n * es;
+	};
+	// stored rows shorter than a page are read whole however narrow the slab, kc only shrinks while that helps
+	while (step_bytes(pm, kc) > budget && kc > MAPPED_MIN_CHUNK && step_bytes(pm, (kc + 1) / 2) < step_bytes(pm, kc)) kc = (kc + 1) / 2;
+	while (step_bytes(pm, kc) > budget && pm > 1) pm = (pm + 1) / 2;
+	while (step_bytes(pm, kc) > budget && kc > 1 && step_bytes(pm, (kc + 1) / 2) < step_bytes(pm, kc)) kc = (kc + 1) / 2;
+
+	if (!transb) advise(rows_of(B, 0, B->rows), MADV_SEQUENTIAL);
+
+	const char* a = (const char*)A->data, *b = (const char*)B->data;
+	char* c = (char*)C->data;
+	std::thread prefetcher;
+	for (size_t i0 = 0; i0 < rows; i0 += pm)
+	{
+		size_t i1 = i0 + pm < rows ? i0 + pm : rows;
+
+		for (size_t k0 = 0; k0 < depth; k0 += kc)
+		{
+			size_t k1 = k0 + kc < depth ? k0 + kc : depth;
+			mapped_step now = step_ranges(transa, transb, A, B, C, i0, i1, k0, k1);
+
+			// the next step is the next chunk of this panel or the first one of the next panel, its pages come in
+			// on the prefetch thread while this one multiplies, C only for a new panel: the rows of this one are
+			// resident and the product writes them meanwhile
+			if (prefetcher.joinable()) prefetcher.join();
+			size_t next_i = k1 < depth ? i0 : i1, next_k = k1 < depth ? k1 : 0;
+			if (next_i < rows)
+			{
+				mapped_step next = step_ranges(transa, transb, A, B, C, next_i, next_i + pm < rows ? next_i + pm : rows,
+					next_k, next_k + kc < depth ? next_k + kc : depth);
+				bool panel = next_i != i0;
+				prefetcher = std::thread([next, panel]() { prefetch(next.b); prefetch(next.a); if (panel) prefetch(next.c); });
+			}
+			slab_advise(now.a, MADV_WILLNEED, false);
+			slab_advise(now.b, MADV_WILLNEED, false);
+			slab_advise(now.c, MADV_WILLNEED, false);
+
+			const char* ap = transa ? a + (k0 * m + i0) * es : a + (i0 * k + k0) * es;
+			const char* bp = transb ? b + k0 * es : b + k0 * n * es;
+			host_gemm_dtype(C->dtype, true, transa, transb, (int)(i1 - i0), n, (int)(k1 - k0), alpha, ap, transa ? m : k,
+				bp, transb ? k : n, k0 == 0 ? beta : 1.0, c + i0 * n * es, n, threads);
+
+			// the slab of A is not needed again, with k in chunks a chunk of B not before the next panel
+			release(now.a);
+			if (kc < depth) release(now.b);
+		}
+
+		// the panel is done: C goes to the file in the background and its pages can go
+		row_range done = rows_of(C, i0, i1);
+		if (done.len > 0) msync(done.start, done.len, MS_ASYNC);
+		advise(done, MADV_DONTNEED);
+	}
+	if (prefetcher.joinable()) prefetcher.join();
+
+	return true;
+}
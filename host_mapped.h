@@ -0,0 +1,37 @@
+// out-of-core host product on matrix files mapped into memory, for matrices larger than physical memory:
+// C is computed in panels of rows and k in chunks, so only a panel of A and C and a chunk of rows of B are needed
+// at a time, they are read with readahead hints (madvise) while a prefetch thread pulls in the next chunk, and
+// finished parts are written back and released, B is read front to back once per panel of C
+// a transposed operand is read in slabs of its stored columns, only the pages of the slab are read and released
+// the files hold the elements row major without anything else, rows x cols of dtype_size() bytes (POSIX only)
+
+#pragma once
+
+#include <stddef.h>
+
+#include "precision.h"
+
+#define MAPPED_BUDGET (256u << 20) //default bytes of A, B and C a step works on
+
+struct mapped_matrix
+{
+	void* data;
+	size_t bytes;
+	int rows, cols;
+	int dtype;
+	int fd;
+	bool writable;
+};
+
+//maps a rows x cols matrix file, create makes (or resizes) it and maps it writable, otherwise the file has to be
+//at least rows x cols elements long and is mapped read only, prints the reason and returns false on failure
+bool mapped_open(mapped_matrix* mm, const char* path, int rows, int cols, int dtype, bool create);
+
+//writes back a writable mapping and unmaps it
+void mapped_close(mapped_matrix* mm);
+
+//C = alpha * op(A) * op(B) + beta * C on mapped files of one element type, the shapes follow from the matrices as
+//stored (A is k x m when transposed, B n x k), budget bounds the bytes one step touches (0 takes MAPPED_BUDGET)
+//and threads is that of host_gemm_blocked, prints the reason and returns false if the shapes do not fit
+bool host_gemm_mapped(bool transa, bool transb, double alpha, const mapped_matrix* A, const mapped_matrix* B, double beta,
+	mapped_matrix* C, size_t budget, int threads);
@@ -0,0 +1,236 @@
+// compile in Linux with gcc:
+// g++ kernelc.cpp ocl.cpp kernels.cpp precision.cpp -o kernelc -lOpenCL
+// offline compiler of KernelSource: builds the program of every --size and --dtype given (default 1000 and float)
+// with the build options the driver and the library would use, and writes the results as the table of prebuilt.h
+// (-o <file>, default prebuilt_data.cpp), exits with 1 if any of them does not compile
+// binaries come from the runtime compiler of the OpenCL device (skipped with --no-device), --spirv <clang> also
+// compiles SPIR-V modules with that clang, which needs the SPIR-V target (clang 20) or llvm-spirv next to it
+// --vec, --tile, --wpt, --no-pad, --stage-bt, --transa and --transb are those of the driver
+
+#include "CL/cl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "kernels.h"
+#include "ocl.h"
+#include "prebuilt.h" //only for PREBUILT_*
+#include "precision.h"
+
+#define MAX_CONFIGS 64
+#define SPIRV_FLAGS "-c -target spirv64 -cl-std=CL2.0 -Xclang -finclude-default-header -O2"
+#define SPIRV_SOURCE "kernelc_tmp.cl"
+#define SPIRV_MODULE "kernelc_tmp.spv"
+
+struct compiled_program
+{
+	std::string options;
+	int format;                 //PREBUILT_*
+	std::string device, driver;
+	std::vector<unsigned char> data;
+};
+
+static bool read_file(const char* path, std::vector<unsigned char>* data)
+{
+	FILE* f = fopen(path, "rb");
+	if (f == NULL) return false;
+
+	unsigned char chunk[65536];
+	size_t got;
+	data->clear();
+	while ((got = fread(chunk, 1, sizeof(chunk), f)) > 0) data->insert(data->end(), chunk, chunk + got);
+	fclose(f);
+
+	return !data->empty();
+}
+
+//KernelSource through clang, the -D options are the same as for the runtime compiler
+static bool compile_spirv(const char* clang, const char* options, std::vector<unsigned char>* data)
+{
+	FILE* f = fopen(SPIRV_SOURCE, "w");
+	if (f == NULL)
+	{
+		printf("Unable to write %s\n", SPIRV_SOURCE);
+		return false;
+	}
+	fputs(KernelSource, f);
+	fclose(f);
+
+	std::string command = std::string(clang) + " " + SPIRV_FLAGS + " " + options + " -o " SPIRV_MODULE " " SPIRV_SOURCE;
+	int status = system(command.c_str());
+	bool ok = status == 0 && read_file(SPIRV_MODULE, data);
+	if (!ok) printf("SPIR-V compilation failed (%d): %s\n", status, command.c_str());
+
+	remove(SPIRV_SOURCE);
+	remove(SPIRV_MODULE);
+	return ok;
+}
+
+static void write_string(FILE* f, const std::string& s)
+{
+	fputc('"', f);
+	for (char c : s)
+	{
+		if (c == '"' || c == '\\') fputc('\\', f);
+		if (c != '\n') fputc(c, f);
+	}
+	fputc('"', f);
+}
+
+static bool write_table(const char* path, const std::vector<compiled_program>& programs)
+{
+	FILE* f = fopen(path, "w");
+	if (f == NULL)
+	{
+		printf("Unable to write %s\n", path);
+		return false;
+	}
+
+	fprintf(f, "// written by kernelc, %d programs%s\n", (int)programs.size(), programs.empty() ? ", everything is built from source" : "");
+	fprintf(f, "#include \"prebuilt.h\"\n\n");
+	for (size_t p = 0; p < programs.size(); ++p)
+	{
+		fprintf(f, "static const unsigned char program%zu[] =\n{", p);
+		for (size_t i = 0; i < programs[p].data.size(); ++i)
+			fprintf(f, "%s0x%02x,", i % 16 == 0 ? "\n\t" : " ", programs[p].data[i]);
+		fprintf(f, "\n};\n\n");
+	}
+
+	fprintf(f, "const prebuilt_program prebuilt_programs[] =\n{\n");
+	for (size_t p = 0; p < programs.size(); ++p)
+	{
+		fprintf(f, "\t{ ");
+		write_string(f, programs[p].options);
+		fprintf(f, ", %s, ", programs[p].format == PREBUILT_SPIRV ? "PREBUILT_SPIRV" : "PREBUILT_BINARY");
+		write_string(f, programs[p].device);
+		fprintf(f, ", ");
+		write_string(f, programs[p].driver);
+		fprintf(f, ", program%zu, sizeof(program%zu) },\n", p, p);
+	}
+	fprintf(f, "\t{ \"\", PREBUILT_BINARY, \"\", \"\", NULL, 0 } //end of the table, not counted\n};\n");
+	fprintf(f, "const int num_prebuilt_programs = %d;\n", (int)programs.size());
+	fclose(f);
+
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	int sizes[MAX_CONFIGS][3], dtypes[NUM_DTYPES];
+	int num_sizes = 0, num_dtypes = 0;
+	int vec = 4, tile = 16, wpt = 4, pad = 1, stage_bt = 0, transa = 0, transb = 0;
+	bool use_device = true;
+	const char* clang = NULL;
+	const char* out = "prebuilt_data.cpp";
+
+	for (int a = 1; a < argc; ++a)
+	{
+		if (strcmp(argv[a], "--size") == 0 && a + 1 < argc && num_sizes < MAX_CONFIGS)
+		{
+			int* s = sizes[num_sizes++];
+			if (sscanf(argv[++a], "%dx%dx%d", &s[0], &s[1], &s[2]) != 3)
+				s[0] = s[1] = s[2] = atoi(argv[a]);
+		}
+		else if (strcmp(argv[a], "--dtype") == 0 && a + 1 < argc && dtype_from_name(argv[a + 1]) >= 0 && num_dtypes < NUM_DTYPES)
+			dtypes[num_dtypes++] = dtype_from_name(argv[++a]);
+		else if (strcmp(argv[a], "--vec") == 0 && a + 1 < argc) vec = atoi(argv[++a]);
+		else if (strcmp(argv[a], "--tile") == 0 && a + 1 < argc) tile = atoi(argv[++a]);
+		else if (strcmp(argv[a], "--wpt") == 0 && a + 1 < argc) wpt = atoi(argv[++a]);
+		else if (strcmp(argv[a], "--no-pad") == 0) pad = 0;
+		else if (strcmp(argv[a], "--stage-bt") == 0) stage_bt = 1;
+		else if (strcmp(argv[a], "--transa") == 0) transa = 1;
+		else if (strcmp(argv[a], "--transb") == 0) transb = 1;
+		else if (strcmp(argv[a], "--no-device") == 0) use_device = false;
+		else if (strcmp(argv[a], "--spirv") == 0 && a + 1 < argc) clang = argv[++a];
+		else if (strcmp(argv[a], "-o") == 0 && a + 1 < argc) out = argv[++a];
+		else
+		{
+			printf("usage: %s [--size <n>|<m>x<n>x<k>]... [--dtype <float|double|half|bf16>]... [--vec <2|4|8|16>] [--tile <4|8|16|32>]\n"
+				"       [--wpt <1|2|4|8>] [--no-pad] [--stage-bt] [--transa] [--transb] [--no-device] [--spirv <clang>] [-o <file>]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (num_sizes == 0)
+	{
+		sizes[0][0] = sizes[0][1] = sizes[0][2] = 1000;
+		num_sizes = 1;
+	}
+	if (num_dtypes == 0) dtypes[num_dtypes++] = DTYPE_FLOAT;
+
+	ocl_env env;
+	char device[256] = "", driver[256] = "";
+	if (use_device)
+	{
+		use_device = ocl_init(&env);
+		if (use_device)
+		{
+			clGetDeviceInfo(env.device, CL_DEVICE_NAME, sizeof(device), device, NULL);
+			clGetDeviceInfo(env.device, CL_DRIVER_VERSION, sizeof(driver), driver, NULL);
+			printf("Compiling for %s (driver %s)\n", device, driver);
+		}
+	}
+	if (!use_device && clang == NULL)
+	{
+		printf("Nothing to compile with, there is no OpenCL device and no --spirv <clang>\n");
+		return 1;
+	}
+
+	std::vector<compiled_program> programs;
+	int failed = 0;
+	for (int d = 0; d < num_dtypes; ++d)
+		for (int s = 0; s < num_sizes; ++s)
+		{
+			kernel_params p;
+			char options[512];
+
+			printf("%s %d x %d x %d: ", dtype_name(dtypes[d]), sizes[s][0], sizes[s][1], sizes[s][2]);
+			if (!kernel_params_init(&p, dtypes[d], sizes[s][0], sizes[s][1], sizes[s][2], transa, transb, vec, tile, wpt, pad, stage_bt))
+			{
+				++failed;
+				continue;
+			}
+			kernel_build_options(&p, options, sizeof(options));
+
+			if (use_device && dtypes[d] == DTYPE_DOUBLE && !ocl_has_extension(&env, "cl_khr_fp64"))
+				printf("no binary, the device does not support double precision (cl_khr_fp64) ");
+			else if (use_device)
+			{
+				cl_int err;
+				cl_program program = ocl_build(&env, KernelSource, options, &err);
+				compiled_program c = { options, PREBUILT_BINARY, device, driver, std::vector<unsigned char>() };
+				size_t size = 0;
+				unsigned char* binary = program != NULL ? ocl_program_binary(program, &size) : NULL;
+
+				if (binary != NULL)
+				{
+					c.data.assign(binary, binary + size);
+					programs.push_back(c);
+					printf("binary of %zu bytes ", size);
+				}
+				else ++failed;
+				free(binary);
+				if (program != NULL) clReleaseProgram(program);
+			}
+
+			if (clang != NULL)
+			{
+				compiled_program c = { options, PREBUILT_SPIRV, "", "", std::vector<unsigned char>() };
+				if (compile_spirv(clang, options, &c.data))
+				{
+					programs.push_back(c);
+					printf("SPIR-V of %zu bytes", c.data.size());
+				}
+				else ++failed;
+			}
+			printf("\n");
+		}
+	if (use_device) ocl_release(&env);
+
+	if (!write_table(out, programs)) return 1;
+	printf("%d programs written to %s, %d failed\n", (int)programs.size(), out, failed);
+
+	return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,246 @@
+#include "kernelgen.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <map>
+
+#define GEN_LOCAL_MEM 32768 //bytes of local memory every OpenCL 1.2 GPU has
+
+static bool is_pow2(int x)
+{
+	return x > 0 && (x & (x - 1)) == 0;
+}
+
+bool gen_params_init(gen_params* g, int dtype, int m, int n, int k, int transa, int transb, int tile_m, int tile_n, int tile_k,
+	int wpt_m, int wpt_n, int vec, int pad, int epilogue)
+{
+	g->dtype = dtype;
+	g->m = m; g->n = n; g->k = k;
+	g->transa = transa ? 1 : 0; g->transb = transb ? 1 : 0;
+	g->tile_m = tile_m; g->tile_n = tile_n; g->tile_k = tile_k;
+	g->wpt_m = wpt_m; g->wpt_n = wpt_n;
+	g->vec = vec;
+	g->pad = pad ? 1 : 0;
+	g->epilogue = epilogue;
+
+	if (dtype < 0 || dtype >= NUM_DTYPES || epilogue < 0 || epilogue >= NUM_GEN_EPILOGUES)
+		printf("Unknown element type or epilogue\n");
+	else if (m <= 0 || n <= 0 || k <= 0)
+		printf("Matrix sizes must be positive\n");
+	else if (vec != 1 && vec != 2 && vec != 4 && vec != 8)
+		printf("Vector width must be 1, 2, 4 or 8\n");
+	else if (wpt_m <= 0 || wpt_n <= 0 || !is_pow2(tile_m) || !is_pow2(tile_n) || tile_m % wpt_m != 0 || tile_n % wpt_n != 0 || wpt_n % vec != 0)
+		printf("Tiles must be powers of 2 divided by the work per item, which the vector width must divide\n");
+	else if (tile_k < 1 || tile_k > 64)
+		printf("The step along k must be between 1 and 64\n");
+	else if ((tile_m / wpt_m) * (tile_n / wpt_n) > GEN_MAX_GROUP)
+		printf("Work group of %d x %d exceeds %d work items\n", tile_n / wpt_n, tile_m / wpt_m, GEN_MAX_GROUP);
+	else if (gen_local_mem(g) > GEN_LOCAL_MEM)
+		printf("Tiles need %zu bytes of local memory, more than %d\n", gen_local_mem(g), GEN_LOCAL_MEM);
+	else
+		return true;
+	return false;
+}
+
+void gen_label(const gen_params* g, char* label, size_t len)
+{
+	static const char* epilogues[NUM_GEN_EPILOGUES] = { "", "_store", "_relu" };
+	int used = snprintf(label, len, "gen_t%dx%dx%d_w%dx%d_v%d%s", g->tile_m, g->tile_n, g->tile_k, g->wpt_m, g->wpt_n, g->vec, g->pad ? "_pad" : "");
+
+	if (g->transa || g->transb) used += snprintf(label + used, len - used, "_%c%c", g->transa ? 't' : 'n', g->transb ? 't' : 'n');
+	if (g->dtype != DTYPE_FLOAT) used += snprintf(label + used, len - used, "_%s", dtype_name(g->dtype));
+	used += snprintf(label + used, len - used, "%s", epilogues[g->epilogue]);
+	if (g->m == g->n && g->n == g->k) snprintf(label + used, len - used, "_%d", g->n);
+	else snprintf(label + used, len - used, "_%dx%dx%d", g->m, g->n, g->k);
+}
+
+size_t gen_local_mem(const gen_params* g)
+{
+	return (size_t)g->tile_k * (g->tile_m + g->pad + g->tile_n + g->pad) * dtype_acc_size(g->dtype);
+}
+
+void gen_geometry(const gen_params* g, size_t* global, size_t* local)
+{
+	local[0] = g->tile_n / g->wpt_n;
+	local[1] = g->tile_m / g->wpt_m;
+	global[0] = (size_t)((g->n + g->tile_n - 1) / g->tile_n) * local[0];
+	global[1] = (size_t)((g->m + g->tile_m - 1) / g->tile_m) * local[1];
+}
+
+//appends one formatted piece of source
+static void emit(std::string& s, const char* fmt, ...)
+{
+	char line[512];
+	va_list args;
+
+	va_start(args, fmt);
+	vsnprintf(line, sizeof(line), fmt, args);
+	va_end(args);
+	s += line;
+}
+
+//element access and rounding of the stored type, the same as in KernelSource
+static void emit_types(std::string& s, const gen_params* g)
+{
+	switch (g->dtype)
+	{
+	case DTYPE_DOUBLE:
+		emit(s, "#pragma OPENCL EXTENSION cl_khr_fp64 : enable\n");
+		emit(s, "#define LD(p, i) (p)[i]\n#define ST(p, i, v) (p)[i] = (v)\n");
+		break;
+	case DTYPE_HALF:
+		emit(s, "#define LD(p, i) vload_half(i, p)\n#define ST(p, i, v) vstore_half_rte(v, i, p)\n");
+		break;
+	case DTYPE_BF16:
+		emit(s, "ushort bf16_round(float f)\n{\n"
+			"\tuint u = as_uint(f);\n"
+			"\tif ((u & 0x7fffffff) > 0x7f800000) return (ushort)((u >> 16) | 0x40);\n"
+			"\treturn (ushort)((u + 0x7fff + ((u >> 16) & 1)) >> 16);\n}\n");
+		emit(s, "#define LD(p, i) as_float((uint)(p)[i] << 16)\n#define ST(p, i, v) (p)[i] = bf16_round(v)\n");
+		break;
+	default:
+		emit(s, "#define LD(p, i) (p)[i]\n#define ST(p, i, v) (p)[i] = (v)\n");
+		break;
+	}
+}
+
+static void emit_epilogue(std::string& s, const gen_params* g, const char* acc)
+{
+	char idx[64];
+
+	snprintf(idx, sizeof(idx), "(i) * %d + (j)", g->n);
+	emit(s, "#define STORE(i, j, v) if ((i) < %d && (j) < %d) ", g->m, g->n);
+	switch (g->epilogue)
+	{
+	case GEN_EPILOGUE_STORE:
+		emit(s, "ST(Cp, %s, alpha * (v))\n", idx);
+		break;
+	case GEN_EPILOGUE_RELU:
+		emit(s, "ST(Cp, %s, max(beta == 0 ? alpha * (v) : alpha * (v) + beta * LD(Cp, %s), (%s)0))\n", idx, idx, acc);
+		break;
+	default:
+		emit(s, "ST(Cp, %s, beta == 0 ? alpha * (v) : alpha * (v) + beta * LD(Cp, %s))\n", idx, idx);
+		break;
+	}
+}
+
+std::string gen_source(const gen_params* g)
+{
+	static const char* reals[NUM_DTYPES] = { "float", "double", "half", "ushort" };
+	const char* real = reals[g->dtype];
+	const char* acc = g->dtype == DTYPE_DOUBLE ? "double" : "float";
+	int rm = g->tile_m / g->wpt_m, rn = g->tile_n / g->wpt_n, nv = g->wpt_n / g->vec, group = rm * rn;
+	char accv[16], label[128];
+	std::string s;
+
+	snprintf(accv, sizeof(accv), g->vec > 1 ? "%s%d" : "%s", acc, g->vec);
+	gen_label(g, label, sizeof(label));
+	emit(s, "// %s, generated by kernelgen.cpp\n", label);
+	emit_types(s, g);
+	if (g->transa) emit(s, "#define A_(i, k) LD(Ap, (k) * %d + (i))\n", g->m);
+	else emit(s, "#define A_(i, k) LD(Ap, (i) * %d + (k))\n", g->k);
+	if (g->transb) emit(s, "#define B_(k, j) LD(Bp, (j) * %d + (k))\n", g->k);
+	else emit(s, "#define B_(k, j) LD(Bp, (k) * %d + (j))\n", g->n);
+	emit_epilogue(s, g, acc);
+
+	emit(s, "__kernel __attribute__((reqd_work_group_size(%d, %d, 1)))\n", rn, rm);
+	emit(s, "void " GEN_ENTRY "(__global const %s* Ap, __global const %s* Bp, __global %s* Cp, %s alpha, %s beta)\n{\n", real, real, real, acc, acc);
+	emit(s, "\t__local %s Al[%d][%d];\n", acc, g->tile_k, g->tile_m + g->pad);
+	emit(s, "\t__local %s Bl[%d][%d];\n", acc, g->tile_k, g->tile_n + g->pad);
+	emit(s, "\tint lj = get_local_id(0), li = get_local_id(1), tid = li * %d + lj;\n", rn);
+	emit(s, "\tint i0 = get_group_id(1) * %d, j0 = get_group_id(0) * %d;\n", g->tile_m, g->tile_n);
+	emit(s, "\t%s acc[%d][%d];\n", accv, g->wpt_m, nv);
+	emit(s, "\tfor (int r = 0; r < %d; ++r)\n\t\tfor (int c = 0; c < %d; ++c) acc[r][c] = (%s)(0);\n", g->wpt_m, nv, accv);
+	emit(s, "\tfor (int k0 = 0; k0 < %d; k0 += %d)\n\t{\n", g->k, g->tile_k);
+
+	//tile loads, consecutive work items read consecutive elements of the stored rows
+	emit(s, "\t\tfor (int x = tid; x < %d; x += %d)\n\t\t{\n", g->tile_m * g->tile_k, group);
+	if (g->transa) emit(s, "\t\t\tint i = x %% %d, k = x / %d;\n", g->tile_m, g->tile_m);
+	else emit(s, "\t\t\tint i = x / %d, k = x %% %d;\n", g->tile_k, g->tile_k);
+	emit(s, "\t\t\tAl[k][i] = i0 + i < %d && k0 + k < %d ? A_(i0 + i, k0 + k) : 0;\n\t\t}\n", g->m, g->k);
+	emit(s, "\t\tfor (int x = tid; x < %d; x += %d)\n\t\t{\n", g->tile_k * g->tile_n, group);
+	if (g->transb) emit(s, "\t\t\tint k = x %% %d, j = x / %d;\n", g->tile_k, g->tile_k);
+	else emit(s, "\t\t\tint k = x / %d, j = x %% %d;\n", g->tile_n, g->tile_n);
+	emit(s, "\t\t\tBl[k][j] = k0 + k < %d && j0 + j < %d ? B_(k0 + k, j0 + j) : 0;\n\t\t}\n", g->k, g->n);
+	emit(s, "\t\tbarrier(CLK_LOCAL_MEM_FENCE);\n");
+
+	//register block: row r of the work item is li + r * rm, vector c starts at column (c * rn + lj) * vec
+	emit(s, "\t\tfor (int k = 0; k < %d; ++k)\n\t\t{\n\t\t\t%s a;\n", g->tile_k, acc);
+	for (int c = 0; c < nv; ++c)
+		if (g->vec > 1) emit(s, "\t\t\t%s b%d = vload%d(0, &Bl[k][%d + lj * %d]);\n", accv, c, g->vec, c * rn * g->vec, g->vec);
+		else emit(s, "\t\t\t%s b%d = Bl[k][%d + lj];\n", accv, c, c * rn);
+	for (int r = 0; r < g->wpt_m; ++r)
+	{
+		emit(s, "\t\t\ta = Al[k][li + %d];", r * rm);
+		for (int c = 0; c < nv; ++c) emit(s, " acc[%d][%d] += a * b%d;", r, c, c);
+		emit(s, "\n");
+	}
+	emit(s, "\t\t}\n\t\tbarrier(CLK_LOCAL_MEM_FENCE);\n\t}\n");
+
+	//epilogue, one line per element as vector components need constant indices
+	for (int r = 0; r < g->wpt_m; ++r)
+		for (int c = 0; c < nv; ++c)
+			for (int e = 0; e < g->vec; ++e)
+			{
+				char comp[16] = "";
+				if (g->vec > 1) snprintf(comp, sizeof(comp), ".s%d", e);
+				emit(s, "\tSTORE(i0 + li + %d, j0 + lj * %d + %d, acc[%d][%d]%s);\n", r * rm, g->vec, c * rn * g->vec + e, r, c, comp);
+			}
+	emit(s, "}\n");
+	return s;
+}
+
+struct gen_entry
+{
+	cl_context context;
+	cl_program program;
+	cl_kernel kernel;
+};
+
+//keyed by the label, which holds every parameter of the source
+static std::map<std::string, gen_entry> cache;
+
+static void release_entry(gen_entry* e)
+{
+	if (e->kernel != NULL) clReleaseKernel(e->kernel);
+	if (e->program != NULL) clReleaseProgram(e->program);
+}
+
+cl_kernel gen_kernel(ocl_env* env, const gen_params* g, cl_int* err)
+{
+	char label[128];
+
+	gen_label(g, label, sizeof(label));
+	std::map<std::string, gen_entry>::iterator it = cache.find(label);
+	if (it != cache.end())
+	{
+		if (it->second.context == env->context)
+		{
+			*err = CL_SUCCESS;
+			return it->second.kernel;
+		}
+		release_entry(&it->second);
+		cache.erase(it);
+	}
+
+	std::string source = gen_source(g);
+	gen_entry e = { env->context, NULL, NULL };
+	e.program = ocl_build(env, source.c_str(), "", err);
+	if (e.program == NULL) return NULL;
+	e.kernel = clCreateKernel(e.program, GEN_ENTRY, err);
+	if (*err != CL_SUCCESS)
+	{
+		printf("Error setting kernel %s. Error: %d\n", GEN_ENTRY, *err);
+		release_entry(&e);
+		return NULL;
+	}
+	cache[label] = e;
+	return e.kernel;
+}
+
+void gen_cache_release(void)
+{
+	for (std::map<std::string, gen_entry>::iterator it = cache.begin(); it != cache.end(); ++it) release_entry(&it->second);
+	cache.clear();
+}
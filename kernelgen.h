@@ -0,0 +1,58 @@
+// kernel source generator: emits the OpenCL C of one register blocked GEMM kernel per parameter set, tile sizes,
+// work per item, vector width, element type, transposes, epilogue and the matrix sizes become literals of the source,
+// only the code the parameters need is emitted, so the autotuner can build any point of the space without adding
+// another hand written variant to KernelSource
+// the kernels take the arguments of the registry (A, B, C, alpha, beta), work on the unpadded matrices with
+// bounds checks and are built on demand, one program per parameter set, kept in a cache until gen_cache_release
+
+#pragma once
+
+#include <string>
+
+#include "CL/cl.h"
+#include "ocl.h"
+#include "precision.h"
+
+#define GEN_MAX_GROUP 256 //work items per work group at most
+#define GEN_ENTRY     "matmult_gen"
+
+enum gen_epilogue
+{
+	GEN_EPILOGUE_AXPBY,     //C = alpha * op(A) * op(B) + beta * C, C only read when beta != 0
+	GEN_EPILOGUE_STORE,     //C = alpha * op(A) * op(B), C is never read
+	GEN_EPILOGUE_RELU,      //C = max(alpha * op(A) * op(B) + beta * C, 0)
+	NUM_GEN_EPILOGUES
+};
+
+struct gen_params
+{
+	int dtype;                  //DTYPE_* of precision.h
+	int m, n, k;
+	int transa, transb;         //as in kernel_params
+	int tile_m, tile_n, tile_k; //C tile of a work group and the step along k staged in local memory
+	int wpt_m, wpt_n;           //elements of C per work item in each direction, the work group is tile_n / wpt_n x tile_m / wpt_m
+	int vec;                    //width of the vectors a work item keeps its row of C in (1, 2, 4, 8), divides wpt_n
+	int pad;                    //1 pads the rows of the local tiles by one element
+	int epilogue;               //GEN_EPILOGUE_*
+};
+
+//checks the combination, prints the reason and returns false if it cannot be generated
+bool gen_params_init(gen_params* g, int dtype, int m, int n, int k, int transa, int transb, int tile_m, int tile_n, int tile_k,
+	int wpt_m, int wpt_n, int vec, int pad, int epilogue);
+
+//e.g. "gen_t64x64x16_w4x4_v4_pad_tn_half_store_1000", the epilogue is left out for axpby as in variant_label
+void gen_label(const gen_params* g, char* label, size_t len);
+
+//the source of the kernel GEN_ENTRY
+std::string gen_source(const gen_params* g);
+
+void gen_geometry(const gen_params* g, size_t* global, size_t* local);
+
+size_t gen_local_mem(const gen_params* g);
+
+//the kernel for g, generated and built on the first request and cached afterwards, owned by the cache
+//returns NULL with err set if the build fails
+cl_kernel gen_kernel(ocl_env* env, const gen_params* g, cl_int* err);
+
+//releases every cached program and kernel
+void gen_cache_release(void);
@@ -0,0 +1,711 @@
+#include "kernels.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/** kernel's source text as string **/
+// every variant reads its sizes from build options (see kernel_build_options), the defaults only keep it compilable
+const char* KernelSource =
+
+"#ifndef M																				\n"
+"#define M 1000																			\n"
+"#endif																					\n"
+"#ifndef N																				\n"
+"#define N 1000																			\n"
+"#endif																					\n"
+"#ifndef K																				\n"
+"#define K 1000																			\n"
+"#endif																					\n"
+"#ifndef MP																				\n"
+"#define MP M																			\n"
+"#endif																					\n"
+"#ifndef NP																				\n"
+"#define NP N																			\n"
+"#endif																					\n"
+"#ifndef KP																				\n"
+"#define KP K																			\n"
+"#endif																					\n"
+"#ifndef TRANSA																			\n"
+"#define TRANSA 0																		\n"
+"#endif																					\n"
+"#ifndef TRANSB																			\n"
+"#define TRANSB 0																		\n"
+"#endif																					\n"
+"#ifndef DTYPE																			\n"
+"#define DTYPE 0																		\n"
+"#endif																					\n"
+"#ifndef VEC																			\n"
+"#define VEC 4																			\n"
+"#endif																					\n"
+"#ifndef TS																				\n"
+"#define TS 16																			\n"
+"#endif																					\n"
+"#ifndef WPT																			\n"
+"#define WPT 4																			\n"
+"#endif																					\n"
+"#ifndef PAD																			\n"
+"#define PAD 1																			\n"
+"#endif																					\n"
+"#ifndef STAGE_BT																		\n"
+"#define STAGE_BT 0																		\n"
+"#endif																					\n"
+"#ifndef SKINNY_MAX																		\n"
+"#define SKINNY_MAX 32																	\n"
+"#endif																					\n"
+"#ifndef SMALL_MAX																		\n"
+"#define SMALL_MAX 32																	\n"
+"#endif																					\n"
+"#ifndef SMALL_GROUP																	\n"
+"#define SMALL_GROUP 256																\n"
+"#endif																					\n"
+"#define CAT_(a, b) a##b																\n"
+"#define CAT(a, b) CAT_(a, b)															\n"
+"																						\n"
+// element type of the matrices (real) and of the arithmetic (acc_t), DTYPE as in precision.h:
+// 0 float, 1 double (cl_khr_fp64), 2 half and 3 bfloat16 storage with float arithmetic
+// LD(p, i) reads element i of p widened to acc_t, ST(p, i, v) rounds v back to real
+"#if DTYPE == 1																			\n"
+"#pragma OPENCL EXTENSION cl_khr_fp64 : enable											\n"
+"#define REAL double																	\n"
+"typedef double acc_t;																	\n"
+"#elif DTYPE == 2																		\n"
+"#define REAL half																		\n" //only as a pointer, vload_half and vstore_half are core and need no cl_khr_fp16
+"typedef float acc_t;																	\n"
+"#elif DTYPE == 3																		\n"
+"#define REAL ushort																	\n" //the upper half of a float
+"typedef float acc_t;																	\n"
+"#else																					\n"
+"#define REAL float																		\n"
+"typedef float acc_t;																	\n"
+"#endif																					\n"
+"typedef REAL real;																		\n"
+"#if DTYPE == 2																			\n"
+"#define LD(p, i) vload_half(i, p)														\n"
+"#define ST(p, i, v) vstore_half_rte(v, i, p)											\n"
+"#elif DTYPE == 3																		\n"
+"ushort bf16_round(float f)																\n"
+"{																						\n"
+"	uint u = as_uint(f);																\n"
+"	if ((u & 0x7fffffff) > 0x7f800000) return (ushort)((u >> 16) | 0x40);				\n" //keep NaN a quiet NaN
+"	return (ushort)((u + 0x7fff + ((u >> 16) & 1)) >> 16);								\n" //round to nearest even
+"}																						\n"
+"#define LD(p, i) as_float((uint)(p)[i] << 16)											\n"
+"#define ST(p, i, v) (p)[i] = bf16_round(v)												\n"
+"#else																					\n"
+"#define LD(p, i) (p)[i]																\n"
+"#define ST(p, i, v) (p)[i] = (v)														\n"
+"#endif																					\n"
+// the vector kernels (rows and vec) load whole vectors of real and exist for float and double only,
+// the vector type is pasted from the macro, a typedef name would not expand
+"#define realv CAT(REAL, VEC)															\n"
+"#define vloadv CAT(vload, VEC)															\n"
+"#define vstorev CAT(vstore, VEC)														\n"
+"																						\n"
+// C = alpha * op(A) * op(B) + beta * C with op(A) M x K, op(B) K x N and C M x N, all row major
+// TRANSA = 1 means A is stored K x M, TRANSB = 1 means B is stored N x K, the kernels read them in place
+// A_ and B_ give op(A)(i, k) and op(B)(k, j) of the unpadded matrices, AP_ and BP_ of the padded copies
+"#if TRANSA																				\n"
+"#define A_(i, k) LD(Ap, (k) * M + (i))													\n"
+"#define AP_(i, k) LD(Ap, (k) * MP + (i))												\n"
+"#else																					\n"
+"#define A_(i, k) LD(Ap, (i) * K + (k))													\n"
+"#define AP_(i, k) LD(Ap, (i) * KP + (k))												\n"
+"#endif																					\n"
+"#if TRANSB																				\n"
+"#define B_(k, j) LD(Bp, (j) * K + (k))													\n"
+"#define BP_(k, j) LD(Bp, (j) * KP + (k))												\n"
+"#else																					\n"
+"#define B_(k, j) LD(Bp, (k) * N + (j))													\n"
+"#define BP_(k, j) LD(Bp, (k) * NP + (j))												\n"
+"#endif																					\n"
+// C is only read when beta != 0, as in BLAS, so it may hold garbage for a plain product
+"#define UPDATE(idx, v) ST(Cp, idx, beta == 0 ? alpha * (v) : alpha * (v) + beta * LD(Cp, idx))	\n"
+"																						\n"
+// naive: one work item per element of C, works on the unpadded matrices
+"__kernel void matmult(__global const real* Ap, __global const real* Bp, __global real* Cp, acc_t alpha, acc_t beta)	\n"
+"{																						\n"
+"	int i, j, k;																		\n"
+"	acc_t sum = 0;																		\n"
+"	i = get_global_id(0);																\n" //past a certain threshhold of matrix size, doubling the matrix size causes an eightfold increase in compile time, suggesting that we eventually reach the maximum possible parallelization and return to a structure equivalent to 3 nested loops, up until that point it is significantly faster though (for us this happened when going from size 1000 to 2000)
+"	j = get_global_id(1);																\n"
+"	for (k = 0; k < K; ++k)																\n"
+"	{																					\n"
+"		sum += A_(i, k) * B_(k, j);														\n"
+"	}																					\n"
+"	UPDATE(i * N + j, sum);																\n"
+"}																						\n"
+"																						\n"
+// the other general kernels work on copies padded with zeros to multiples of VEC and TS in every dimension,
+// so rows start vector aligned and tiles never leave the matrix
+"#if DTYPE < 2																			\n"
+// rows: one work item per column of C, the work group copies the current row of op(A) into local memory (VEC elements
+// at a time unless A is transposed) and every work item multiplies it with its column of op(B), Al holds KP elements
+// and is passed as argument 5
+"__kernel void matmult_rows(__global const real* Ap, __global const real* Bp, __global real* Cp,	\n"
+"	acc_t alpha, acc_t beta, __local real* Al)											\n"
+"{																						\n"
+"	int j = get_global_id(0);															\n"
+"	int il = get_local_id(0);															\n"
+"	int nl = get_local_size(0);															\n"
+"	for (int i = 0; i < MP; i++)														\n"
+"	{																					\n"
+"#if TRANSA																				\n"
+"		for (int k = il; k < KP; k += nl) Al[k] = AP_(i, k);							\n"
+"#else																					\n"
+"		for (int k = il; k < KP / VEC; k += nl) vstorev(vloadv(i * (KP / VEC) + k, Ap), k, Al);	\n"
+"#endif																					\n"
+"		barrier(CLK_LOCAL_MEM_FENCE);													\n"
+"		acc_t sum = 0;																	\n"
+"		for (int k = 0; k < KP; k++) sum += Al[k] * BP_(k, j);							\n"
+"		UPDATE(i * NP + j, sum);														\n"
+"		barrier(CLK_LOCAL_MEM_FENCE);													\n" //Al is overwritten by the next row
+"	}																					\n"
+"}																						\n"
+"																						\n"
+// vec: every work item computes VEC neighbouring elements of a row of C, A and B are read VEC elements at a time,
+// a transposed operand is gathered element by element instead
+"__kernel void matmult_vec(__global const real* Ap, __global const real* Bp, __global real* Cp,	\n"
+"	acc_t alpha, acc_t beta)															\n"
+"{																						\n"
+"	int i = get_global_id(0);															\n"
+"	int jv = get_global_id(1);															\n" //index of the VEC wide column block
+"	realv sum = (realv)(0);																\n"
+"	real a[VEC];																		\n"
+"#if TRANSB																				\n"
+"	real b[VEC];																		\n"
+"#endif																					\n"
+"	for (int k = 0; k < KP; k += VEC)													\n"
+"	{																					\n"
+"#if TRANSA																				\n"
+"		for (int u = 0; u < VEC; ++u) a[u] = AP_(i, k + u);								\n"
+"#else																					\n"
+"		vstorev(vloadv((i * KP + k) / VEC, Ap), 0, a);									\n"
+"#endif																					\n"
+"		for (int u = 0; u < VEC; ++u)													\n"
+"		{																				\n"
+"#if TRANSB																				\n"
+"			for (int v = 0; v < VEC; ++v) b[v] = BP_(k + u, jv * VEC + v);				\n"
+"			sum += a[u] * vloadv(0, b);													\n"
+"#else																					\n"
+"			sum += a[u] * vloadv((k + u) * (NP / VEC) + jv, Bp);						\n"
+"#endif																					\n"
+"		}																				\n"
+"	}																					\n"
+"	realv c = beta == 0 ? (realv)(0) : vloadv(i * (NP / VEC) + jv, Cp);					\n"
+"	vstorev(alpha * sum + beta * c, i * (NP / VEC) + jv, Cp);							\n"
+"}																						\n"
+"#endif																					\n"
+"																						\n"
+// tiled: TS x TS work groups, the tiles are double buffered: while tile t is multiplied out of one local buffer the
+// work group already loads tile t + 1 into the other one, so there is one barrier per tile instead of two
+// dimension 0 runs along the columns so neighbouring work items read neighbouring addresses of A, B and C,
+// a transposed operand is read along its stored rows as well and written transposed into the local tile
+// PAD = 1 pads the rows of the local tiles to TS + 1 elements, so a column of a tile is spread over all local memory
+// banks instead of hitting the same few, STAGE_BT = 1 stores the tile of B transposed (only conflict free with PAD)
+// the local tiles hold acc_t, half and bfloat16 are widened once when they are loaded
+"#if STAGE_BT																			\n"
+"#define BL(buf, k, j) Bl[buf][j][k]													\n"
+"#else																					\n"
+"#define BL(buf, k, j) Bl[buf][k][j]													\n"
+"#endif																					\n"
+"#if TRANSA																				\n"
+"#define LOAD_A_TILE(buf, t) Al[buf][lj][li] = LD(Ap, ((t) * TS + li) * MP + i0 + lj)	\n"
+"#else																					\n"
+"#define LOAD_A_TILE(buf, t) Al[buf][li][lj] = LD(Ap, (i0 + li) * KP + (t) * TS + lj)	\n"
+"#endif																					\n"
+"#if TRANSB																				\n"
+"#define LOAD_B_TILE(buf, t) BL(buf, lj, li) = LD(Bp, (j0 + li) * KP + (t) * TS + lj)	\n"
+"#else																					\n"
+"#define LOAD_B_TILE(buf, t) BL(buf, li, lj) = LD(Bp, ((t) * TS + li) * NP + j0 + lj)	\n"
+"#endif																					\n"
+"__kernel __attribute__((reqd_work_group_size(TS, TS, 1)))								\n"
+"void matmult_tiled(__global const real* Ap, __global const real* Bp, __global real* Cp,	\n"
+"	acc_t alpha, acc_t beta)															\n"
+"{																						\n"
+"	__local acc_t Al[2][TS][TS + PAD];													\n"
+"	__local acc_t Bl[2][TS][TS + PAD];													\n"
+"	int j = get_global_id(0), i = get_global_id(1);										\n"
+"	int lj = get_local_id(0), li = get_local_id(1);										\n"
+"	int j0 = get_group_id(0) * TS, i0 = get_group_id(1) * TS;							\n"
+"	acc_t sum = 0;																		\n"
+"	LOAD_A_TILE(0, 0);																	\n"
+"	LOAD_B_TILE(0, 0);																	\n"
+"	barrier(CLK_LOCAL_MEM_FENCE);														\n"
+"	for (int t = 0; t < KP / TS; ++t)													\n"
+"	{																					\n"
+"		int cur = t & 1;																\n"
+"		if (t + 1 < KP / TS)															\n" //the other buffer was last read before the previous barrier
+"		{																				\n"
+"			LOAD_A_TILE(cur ^ 1, t + 1);												\n"
+"			LOAD_B_TILE(cur ^ 1, t + 1);												\n"
+"		}																				\n"
+"		for (int k = 0; k < TS; ++k)													\n"
+"			sum += Al[cur][li][k] * BL(cur, k, lj);										\n"
+"		barrier(CLK_LOCAL_MEM_FENCE);													\n"
+"	}																					\n"
+"	UPDATE(i * NP + j, sum);															\n"
+"}																						\n"
+"																						\n"
+// regblock: like tiled, but every work item keeps WPT elements of a row of C in registers, spaced TS / WPT apart so
+// the work group still reads whole rows of the tiles, each value of A loaded from local memory is used WPT times
+"#define RTS (TS / WPT)																	\n"
+"__kernel __attribute__((reqd_work_group_size(RTS, TS, 1)))								\n"
+"void matmult_regblock(__global const real* Ap, __global const real* Bp, __global real* Cp,	\n"
+"	acc_t alpha, acc_t beta)															\n"
+"{																						\n"
+"	__local acc_t Al[TS][TS + PAD];														\n"
+"	__local acc_t Bl[TS][TS + PAD];														\n"
+"	int lj = get_local_id(0), li = get_local_id(1);										\n"
+"	int j0 = get_group_id(0) * TS, i0 = get_group_id(1) * TS, i = i0 + li;				\n"
+"	acc_t acc[WPT];																		\n"
+"	for (int w = 0; w < WPT; ++w) acc[w] = 0;											\n"
+"	for (int t = 0; t < KP / TS; ++t)													\n"
+"	{																					\n"
+"		for (int w = 0; w < WPT; ++w)													\n"
+"		{																				\n"
+"			int c = lj + w * RTS;														\n"
+"#if TRANSA																				\n"
+"			Al[c][li] = LD(Ap, (t * TS + li) * MP + i0 + c);							\n"
+"#else																					\n"
+"			Al[li][c] = LD(Ap, i * KP + t * TS + c);									\n"
+"#endif																					\n"
+"#if TRANSB																				\n"
+"			Bl[c][li] = LD(Bp, (j0 + li) * KP + t * TS + c);							\n"
+"#else																					\n"
+"			Bl[li][c] = LD(Bp, (t * TS + li) * NP + j0 + c);							\n"
+"#endif																					\n"
+"		}																				\n"
+"		barrier(CLK_LOCAL_MEM_FENCE);													\n"
+"		for (int k = 0; k < TS; ++k)													\n"
+"		{																				\n"
+"			acc_t a = Al[li][k];														\n"
+"			for (int w = 0; w < WPT; ++w) acc[w] += a * Bl[k][lj + w * RTS];			\n"
+"		}																				\n"
+"		barrier(CLK_LOCAL_MEM_FENCE);													\n"
+"	}																					\n"
+"	for (int w = 0; w < WPT; ++w) UPDATE(i * NP + j0 + lj + w * RTS, acc[w]);			\n"
+"}																						\n"
+"																						\n"
+// shape specialized kernels on the unpadded matrices, padding a tall-skinny or short-wide product to tiles
+// would multiply mostly zeros, their register arrays shrink to one element when the shape does not fit
+// skinny: C has at most SKINNY_MAX columns, one work item per row of C keeps the whole row in registers,
+// the rows of op(B) are shared by the work group and staged through local memory TS at a time (Bl is argument 5)
+"#define SKINNY_N (N <= SKINNY_MAX ? N : 1)												\n"
+"__kernel void matmult_skinny(__global const real* Ap, __global const real* Bp, __global real* Cp,	\n"
+"	acc_t alpha, acc_t beta, __local acc_t* Bl)											\n"
+"{																						\n"
+"	int i = get_global_id(0);															\n"
+"	int il = get_local_id(0), nl = get_local_size(0);									\n"
+"	acc_t acc[SKINNY_N];																\n"
+"	for (int j = 0; j < SKINNY_N; ++j) acc[j] = 0;										\n"
+"	for (int k0 = 0; k0 < K; k0 += TS)													\n"
+"	{																					\n"
+"		int kn = min(TS, K - k0);														\n"
+"		for (int x = il; x < kn * N; x += nl) Bl[x] = B_(k0 + x / N, x % N);			\n"
+"		barrier(CLK_LOCAL_MEM_FENCE);													\n"
+"		if (i < M)																		\n"
+"			for (int k = 0; k < kn; ++k)												\n"
+"			{																			\n"
+"				acc_t a = A_(i, k0 + k);												\n"
+"				for (int j = 0; j < SKINNY_N; ++j) acc[j] += a * Bl[k * N + j];			\n"
+"			}																			\n"
+"		barrier(CLK_LOCAL_MEM_FENCE);													\n"
+"	}																					\n"
+"	if (i < M)																			\n"
+"		for (int j = 0; j < SKINNY_N; ++j) UPDATE(i * N + j, acc[j]);					\n"
+"}																						\n"
+"																						\n"
+// wide: C has at most SKINNY_MAX rows, one work item per column of C keeps the whole column in registers,
+// all work items read the same element of A at the same time and neighbouring elements of B
+"#define WIDE_M (M <= SKINNY_MAX ? M : 1)												\n"
+"__kernel void matmult_wide(__global const real* Ap, __global const real* Bp, __global real* Cp,	\n"
+"	acc_t alpha, acc_t beta)															\n"
+"{																						\n"
+"	int j = get_global_id(0);															\n"
+"	if (j >= N) return;																	\n"
+"	acc_t acc[WIDE_M];																	\n"
+"	for (int i = 0; i < WIDE_M; ++i) acc[i] = 0;										\n"
+"	for (int k = 0; k < K; ++k)															\n"
+"	{																					\n"
+"		acc_t b = B_(k, j);																\n"
+"		for (int i = 0; i < WIDE_M; ++i) acc[i] += A_(i, k) * b;						\n"
+"	}																					\n"
+"	for (int i = 0; i < WIDE_M; ++i) UPDATE(i * N + j, acc[i]);							\n"
+"}																						\n"
+"																						\n"
+// small: every size at most SMALL_MAX, the sizes are compile time constants of the build so one work group of
+// N x SMALL_ROWS work items stages all of op(A) and op(B) in local memory and the loops unroll completely,
+// only compiled for such shapes as the local arrays and the work group size follow M, N and K
+"#if M <= SMALL_MAX && N <= SMALL_MAX && K <= SMALL_MAX									\n"
+"#define SMALL_ROWS (SMALL_GROUP / N < M ? SMALL_GROUP / N : M)							\n"
+"__kernel __attribute__((reqd_work_group_size(N, SMALL_ROWS, 1)))						\n"
+"void matmult_small(__global const real* Ap, __global const real* Bp, __global real* Cp, acc_t alpha, acc_t beta)	\n"
+"{																						\n"
+"	__local acc_t Al[M][K];																\n"
+"	__local acc_t Bl[K][N];																\n"
+"	int j = get_local_id(0), li = get_local_id(1);										\n"
+"	for (int x = li * N + j; x < M * K; x += N * SMALL_ROWS) Al[x / K][x % K] = A_(x / K, x % K);	\n"
+"	for (int x = li * N + j; x < K * N; x += N * SMALL_ROWS) Bl[x / N][x % N] = B_(x / N, x % N);	\n"
+"	barrier(CLK_LOCAL_MEM_FENCE);														\n"
+"	#pragma unroll																		\n"
+"	for (int i = li; i < M; i += SMALL_ROWS)											\n"
+"	{																					\n"
+"		acc_t sum = 0;																	\n"
+"		#pragma unroll																	\n"
+"		for (int k = 0; k < K; ++k) sum += Al[i][k] * Bl[k][j];							\n"
+"		UPDATE(i * N + j, sum);															\n"
+"	}																					\n"
+"}																						\n"
+"#endif																					\n"
+"																						\n"
+// batched: many independent products of the same shape in one launch, dimension 2 of the NDRange picks the product
+// and offsets holds the element offsets of its A, B and C in the three buffers (three per product, a strided batch
+// uses b * stride), TS x TS local tiles of the unpadded matrices with bounds checks as small sizes rarely divide TS
+"__kernel __attribute__((reqd_work_group_size(TS, TS, 1)))								\n"
+"void matmult_batched(__global const real* Ap, __global const real* Bp, __global real* Cp,	\n"
+"	acc_t alpha, acc_t beta, __global const uint* offsets)								\n"
+"{																						\n"
+"	__local acc_t Al[TS][TS + PAD];														\n"
+"	__local acc_t Bl[TS][TS + PAD];														\n"
+"	int j = get_global_id(0), i = get_global_id(1), b = get_global_id(2);				\n"
+"	int lj = get_local_id(0), li = get_local_id(1);										\n"
+"	Ap += offsets[3 * b]; Bp += offsets[3 * b + 1]; Cp += offsets[3 * b + 2];			\n"
+"	acc_t sum = 0;																		\n"
+"	for (int k0 = 0; k0 < K; k0 += TS)													\n"
+"	{																					\n"
+"		Al[li][lj] = i < M && k0 + lj < K ? A_(i, k0 + lj) : 0;							\n"
+"		Bl[li][lj] = k0 + li < K && j < N ? B_(k0 + li, j) : 0;							\n"
+"		barrier(CLK_LOCAL_MEM_FENCE);													\n"
+"		for (int k = 0; k < TS; ++k) sum += Al[li][k] * Bl[k][lj];						\n"
+"		barrier(CLK_LOCAL_MEM_FENCE);													\n"
+"	}																					\n"
+"	if (i < M && j < N) UPDATE(i * N + j, sum);											\n"
+"}																						\n"
+"																						\n"
+// int8: exact integer product, A M x KP and B transposed N x KP in chars (zero padded along k), C M x N in ints,
+// one work item per element of C, four products per step with the integer dot product of OpenCL 3.0 if there is one
+"#ifdef __opencl_c_integer_dot_product_input_4x8bit										\n"
+"#define DOT4(a, b) dot(a, b)															\n"
+"#else																					\n"
+"#define DOT4(a, b) ((int)(a).x * (b).x + (int)(a).y * (b).y + (int)(a).z * (b).z + (int)(a).w * (b).w)	\n"
+"#endif																					\n"
+"__kernel void matmult_int8(__global const char* Ap, __global const char* Btp, __global int* Cp)	\n"
+"{																						\n"
+"	int j = get_global_id(0), i = get_global_id(1);										\n"
+"	int sum = 0;																		\n"
+"	for (int k = 0; k < KP / 4; ++k) sum += DOT4(vload4(i * (KP / 4) + k, Ap), vload4(j * (KP / 4) + k, Btp));	\n"
+"	Cp[i * N + j] = sum;																\n"
+"}																						\n"
+"																						\n"
+// unpack4: device pre-pass of the 4-bit packed upload (pack.h), element 2i is lo plus the low, 2i + 1 lo plus
+// the high nibble of byte i, one work item per byte writes both into the buffer of the variants as real
+"__kernel void unpack4(__global const uchar* in, __global real* out, int count, acc_t lo)	\n"
+"{																						\n"
+"	int i = get_global_id(0);															\n"
+"	uchar b = in[i];																	\n"
+"	ST(out, 2 * i, lo + (b & 15));														\n"
+"	if (2 * i + 1 < count) ST(out, 2 * i + 1, lo + (b >> 4));							\n"
+"}																						\n"
+"																						\n"
+// micro benchmark for the local memory banks: every work item reads a row of a TS x stride tile, so neighbouring
+// work items are stride floats apart, stride TS makes them collide on the same banks, stride TS + 1 does not
+"#ifndef LOCAL_BENCH_REPS																\n"
+"#define LOCAL_BENCH_REPS 256															\n"
+"#endif																					\n"
+"__kernel __attribute__((reqd_work_group_size(TS, TS, 1)))								\n"
+"void local_bench(__global float* out, int stride)										\n"
+"{																						\n"
+"	__local float tile[TS * (TS + 1)];													\n"
+"	int lj = get_local_id(0), li = get_local_id(1);										\n"
+"	for (int x = li * TS + lj; x < TS * (TS + 1); x += TS * TS) tile[x] = x;			\n"
+"	barrier(CLK_LOCAL_MEM_FENCE);														\n"
+"	float sum = 0.f;																	\n"
+"	for (int r = 0; r < LOCAL_BENCH_REPS; ++r)											\n"
+"		for (int k = 0; k < TS; ++k)													\n"
+"			sum += tile[lj * stride + ((k + r + li) & (TS - 1))];						\n"
+"	out[get_global_id(1) * get_global_size(0) + get_global_id(0)] = sum;				\n"
+"}																						\n"
+"																						\n";
+//largest power of two up to 256 dividing x, the rows kernel needs work groups that divide the global size
+static size_t pow2_divisor(int x)
+{
+	size_t d = 1;
+	while (d < 256 && x % (2 * d) == 0) d *= 2;
+	return d;
+}
+
+static size_t round_up(size_t x, size_t multiple)
+{
+	return (x + multiple - 1) / multiple * multiple;
+}
+
+static void naive_geometry(const kernel_params* p, size_t* global, size_t* local)
+{
+	global[0] = p->m; global[1] = p->n;
+	local[0] = 0;
+}
+
+static void rows_geometry(const kernel_params* p, size_t* global, size_t* local)
+{
+	global[0] = p->np;
+	local[0] = pow2_divisor(p->np);
+}
+
+static void vec_geometry(const kernel_params* p, size_t* global, size_t* local)
+{
+	global[0] = p->m; global[1] = p->np / p->vec;
+	local[0] = 0;
+}
+
+static void tiled_geometry(const kernel_params* p, size_t* global, size_t* local)
+{
+	global[0] = p->np; global[1] = p->mp;
+	local[0] = p->tile; local[1] = p->tile;
+}
+
+static void regblock_geometry(const kernel_params* p, size_t* global, size_t* local)
+{
+	global[0] = p->np / p->wpt; global[1] = p->mp;
+	local[0] = p->tile / p->wpt; local[1] = p->tile;
+}
+
+static void skinny_geometry(const kernel_params* p, size_t* global, size_t* local)
+{
+	local[0] = SHAPE_GROUP;
+	global[0] = round_up(p->m, SHAPE_GROUP);
+}
+
+static void wide_geometry(const kernel_params* p, size_t* global, size_t* local)
+{
+	local[0] = SHAPE_GROUP;
+	global[0] = round_up(p->n, SHAPE_GROUP);
+}
+
+static void small_geometry(const kernel_params* p, size_t* global, size_t* local)
+{
+	//one work group, as SMALL_ROWS of KernelSource
+	global[0] = local[0] = p->n;
+	global[1] = local[1] = SMALL_GROUP / p->n < p->m ? SMALL_GROUP / p->n : p->m;
+}
+
+static void int8_geometry(const kernel_params* p, size_t* global, size_t* local)
+{
+	global[0] = p->n; global[1] = p->m;
+	local[0] = 0;
+}
+
+void batched_geometry(const kernel_params* p, int count, size_t* global, size_t* local)
+{
+	global[0] = round_up(p->n, p->tile); global[1] = round_up(p->m, p->tile); global[2] = count;
+	local[0] = p->tile; local[1] = p->tile; local[2] = 1;
+}
+
+bool batch_strided_offsets(batch_offsets* offsets, int count, size_t stride_a, size_t stride_b, size_t stride_c)
+{
+	size_t largest = stride_a > stride_b ? (stride_a > stride_c ? stride_a : stride_c) : (stride_b > stride_c ? stride_b : stride_c);
+
+	if (count > 0 && largest > UINT32_MAX / (size_t)count)
+	{
+		printf("%d products of up to %zu elements do not fit the 32 bit offsets of matmult_batched\n", count, largest);
+		return false;
+	}
+	for (int b = 0; b < count; ++b)
+	{
+		offsets[b].a = (cl_uint)(b * stride_a);
+		offsets[b].b = (cl_uint)(b * stride_b);
+		offsets[b].c = (cl_uint)(b * stride_c);
+	}
+	return true;
+}
+
+static size_t no_local_mem(const kernel_params* p)
+{
+	return 0;
+}
+
+static size_t rows_local_mem(const kernel_params* p)
+{
+	return p->kp * dtype_size(p->dtype); //one row of op(A)
+}
+
+//the tiles hold the arithmetic type
+static size_t tiled_local_mem(const kernel_params* p)
+{
+	return 2 * 2 * p->tile * (p->tile + p->pad) * dtype_acc_size(p->dtype); //two buffers for A and B each
+}
+
+static size_t regblock_local_mem(const kernel_params* p)
+{
+	return 2 * p->tile * (p->tile + p->pad) * dtype_acc_size(p->dtype);
+}
+
+static size_t small_local_mem(const kernel_params* p)
+{
+	return ((size_t)p->m * p->k + (size_t)p->k * p->n) * dtype_acc_size(p->dtype);
+}
+
+static size_t skinny_local_mem(const kernel_params* p)
+{
+	return p->tile * p->n * dtype_acc_size(p->dtype); //tile rows of op(B)
+}
+
+static bool any_shape(const kernel_params* p)
+{
+	return true;
+}
+
+//rows and vec load whole vectors of the element type, half and bfloat16 would need a conversion per element
+static bool vector_type(const kernel_params* p)
+{
+	return p->dtype == DTYPE_FLOAT || p->dtype == DTYPE_DOUBLE;
+}
+
+static bool small_shape(const kernel_params* p)
+{
+	return p->m <= SMALL_MAX && p->n <= SMALL_MAX && p->k <= SMALL_MAX;
+}
+
+static bool skinny_shape(const kernel_params* p)
+{
+	return p->n <= SKINNY_MAX;
+}
+
+static bool wide_shape(const kernel_params* p)
+{
+	return p->m <= SKINNY_MAX;
+}
+
+const kernel_variant kernel_variants[] =
+{
+	{ "naive", "matmult", "one work item per element, everything from global memory",
+		2, false, false, 0, naive_geometry, no_local_mem, any_shape },
+	{ "rows", "matmult_rows", "one work item per column, current row of op(A) cached in local memory",
+		1, true, true, KP_VEC, rows_geometry, rows_local_mem, vector_type },
+	{ "vec", "matmult_vec", "VEC elements per work item, vloadN from global memory",
+		2, true, false, KP_VEC, vec_geometry, no_local_mem, vector_type },
+	{ "tiled", "matmult_tiled", "double buffered TS x TS local tiles",
+		2, true, false, KP_TILE | KP_PAD | KP_STAGE_BT, tiled_geometry, tiled_local_mem, any_shape },
+	{ "regblock", "matmult_regblock", "TS x TS local tiles, WPT elements per work item in registers",
+		2, true, false, KP_TILE | KP_WPT | KP_PAD, regblock_geometry, regblock_local_mem, any_shape },
+	{ "skinny", "matmult_skinny", "N <= SKINNY_MAX: one row of C per work item, op(B) staged in local memory",
+		1, false, true, KP_TILE, skinny_geometry, skinny_local_mem, skinny_shape },
+	{ "wide", "matmult_wide", "M <= SKINNY_MAX: one column of C per work item, A broadcast",
+		1, false, false, 0, wide_geometry, no_local_mem, wide_shape },
+	{ "small", "matmult_small", "all sizes <= SMALL_MAX: one work group, everything in local memory, loops unrolled",
+		2, false, false, 0, small_geometry, small_local_mem, small_shape },
+};
+
+const int num_kernel_variants = sizeof(kernel_variants) / sizeof(kernel_variants[0]);
+
+const kernel_variant int8_variant =
+	{ "int8", "matmult_int8", "int8 A and B, int32 C, one work item per element, char4 dot products",
+		2, true, false, 0, int8_geometry, no_local_mem, any_shape };
+
+static bool is_pow2_in(int x, int lo, int hi)
+{
+	return x >= lo && x <= hi && !(x & (x - 1));
+}
+
+bool kernel_params_init(kernel_params* p, int dtype, int m, int n, int k, int transa, int transb, int vec, int tile, int wpt, int pad, int stage_bt)
+{
+	if (dtype < 0 || dtype >= NUM_DTYPES)
+	{
+		printf("Invalid element type %d\n", dtype);
+		return false;
+	}
+	if (m <= 0 || n <= 0 || k <= 0 || !is_pow2_in(vec, 2, 16) || !is_pow2_in(tile, 4, 32) || !is_pow2_in(wpt, 1, tile))
+	{
+		printf("Invalid kernel parameters: %d x %d x %d, vec %d, tile %d, wpt %d\n", m, n, k, vec, tile, wpt);
+		return false;
+	}
+
+	//vec and tile are powers of two, so a multiple of the larger one is a multiple of both
+	int align = vec > tile ? vec : tile;
+	p->dtype = dtype;
+	p->m = m;
+	p->n = n;
+	p->k = k;
+	p->transa = transa ? 1 : 0;
+	p->transb = transb ? 1 : 0;
+	p->mp = (int)round_up(m, align);
+	p->np = (int)round_up(n, align);
+	p->kp = (int)round_up(k, align);
+	p->vec = vec;
+	p->tile = tile;
+	p->wpt = wpt;
+	p->pad = pad ? 1 : 0;
+	p->stage_bt = stage_bt ? 1 : 0;
+
+	return true;
+}
+
+void kernel_build_options(const kernel_params* p, char* options, size_t len)
+{
+	snprintf(options, len, "-D DTYPE=%d -D M=%d -D N=%d -D K=%d -D MP=%d -D NP=%d -D KP=%d -D TRANSA=%d -D TRANSB=%d -D VEC=%d -D TS=%d -D WPT=%d -D PAD=%d -D STAGE_BT=%d -D SKINNY_MAX=%d -D SMALL_MAX=%d -D SMALL_GROUP=%d -D LOCAL_BENCH_REPS=%d",
+		p->dtype, p->m, p->n, p->k, p->mp, p->np, p->kp, p->transa, p->transb, p->vec, p->tile, p->wpt, p->pad, p->stage_bt, SKINNY_MAX, SMALL_MAX, SMALL_GROUP, LOCAL_BENCH_REPS);
+}
+
+cl_int kernel_set_scalar(cl_kernel kernel, cl_uint index, const kernel_params* p, double value)
+{
+	float single = (float)value;
+
+	if (dtype_acc_size(p->dtype) == sizeof(double)) return clSetKernelArg(kernel, index, sizeof(double), &value);
+	return clSetKernelArg(kernel, index, sizeof(float), &single);
+}
+
+const kernel_variant* find_variant(const char* name)
+{
+	for (int v = 0; v < num_kernel_variants; ++v)
+		if (strcmp(kernel_variants[v].name, name) == 0) return &kernel_variants[v];
+
+	return NULL;
+}
+
+const kernel_variant* select_variant(const kernel_params* p)
+{
+	//a tiny product fits one work group, anything else with a handful of output columns or rows would waste most
+	//of a tile on padding
+	if (small_shape(p)) return find_variant("small");
+	if (skinny_shape(p)) return find_variant("skinny");
+	if (wide_shape(p)) return find_variant("wide");
+
+	return find_variant("tiled");
+}
+
+void variant_label(const kernel_variant* v, const kernel_params* p, char* label, size_t len)
+{
+	int used = snprintf(label, len, "%s", v->name);
+
+	if (v->uses & KP_VEC) used += snprintf(label + used, len - used, "_v%d", p->vec);
+	if (v->uses & KP_TILE) used += snprintf(label + used, len - used, "_t%d", p->tile);
+	if (v->uses & KP_WPT) used += snprintf(label + used, len - used, "_w%d", p->wpt);
+	if ((v->uses & KP_PAD) && p->pad) used += snprintf(label + used, len - used, "_pad");
+	if ((v->uses & KP_STAGE_BT) && p->stage_bt) used += snprintf(label + used, len - used, "_sbt");
+	if (p->transa || p->transb) used += snprintf(label + used, len - used, "_%c%c", p->transa ? 't' : 'n', p->transb ? 't' : 'n');
+	if (p->dtype != DTYPE_FLOAT) used += snprintf(label + used, len - used, "_%s", dtype_name(p->dtype));
+	if (p->m == p->n && p->n == p->k) snprintf(label + used, len - used, "_%d", p->n);
+	else snprintf(label + used, len - used, "_%dx%dx%d", p->m, p->n, p->k);
+}
+
+void print_variants(const kernel_params* p)
+{
+	size_t global[MAX_WORK_DIM], local[MAX_WORK_DIM];
+
+	printf("%-10s %-18s %-22s %-12s %-10s %s\n", "name", "kernel", "global", "local", "local mem", "description");
+	for (int v = 0; v < num_kernel_variants; ++v)
+	{
+		const kernel_variant* kv = &kernel_variants[v];
+		char g[32], l[32];
+
+		kv->geometry(p, global, local);
+		if (kv->dim == 1) snprintf(g, sizeof(g), "%zu", global[0]);
+		else snprintf(g, sizeof(g), "%zu x %zu", global[0], global[1]);
+		if (local[0] == 0) snprintf(l, sizeof(l), "runtime");
+		else if (kv->dim == 1) snprintf(l, sizeof(l), "%zu", local[0]);
+		else snprintf(l, sizeof(l), "%zu x %zu", local[0], local[1]);
+
+		printf("%-10s %-18s %-22s %-12s %-10zu %s%s\n", kv->name, kv->entry, g, l, kv->local_mem(p), kv->description,
+			kv->supports(p) ? "" : " (not for this shape or type)");
+	}
+	printf("auto picks %s for %d x %d x %d %s\n", select_variant(p)->name, p->m, p->n, p->k, dtype_name(p->dtype));
+}
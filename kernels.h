@@ -0,0 +1,97 @@
+// registry of the matrix multiplication kernels, all of them live in one OpenCL program (KernelSource)
+// which is built once with the -D options of kernel_params
+
+#pragma once
+
+#include "CL/cl.h"
+#include <stddef.h>
+
+#include "precision.h"
+
+#define MAX_WORK_DIM 2
+#define SKINNY_MAX   32 //products with at most this many columns (rows) of C go to the skinny (wide) kernel
+#define SHAPE_GROUP  64 //work group size of the skinny and wide kernels
+#define SMALL_MAX    32 //products with no size above this go to the small kernel
+#define SMALL_GROUP  256 //upper bound of the work group size of the small kernel
+#define LOCAL_BENCH_REPS 256 //passes of the local memory micro benchmark over its tile
+
+extern const char* KernelSource;
+
+//build parameters shared by all variants, the product is C = alpha * op(A) * op(B) + beta * C with op(A) m x k,
+//op(B) k x n and C m x n, alpha and beta are kernel arguments so they do not need a rebuild
+struct kernel_params
+{
+	int dtype;          //element type, DTYPE_* of precision.h
+	int m, n, k;
+	int transa, transb; //1 if A is stored k x m (B n x k) and op() transposes it, the kernels read it in place
+	int mp, np, kp; //padded sizes, multiples of vec and tile, the padded variants work on mp x kp, kp x np, mp x np
+	int vec;        //vector width of vec and rows (2, 4, 8, 16)
+	int tile;       //local tile size of tiled and regblock (4, 8, 16, 32)
+	int wpt;        //elements of C per work item of regblock, divides tile
+	int pad;        //1 pads local tile rows to tile + 1 floats
+	int stage_bt;   //1 stages the tile of B transposed in local memory (tiled only)
+};
+
+//metadata of one variant, the kernel takes (A, B, C, alpha, beta) and optionally a __local buffer as argument 5
+//A, B and C hold dtype_size() bytes per element, alpha and beta are of the arithmetic type (kernel_set_scalar)
+struct kernel_variant
+{
+	const char* name;           //name on the command line and in baselines
+	const char* entry;          //kernel function in KernelSource
+	const char* description;
+	cl_uint dim;                //work dimensions
+	bool padded;                //works on the padded copies instead of m x k, k x n, m x n
+	bool local_arg;             //gets local_mem() bytes as __local argument 5
+	unsigned uses;              //KP_* flags of the parameters that change the kernel, they go into the label
+	void (*geometry)(const kernel_params* p, size_t* global, size_t* local); //local[0] == 0 lets the runtime choose
+	size_t (*local_mem)(const kernel_params* p);                               //bytes of local memory per work group
+	bool (*supports)(const kernel_params* p);                                  //false if the shape or type does not fit the kernel
+};
+
+#define KP_VEC      (1 << 0)
+#define KP_TILE     (1 << 1)
+#define KP_WPT      (1 << 2)
+#define KP_PAD      (1 << 3)
+#define KP_STAGE_BT (1 << 4)
+
+extern const kernel_variant kernel_variants[];
+extern const int num_kernel_variants;
+
+//exact int8 product outside the registry: it takes (A, Bt, C) with A m x kp and B transposed n x kp as chars
+//(zero padded along k) and C m x n as ints, only the sizes of kernel_params matter, dtype and transposes do not
+extern const kernel_variant int8_variant;
+
+//batched product outside the registry: matmult_batched takes (A, B, C, alpha, beta, offsets) and multiplies count
+//products of the shape of kernel_params in one launch, offsets is a buffer of one batch_offsets per product
+//(OpenCL 1.2 has no device pointers, so a pointer array becomes element offsets into the three buffers)
+struct batch_offsets
+{
+	cl_uint a, b, c;
+};
+
+//offsets of a strided batch, product b starts at element b * stride of A, B and C
+//prints the reason and returns false if the elements of the batch do not fit the 32 bit offsets
+bool batch_strided_offsets(batch_offsets* offsets, int count, size_t stride_a, size_t stride_b, size_t stride_c);
+
+//three dimensions, tile x tile work groups over each product and one product per index of dimension 2
+void batched_geometry(const kernel_params* p, int count, size_t* global, size_t* local);
+
+//checks the values and derives the padded sizes, prints the reason and returns false for an invalid combination
+bool kernel_params_init(kernel_params* p, int dtype, int m, int n, int k, int transa, int transb, int vec, int tile, int wpt, int pad, int stage_bt);
+
+void kernel_build_options(const kernel_params* p, char* options, size_t len);
+
+//sets a scalar argument (alpha, beta) as double or float, whichever the arithmetic type of p->dtype is
+cl_int kernel_set_scalar(cl_kernel kernel, cl_uint index, const kernel_params* p, double value);
+
+//returns NULL for an unknown name
+const kernel_variant* find_variant(const char* name);
+
+//shape based choice: small for tiny products, skinny or wide for extreme aspect ratios, tiled otherwise
+const kernel_variant* select_variant(const kernel_params* p);
+
+//name plus the parameters the variant depends on, e.g. "tiled_t16_pad_1000" or "skinny_t16_tn_half_4096x8x512"
+//(op(A) transposed, op(B) not, half storage), used for baselines
+void variant_label(const kernel_variant* v, const kernel_params* p, char* label, size_t len);
+
+void print_variants(const kernel_params* p);
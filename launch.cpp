@@ -0,0 +1,157 @@
+#include "launch.h"
+#include <stdio.h>
+#include <string.h>
+
+struct launch_limits
+{
+	size_t max_group;                   //of the kernel, at most CL_DEVICE_MAX_WORK_GROUP_SIZE
+	size_t max_items[LAUNCH_MAX_DIM];
+	size_t required[LAUNCH_MAX_DIM];    //reqd_work_group_size of the kernel, 0 if it has none
+	size_t multiple;                    //CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, the warp or wavefront
+	cl_ulong device_local_mem;
+	cl_uint units;
+};
+
+static bool query_limits(ocl_env* env, cl_kernel kernel, launch_limits* l, launch_plan* plan)
+{
+	cl_int err = clGetKernelWorkGroupInfo(kernel, env->device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &l->max_group, NULL);
+	if (err == CL_SUCCESS) err = clGetKernelWorkGroupInfo(kernel, env->device, CL_KERNEL_COMPILE_WORK_GROUP_SIZE, sizeof(l->required), l->required, NULL);
+	if (err == CL_SUCCESS) err = clGetKernelWorkGroupInfo(kernel, env->device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof(size_t), &l->multiple, NULL);
+	if (err == CL_SUCCESS) err = clGetKernelWorkGroupInfo(kernel, env->device, CL_KERNEL_LOCAL_MEM_SIZE, sizeof(cl_ulong), &plan->local_mem, NULL);
+	if (err == CL_SUCCESS) err = clGetKernelWorkGroupInfo(kernel, env->device, CL_KERNEL_PRIVATE_MEM_SIZE, sizeof(cl_ulong), &plan->private_mem, NULL);
+	if (err == CL_SUCCESS) err = clGetDeviceInfo(env->device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(l->max_items), l->max_items, NULL);
+	if (err == CL_SUCCESS) err = clGetDeviceInfo(env->device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(cl_ulong), &l->device_local_mem, NULL);
+	if (err == CL_SUCCESS) err = clGetDeviceInfo(env->device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &l->units, NULL);
+	if (l->multiple == 0) l->multiple = 1;
+	if (l->units == 0) l->units = 1;
+
+	return err == CL_SUCCESS;
+}
+
+//fills the derived numbers of plan for its local size
+static void estimate(const launch_limits* l, launch_plan* plan)
+{
+	plan->group_size = 1;
+	plan->groups = 1;
+	for (cl_uint d = 0; d < plan->dim; ++d)
+	{
+		plan->group_size *= plan->local[d];
+		plan->groups *= plan->global[d] / plan->local[d];
+	}
+	plan->groups_per_unit = plan->local_mem > 0 ? (size_t)(l->device_local_mem / plan->local_mem) : plan->groups;
+
+	//a group runs on one compute unit, fewer groups than units leave some idle, more groups than the units hold at
+	//once (local memory bounds the groups per unit) run in waves whose last one leaves units idle, and a group that
+	//is not a multiple of the warp wastes lanes of its last one
+	//private memory cannot bound the groups, OpenCL 1.2 reports the bytes of the kernel but not those of a unit
+	size_t slots = l->units * plan->groups_per_unit;
+	double busy = 1.0;
+	if (slots == 0) busy = 0.0;
+	else if (plan->groups < l->units) busy = (double)plan->groups / l->units;
+	else if (plan->groups > slots) busy = (double)plan->groups / (((plan->groups + slots - 1) / slots) * slots);
+	size_t lanes = (plan->group_size + l->multiple - 1) / l->multiple * l->multiple;
+	plan->occupancy = busy * plan->group_size / lanes;
+}
+
+//rises up to LAUNCH_TARGET_GROUP work items and falls again beyond
+static double size_preference(size_t group_size)
+{
+	return group_size <= LAUNCH_TARGET_GROUP ? (double)group_size : (double)LAUNCH_TARGET_GROUP * LAUNCH_TARGET_GROUP / group_size;
+}
+
+//every divisor combination of global within the limits, best occupancy first, then group sizes near
+//LAUNCH_TARGET_GROUP (enough warps to hide latency with, several groups per compute unit), then wider along dimension 0 where consecutive work items
+//read consecutive elements
+static void choose_local(const launch_limits* l, launch_plan* plan)
+{
+	launch_plan best = *plan, trial = *plan;
+	bool found = false;
+	size_t max_y = plan->dim > 1 ? l->max_group : 1;
+
+	for (cl_uint d = 0; d < plan->dim; ++d) trial.local[d] = 1;
+	for (size_t y = 1; y <= max_y && y <= plan->global[plan->dim > 1 ? 1 : 0]; ++y)
+	{
+		if (plan->dim > 1 && (plan->global[1] % y != 0 || y > l->max_items[1])) continue;
+		for (size_t x = 1; x * y <= l->max_group && x <= plan->global[0] && x <= l->max_items[0]; ++x)
+		{
+			if (plan->global[0] % x != 0) continue;
+			trial.local[0] = x;
+			if (plan->dim > 1) trial.local[1] = y;
+			estimate(l, &trial);
+			if (!found || trial.occupancy > best.occupancy
+				|| (trial.occupancy == best.occupancy && (size_preference(trial.group_size) > size_preference(best.group_size)
+				|| (size_preference(trial.group_size) == size_preference(best.group_size) && x > best.local[0]))))
+				best = trial;
+			found = true;
+		}
+	}
+	*plan = best;
+}
+
+bool launch_plan_init(ocl_env* env, cl_kernel kernel, cl_uint dim, const size_t* global, const size_t* local, launch_plan* plan)
+{
+	launch_limits limits;
+
+	memset(plan, 0, sizeof(*plan));
+	memset(&limits, 0, sizeof(limits));
+	plan->dim = dim;
+	for (cl_uint d = 0; d < dim; ++d)
+	{
+		plan->global[d] = global[d];
+		plan->local[d] = local[0] != 0 ? local[d] : 0;
+	}
+
+	if (!query_limits(env, kernel, &limits, plan))
+	{
+		printf("Unable to query the launch limits of the kernel, the runtime checks the launch\n");
+		return true;
+	}
+
+	if (local[0] == 0 && limits.required[0] == 0)
+	{
+		choose_local(&limits, plan);
+		return true;
+	}
+
+	// a kernel compiled with reqd_work_group_size only runs with that size
+	const size_t* want = local[0] != 0 ? local : limits.required;
+	for (cl_uint d = 0; d < dim; ++d)
+	{
+		if (want[d] == 0 || want[d] > limits.max_items[d] || global[d] % want[d] != 0 || (limits.required[0] != 0 && want[d] != limits.required[d]))
+		{
+			printf("Local size %zu does not fit dimension %u of the kernel (global %zu, at most %zu work items, required %zu)\n",
+				want[d], d, global[d], limits.max_items[d], limits.required[d]);
+			return false;
+		}
+		plan->local[d] = want[d];
+	}
+	estimate(&limits, plan);
+	if (plan->group_size > limits.max_group)
+	{
+		printf("Work groups of %zu work items are more than the %zu the kernel allows on this device\n", plan->group_size, limits.max_group);
+		return false;
+	}
+	if (plan->local_mem > limits.device_local_mem)
+	{
+		printf("The kernel needs %llu bytes of local memory per work group, the device has %llu\n",
+			(unsigned long long)plan->local_mem, (unsigned long long)limits.device_local_mem);
+		return false;
+	}
+
+	return true;
+}
+
+void launch_plan_print(const launch_plan* plan)
+{
+	if (plan->local[0] == 0)
+	{
+		printf("local chosen by the runtime\n");
+		return;
+	}
+
+	printf("local %zu", plan->local[0]);
+	for (cl_uint d = 1; d < plan->dim; ++d) printf(" x %zu", plan->local[d]);
+	printf(", %llu B local memory", (unsigned long long)plan->local_mem);
+	if (plan->local_mem > 0) printf(" (%zu groups per compute unit)", plan->groups_per_unit);
+	printf(", %llu B private, occupancy %.0f%%\n", (unsigned long long)plan->private_mem, 100.0 * plan->occupancy);
+}
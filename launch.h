@@ -0,0 +1,34 @@
+// launch planner: checks the geometry of a variant against the limits of the device and of the compiled kernel
+// (CL_KERNEL_WORK_GROUP_SIZE, local memory of the kernel and its __local arguments against CL_DEVICE_LOCAL_MEM_SIZE)
+// and picks the local size of kernels that leave it to the runtime by an occupancy estimate
+
+#pragma once
+
+#include "CL/cl.h"
+#include <stddef.h>
+
+#include "ocl.h"
+
+#define LAUNCH_MAX_DIM 3
+#define LAUNCH_TARGET_GROUP 256 //work group size the choice of a local size aims for when the occupancy is equal
+
+struct launch_plan
+{
+	cl_uint dim;
+	size_t global[LAUNCH_MAX_DIM], local[LAUNCH_MAX_DIM];
+	size_t group_size;          //work items per work group
+	size_t groups;              //work groups of the launch
+	cl_ulong local_mem;         //bytes of local memory per work group, __local variables and arguments
+	cl_ulong private_mem;       //bytes of private memory per work item as the compiler reports it
+	size_t groups_per_unit;     //work groups a compute unit can hold at once as far as local memory goes
+	double occupancy;           //0..1, share of the compute units with work over all waves times the share of full warps in a group
+};
+
+//plans the launch of kernel with the geometry of its variant, call it after clSetKernelArg so __local arguments count
+//a fixed local size is checked, local[0] == 0 gets the local size of the best occupancy that divides global
+//prints the reason and returns false if the kernel cannot run like this on the device, if the runtime does not
+//answer the queries the geometry is taken as it is
+bool launch_plan_init(ocl_env* env, cl_kernel kernel, cl_uint dim, const size_t* global, const size_t* local, launch_plan* plan);
+
+//e.g. "local 16 x 16, 8448 B local memory (5 groups per compute unit), 64 B private, occupancy 100%"
+void launch_plan_print(const launch_plan* plan);
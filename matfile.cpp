@@ -0,0 +1,205 @@
+#include "matfile.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "matrix.h"
+#include "precision.h"
+
+uint64_t matfile_checksum(const void* data, size_t bytes, uint64_t hash)
+{
+	const unsigned char* p = (const unsigned char*)data;
+
+	for (size_t i = 0; i < bytes; ++i)
+	{
+		hash ^= p[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
+static_assert(sizeof(matfile_header) == 64, "the header is 64 bytes on disk");
+
+//rows (columns) times ld elements, false if that does not fit a size_t
+static bool payload_bytes(const matfile_header* h, size_t* bytes)
+{
+	size_t lines = (size_t)(h->layout == MATFILE_ROW_MAJOR ? h->rows : h->cols), elements;
+
+	return !__builtin_mul_overflow(lines, (size_t)h->ld, &elements) && !__builtin_mul_overflow(elements, dtype_size((int)h->dtype), bytes);
+}
+
+//the format is little endian and used in place, so the host has to be as well
+static bool little_endian_host(void)
+{
+	const uint32_t probe = MATFILE_BYTE_ORDER;
+	unsigned char first;
+
+	memcpy(&first, &probe, 1);
+	return first == 0x04;
+}
+
+bool matfile_write(const char* path, int dtype, int rows, int cols, int ld, const void* data)
+{
+	matfile_header h;
+	size_t es = dtype_size(dtype), row_bytes = (size_t)cols * es;
+	const char* src = (const char*)data;
+
+	if (!little_endian_host())
+	{
+		printf("Unable to write %s: matrix files are little endian\n", path);
+		return false;
+	}
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, MATFILE_MAGIC, sizeof(h.magic));
+	h.version = MATFILE_VERSION;
+	h.byte_order = MATFILE_BYTE_ORDER;
+	h.dtype = (uint32_t)dtype;
+	h.layout = MATFILE_ROW_MAJOR;
+	h.rows = (uint64_t)rows;
+	h.cols = (uint64_t)cols;
+	h.ld = (uint64_t)cols;
+	h.offset = MATFILE_ALIGN;
+	h.checksum = MATFILE_FNV_BASIS;
+	for (int i = 0; i < rows; ++i) h.checksum = matfile_checksum(src + (size_t)i * ld * es, row_bytes, h.checksum);
+
+	FILE* f = fopen(path, "wb");
+	if (f == NULL)
+	{
+		printf("Unable to write %s\n", path);
+		return false;
+	}
+
+	static const char zeros[MATFILE_ALIGN] = { 0 };
+	bool ok = fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(zeros, MATFILE_ALIGN - sizeof(h), 1, f) == 1;
+	for (int i = 0; ok && i < rows; ++i) ok = fwrite(src + (size_t)i * ld * es, row_bytes, 1, f) == 1;
+	ok = fclose(f) == 0 && ok;
+	if (!ok) printf("Unable to write %s\n", path);
+
+	return ok;
+}
+
+static bool valid_header(const matfile_header* h, size_t file_bytes, const char* path)
+{
+	const char* problem = NULL;
+	size_t payload = 0;
+
+	if (memcmp(h->magic, MATFILE_MAGIC, sizeof(h->magic)) != 0) problem = "not a matrix file";
+	else if (h->version != MATFILE_VERSION) problem = "unknown version";
+	else if (!little_endian_host()) problem = "matrix files are little endian, this host is not";
+	else if (h->byte_order != MATFILE_BYTE_ORDER) problem = "not little endian";
+	else if (h->dtype >= NUM_DTYPES || h->layout >= NUM_MATFILE_LAYOUTS) problem = "unknown element type or layout";
+	else if (h->rows == 0 || h->cols == 0 || h->rows > INT_MAX || h->cols > INT_MAX) problem = "invalid size";
+	else if (h->ld < (h->layout == MATFILE_ROW_MAJOR ? h->cols : h->rows) || h->ld > INT_MAX) problem = "invalid leading dimension";
+	else if (h->offset % MATFILE_ALIGN != 0 || h->offset < sizeof(*h)) problem = "unaligned elements";
+	else if (!payload_bytes(h, &payload)) problem = "invalid size";
+	else if (h->offset > file_bytes || payload > file_bytes - h->offset) problem = "truncated";
+
+	if (problem != NULL) printf("%s: %s\n", path, problem);
+	return problem == NULL;
+}
+
+bool matfile_open(matfile* f, const char* path, bool verify)
+{
+	struct stat st;
+
+	memset(f, 0, sizeof(*f));
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		printf("Unable to open %s\n", path);
+		return false;
+	}
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(matfile_header))
+	{
+		printf("%s: not a matrix file\n", path);
+		close(fd);
+		return false;
+	}
+
+	// private and writable so a device buffer may use it, the file itself is never changed
+	void* map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+	{
+		printf("Unable to map %s\n", path);
+		return false;
+	}
+
+	memcpy(&f->header, map, sizeof(f->header));
+	f->map = map;
+	f->map_bytes = (size_t)st.st_size;
+	if (!valid_header(&f->header, f->map_bytes, path))
+	{
+		matfile_close(f);
+		return false;
+	}
+	f->data = (char*)map + f->header.offset;
+
+	size_t payload = 0;
+	payload_bytes(&f->header, &payload);
+	if (verify && matfile_checksum(f->data, payload, MATFILE_FNV_BASIS) != f->header.checksum)
+	{
+		printf("%s: checksum mismatch\n", path);
+		matfile_close(f);
+		return false;
+	}
+	return true;
+}
+
+void matfile_close(matfile* f)
+{
+	if (f->map != NULL) munmap(f->map, f->map_bytes);
+	memset(f, 0, sizeof(*f));
+}
+
+bool matfile_dense_float(const matfile* f)
+{
+	return f->header.dtype == DTYPE_FLOAT && f->header.layout == MATFILE_ROW_MAJOR && f->header.ld == f->header.cols;
+}
+
+float** matfile_rows(const matfile* f)
+{
+	int rows = (int)f->header.rows;
+	float** R = (float**)malloc(rows * sizeof(float*));
+
+	for (int i = 0; i < rows; i++)
+		R[i] = (float*)f->data + (size_t)i * f->header.ld;
+	return R;
+}
+
+float** matfile_to_mat(const matfile* f)
+{
+	int rows = (int)f->header.rows, cols = (int)f->header.cols, dtype = (int)f->header.dtype;
+	size_t es = dtype_size(dtype), ld = (size_t)f->header.ld;
+	const char* src = (const char*)f->data;
+	float** M = alloc_mat(rows, cols);
+
+	if (f->header.layout == MATFILE_ROW_MAJOR)
+	{
+		for (int i = 0; i < rows; i++) from_dtype(dtype, src + i * ld * es, M[i], cols);
+		return M;
+	}
+
+	// column by column through a buffer, then into the rows
+	float* column = (float*)malloc(rows * sizeof(float));
+	for (int j = 0; j < cols; j++)
+	{
+		from_dtype(dtype, src + j * ld * es, column, rows);
+		for (int i = 0; i < rows; i++) M[i][j] = column[i];
+	}
+	free(column);
+	return M;
+}
+
+cl_mem matfile_buffer(ocl_env* env, const matfile* f, cl_int* err)
+{
+	size_t payload = 0;
+
+	payload_bytes(&f->header, &payload); //checked by matfile_open
+	return clCreateBuffer(env->context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, payload, f->data, err);
+}
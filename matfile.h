@@ -0,0 +1,72 @@
+// binary matrix files: a 64 byte header (element type, size, leading dimension, layout, checksum) and the elements
+// from a page aligned offset on, so a file can be mapped and used in place, by the host through row pointers and
+// by the device through a buffer on the mapping (CL_MEM_USE_HOST_PTR), numbers are stored little endian and the
+// byte_order field says so, files are only read and written on little endian hosts
+// written by matfile_write (the driver's --save-c), read by matfile_open (--load-a, --load-b, --load-c)
+
+#pragma once
+
+#include "CL/cl.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ocl.h"
+
+#define MATFILE_MAGIC   "PVSMAT\r\n" //8 bytes, the line ending catches text mode transfers
+#define MATFILE_VERSION 2
+#define MATFILE_BYTE_ORDER 0x01020304u //reads back as this only in the byte order it was written in
+#define MATFILE_ALIGN   4096        //the elements start at a multiple of this
+
+enum matfile_layout
+{
+	MATFILE_ROW_MAJOR,  //ld elements from one row to the next
+	MATFILE_COL_MAJOR,  //ld elements from one column to the next
+	NUM_MATFILE_LAYOUTS
+};
+
+struct matfile_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t dtype;         //DTYPE_* of precision.h
+	uint32_t layout;        //MATFILE_*
+	uint32_t byte_order;    //MATFILE_BYTE_ORDER, stored as 04 03 02 01
+	uint64_t rows, cols, ld;
+	uint64_t offset;        //of the elements from the start of the file
+	uint64_t checksum;      //FNV-1a of the rows (columns) times ld elements
+};
+
+struct matfile
+{
+	matfile_header header;
+	void* data;             //first element inside the mapping
+	void* map;
+	size_t map_bytes;
+};
+
+//64 bit FNV-1a, continued from hash (start with MATFILE_FNV_BASIS)
+#define MATFILE_FNV_BASIS 0xcbf29ce484222325ull
+uint64_t matfile_checksum(const void* data, size_t bytes, uint64_t hash);
+
+//writes a rows x cols matrix whose rows are ld elements apart in memory as a dense row major file
+bool matfile_write(const char* path, int dtype, int rows, int cols, int ld, const void* data);
+
+//maps a matrix file copy on write (the mapping can back a device buffer without changing the file), checks the
+//header and, with verify, the checksum, prints the reason and returns false if it is not a valid matrix file
+//verify reads every element once, so the file is no longer used without touching it, without it only the pages
+//that are used get read
+bool matfile_open(matfile* f, const char* path, bool verify);
+
+void matfile_close(matfile* f);
+
+//true for row major float files without gaps between the rows, those can be used in place as they are
+bool matfile_dense_float(const matfile* f);
+
+//row pointers into the mapping (free() them, the elements belong to the mapping), only for matfile_dense_float
+float** matfile_rows(const matfile* f);
+
+//a copy as alloc_mat matrix of floats, for any element type and layout
+float** matfile_to_mat(const matfile* f);
+
+//a read only device buffer on the mapped elements, nothing is copied until the runtime needs to
+cl_mem matfile_buffer(ocl_env* env, const matfile* f, cl_int* err);
@@ -0,0 +1,79 @@
+#include "matrix.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+float** alloc_mat(int row, int col)
+{
+	float** A1, * A2;
+
+	A1 = (float**)calloc(row, sizeof(float*));	 // pointer on rows
+	A2 = (float*)calloc(row * col, sizeof(float));    // all matrix elements
+	for (int i = 0; i < row; i++)
+		A1[i] = A2 + i * col;
+
+	return A1;
+}
+
+void init_mat(float** A, int row, int col)
+{
+	for (int i = 0; i < row * col; i++)
+		A[0][i] = (float)(rand() % 10);
+}
+
+void init_zero(float** A, int row, int col)
+{
+	for (int i = 0; i < row * col; i++)
+		A[0][i] = 0;
+}
+
+void print_mat(float** A, int row, int col, char const* tag)
+{
+	int i, j;
+
+	printf("Matrix %s:\n", tag);
+	for (i = 0; i < row; i++)
+	{
+		for (j = 0; j < col; j++)
+			printf("%6.1f   ", A[i][j]);
+		printf("\n");
+	}
+}
+
+void free_mat(float** A, int num_rows) {
+	free(A[0]);
+	free(A);
+}
+
+float** pad_mat(float** A, int row, int col, int pad_row, int pad_col)
+{
+	float** P = alloc_mat(pad_row, pad_col);
+	for (int i = 0; i < row; i++)
+		memcpy(P[i], A[i], col * sizeof(float));
+
+	return P;
+}
+
+bool compare_mat(float** A, float** B, int row, int col) {
+	for(int i = 0; i < row; ++i)
+		for (int j = 0; j < col; ++j)
+		{
+			if (A[i][j] != B[i][j]) return false; //iterate through all elements, if any are different return that they are not equal
+		}
+
+	return true; //if we reached this point we haven't found any differences as we would have otherwise returned false already, so we can return true
+}
+
+float max_rel_diff(float** A, float** B, int row, int col)
+{
+	float worst = 0.f;
+	for (int i = 0; i < row; ++i)
+		for (int j = 0; j < col; ++j)
+		{
+			float d = fabsf(A[i][j] - B[i][j]) / fmaxf(1.f, fabsf(B[i][j]));
+			if (d > worst) worst = d;
+		}
+
+	return worst;
+}
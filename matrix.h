@@ -0,0 +1,17 @@
+// host side matrices: float** row pointers into one contiguous block, so A[0] can be handed to clEnqueueWriteBuffer
+
+#pragma once
+
+float** alloc_mat(int row, int col);
+void init_mat(float** A, int row, int col);
+void init_zero(float** A, int row, int col);
+void print_mat(float** A, int row, int col, char const* tag);
+void free_mat(float** A, int num_rows);
+
+//copies A into a zero initialized pad_row x pad_col matrix, so rows can start at multiples of a vector width
+float** pad_mat(float** A, int row, int col, int pad_row, int pad_col);
+
+bool compare_mat(float** A, float** B, int row, int col);
+
+//largest |A - B| relative to max(1, |B|), for results whose rounding depends on the order of the summation
+float max_rel_diff(float** A, float** B, int row, int col);
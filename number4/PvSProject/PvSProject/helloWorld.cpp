@@ -187,13 +187,14 @@ int main(void)
 			return 0;
 		}
 
-		err = clGetDeviceInfo(device_id, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(size_t), local, NULL);
+		cl_uint units = 0;
+		err = clGetDeviceInfo(device_id, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &units, NULL);
 		if (err != CL_SUCCESS)
 		{
 			printf("I am sad. Error: %d\n", err);
 			return 0;
 		}
-		local[0] = ggt(global[0], local[0]);
+		local[0] = ggt(global[0], units);
 	}
 
 	context = clCreateContext(0, 1, &device_id, NULL, NULL, &err);
@@ -248,7 +249,7 @@ int main(void)
 	clSetKernelArg(kernel, 0, sizeof(cl_mem), &Ap);
 	clSetKernelArg(kernel, 1, sizeof(cl_mem), &Bp);
 	clSetKernelArg(kernel, 2, sizeof(cl_mem), &Cp);
-	clSetKernelArg(kernel, 3, sizeof(cl_mem)*DATA_SIZE, NULL);
+	clSetKernelArg(kernel, 3, sizeof(float)* DATA_SIZE, NULL);
 	clSetKernelArg(kernel, 4, sizeof(float)* DATA_SIZE, NULL);
 
 
@@ -0,0 +1,198 @@
+#include "ocl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool ocl_init(ocl_env* env)
+{
+	cl_int				err;                      //stores information about success or failure of commands
+	cl_platform_id*		platforms = NULL;         //ids of the platforms
+	char			    platform_name[1024];      //name of the platform
+	cl_uint			    num_of_platforms = 0,     //number of platforms
+						num_of_devices = 0;       //number of devices
+	unsigned int		nvidia_platform = 0;
+
+	memset(env, 0, sizeof(*env));
+
+	// gets the number of available platforms, returning if it was successful
+	err = clGetPlatformIDs(0, NULL, &num_of_platforms);
+	if (err != CL_SUCCESS || num_of_platforms == 0)
+	{
+		printf("No platforms found. Error: %d\n", err);
+		return false;
+	}
+
+	// gets the ids of the platforms
+	platforms = (cl_platform_id*)malloc(num_of_platforms * sizeof(cl_platform_id));
+	err = clGetPlatformIDs(num_of_platforms, platforms, NULL);
+	if (err != CL_SUCCESS)
+	{
+		printf("No platforms found. Error: %d\n", err);
+		free(platforms);
+		return false;
+	}
+
+	// For every platform
+	for (unsigned int i = 0; i < num_of_platforms; i++)
+	{
+		// Attempt to get its information
+		err = clGetPlatformInfo(platforms[i], CL_PLATFORM_NAME, sizeof(platform_name), platform_name, NULL);
+		if (err != CL_SUCCESS)
+		{
+			printf("Could not get information about platform. Error: %d\n", err);
+			free(platforms);
+			return false;
+		}
+
+		// check if using nvidia
+		if (strstr(platform_name, "NVIDIA") != NULL)
+		{
+			nvidia_platform = i;
+			break;
+		}
+	}
+	env->platform = platforms[nvidia_platform];
+	free(platforms);
+
+	// Get ID of a GPU, CPU runtimes or accelerators are fine too if there is none
+	err = clGetDeviceIDs(env->platform, CL_DEVICE_TYPE_GPU, 1, &env->device, &num_of_devices);
+	if (err != CL_SUCCESS)
+		err = clGetDeviceIDs(env->platform, CL_DEVICE_TYPE_ALL, 1, &env->device, &num_of_devices);
+	if (err != CL_SUCCESS)
+	{
+		printf("Could not get device in platform. Error: %d\n", err);
+		return false;
+	}
+
+	// Open Context
+	env->context = clCreateContext(0, 1, &env->device, NULL, NULL, &err);
+	if (err != CL_SUCCESS)
+	{
+		printf("Unable to create context. Error: %d\n", err);
+		return false;
+	}
+
+	// Creates a queue (FIFO)
+	env->queue = clCreateCommandQueue(env->context, env->device, CL_QUEUE_PROFILING_ENABLE, &err);
+	if (err != CL_SUCCESS)
+	{
+		printf("Unable to create command queue. Error: %d\n", err);
+		clReleaseContext(env->context);
+		env->context = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+//builds a created program for the device, prints the log and releases it on failure
+static cl_program build_program(ocl_env* env, cl_program program, const char* options, cl_int* err)
+{
+	*err = clBuildProgram(program, 1, &env->device, options, NULL, NULL);
+	if (*err != CL_SUCCESS)
+	{
+		char log[16384];
+		printf("Error building program. Error: %d\n", *err);
+		if (clGetProgramBuildInfo(program, env->device, CL_PROGRAM_BUILD_LOG, sizeof(log), log, NULL) == CL_SUCCESS)
+			printf("%s\n", log);
+		clReleaseProgram(program);
+		return NULL;
+	}
+
+	return program;
+}
+
+cl_program ocl_build(ocl_env* env, const char* source, const char* options, cl_int* err)
+{
+	// Generate online program
+	cl_program program = clCreateProgramWithSource(env->context, 1, &source, NULL, err);
+	if (*err != CL_SUCCESS)
+	{
+		printf("Unable to create program. Error: %d\n", *err);
+		return NULL;
+	}
+
+	// Compile and link the kernel source text
+	return build_program(env, program, options, err);
+}
+
+cl_program ocl_build_binary(ocl_env* env, const unsigned char* binary, size_t size, const char* options, cl_int* err)
+{
+	cl_int status;
+	cl_program program = clCreateProgramWithBinary(env->context, 1, &env->device, &size, &binary, &status, err);
+	if (*err == CL_SUCCESS) *err = status;
+	if (*err != CL_SUCCESS)
+	{
+		printf("Unable to load program binary. Error: %d\n", *err);
+		if (program != NULL) clReleaseProgram(program);
+		return NULL;
+	}
+
+	return build_program(env, program, options, err);
+}
+
+cl_program ocl_build_il(ocl_env* env, const void* il, size_t size, const char* options, cl_int* err)
+{
+#ifdef CL_VERSION_2_1
+	char versions[256];
+
+	// OpenCL 1.2 devices do not know the query, 2.1 and later ones list e.g. "SPIR-V_1.0 SPIR-V_1.2"
+	if (clGetDeviceInfo(env->device, CL_DEVICE_IL_VERSION, sizeof(versions), versions, NULL) == CL_SUCCESS && strstr(versions, "SPIR-V") != NULL)
+	{
+		cl_program program = clCreateProgramWithIL(env->context, il, size, err);
+		if (*err != CL_SUCCESS)
+		{
+			printf("Unable to load SPIR-V module. Error: %d\n", *err);
+			return NULL;
+		}
+		return build_program(env, program, options, err);
+	}
+#else
+	(void)il; (void)size; (void)options;
+#endif
+	*err = CL_INVALID_OPERATION;
+	return NULL;
+}
+
+unsigned char* ocl_program_binary(cl_program program, size_t* size)
+{
+	// one binary per device of the program, which is only ever env->device here
+	if (clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size_t), size, NULL) != CL_SUCCESS || *size == 0) return NULL;
+
+	unsigned char* binary = (unsigned char*)malloc(*size);
+	if (clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(unsigned char*), &binary, NULL) != CL_SUCCESS)
+	{
+		printf("Unable to read the program binary for the device\n");
+		free(binary);
+		return NULL;
+	}
+	return binary;
+}
+
+bool ocl_has_extension(ocl_env* env, const char* name)
+{
+	size_t size = 0;
+	bool found = false;
+
+	if (clGetDeviceInfo(env->device, CL_DEVICE_EXTENSIONS, 0, NULL, &size) != CL_SUCCESS || size == 0) return false;
+
+	char* extensions = (char*)malloc(size + 1);
+	if (clGetDeviceInfo(env->device, CL_DEVICE_EXTENSIONS, size, extensions, NULL) == CL_SUCCESS)
+	{
+		extensions[size] = '\0';
+		//space separated list, a match has to be a whole word and not the prefix of a longer name
+		size_t len = strlen(name);
+		for (char* at = strstr(extensions, name); at != NULL && !found; at = strstr(at + 1, name))
+			found = (at == extensions || at[-1] == ' ') && (at[len] == ' ' || at[len] == '\0');
+	}
+	free(extensions);
+
+	return found;
+}
+
+void ocl_release(ocl_env* env)
+{
+	if (env->queue != NULL) clReleaseCommandQueue(env->queue);
+	if (env->context != NULL) clReleaseContext(env->context);
+	memset(env, 0, sizeof(*env));
+}
@@ -0,0 +1,34 @@
+// OpenCL setup shared by every program: platform and device choice, context, profiling queue, program builds
+
+#pragma once
+
+#include "CL/cl.h"
+
+struct ocl_env
+{
+	cl_platform_id		platform;
+	cl_device_id		device;
+	cl_context			context;
+	cl_command_queue	queue;      //in order, with CL_QUEUE_PROFILING_ENABLE
+};
+
+//prefers the NVIDIA platform and a GPU on it, falls back to the first platform and any device type
+//prints the reason and returns false on failure
+bool ocl_init(ocl_env* env);
+
+//creates and builds a program from source, prints the build log if compilation fails
+cl_program ocl_build(ocl_env* env, const char* source, const char* options, cl_int* err);
+
+//creates and builds a program from a device binary (of clGetProgramInfo CL_PROGRAM_BINARIES) or from a SPIR-V
+//module, the options still go to clBuildProgram, prints the build log if it fails
+//SPIR-V needs an OpenCL 2.1 header and a device listing SPIR-V in CL_DEVICE_IL_VERSION, else err is CL_INVALID_OPERATION
+cl_program ocl_build_binary(ocl_env* env, const unsigned char* binary, size_t size, const char* options, cl_int* err);
+cl_program ocl_build_il(ocl_env* env, const void* il, size_t size, const char* options, cl_int* err);
+
+//the device binary of a built program, malloc'd, NULL if the runtime does not hand it out
+unsigned char* ocl_program_binary(cl_program program, size_t* size);
+
+//true if the device lists the extension, e.g. "cl_khr_fp64"
+bool ocl_has_extension(ocl_env* env, const char* name);
+
+void ocl_release(ocl_env* env);
@@ -0,0 +1,195 @@
+#include "ooc.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "launch.h"
+#include "prebuilt.h"
+
+static size_t round_up(size_t x, size_t multiple)
+{
+	return (x + multiple - 1) / multiple * multiple;
+}
+
+static size_t min_size(size_t a, size_t b)
+{
+	return a < b ? a : b;
+}
+
+bool ooc_plan(ocl_env* env, const kernel_params* p, size_t mem_limit, ooc_blocks* b)
+{
+	size_t es = dtype_size(p->dtype), align = p->vec > p->tile ? p->vec : p->tile;
+	size_t bm = p->mp, bn = p->np, bk = p->kp; //already multiples of align
+	cl_ulong max_alloc = 0, global_mem = 0;
+
+	// a runtime that does not answer leaves them 0, then only mem_limit counts
+	clGetDeviceInfo(env->device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong), &max_alloc, NULL);
+	clGetDeviceInfo(env->device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(cl_ulong), &global_mem, NULL);
+	size_t single = max_alloc > 0 ? (size_t)max_alloc : SIZE_MAX;
+	size_t total = global_mem > 0 ? (size_t)(global_mem / OOC_MEM_SHARE) : SIZE_MAX;
+	if (mem_limit != 0)
+	{
+		single = min_size(single, mem_limit);
+		total = mem_limit;
+	}
+
+	while (bm * bk * es > single || bk * bn * es > single || bm * bn * es > single || (bm * bk + bk * bn + bm * bn) * es > total)
+	{
+		if (bm <= align && bn <= align && bk <= align)
+		{
+			printf("Not even blocks of %zu x %zu x %zu fit into %zu bytes of device memory\n", bm, bn, bk, total);
+			return false;
+		}
+		size_t* largest = bm >= bn && bm >= bk ? &bm : bn >= bk ? &bn : &bk;
+		*largest = round_up(*largest / 2, align);
+	}
+
+	if (!kernel_params_init(&b->block, p->dtype, (int)bm, (int)bn, (int)bk, p->transa, p->transb, p->vec, p->tile, p->wpt, p->pad, p->stage_bt))
+		return false;
+	b->count_m = (int)((p->m + bm - 1) / bm);
+	b->count_n = (int)((p->n + bn - 1) / bn);
+	b->count_k = (int)((p->k + bk - 1) / bk);
+	b->bytes = (bm * bk + bk * bn + bm * bn) * es;
+
+	return true;
+}
+
+//rows x cols elements at (row, col) of a host matrix into the top left of a block buffer whose rows are buf_cols
+//elements apart, a partial block clears the buffer first so the padding is zero
+static cl_int write_block(ocl_env* env, cl_mem buf, size_t buf_rows, size_t buf_cols, const void* src, size_t ld,
+	size_t row, size_t col, size_t rows, size_t cols, size_t es)
+{
+	size_t buffer_origin[3] = { 0, 0, 0 }, host_origin[3] = { col * es, row, 0 }, region[3] = { cols * es, rows, 1 };
+
+	if (rows < buf_rows || cols < buf_cols)
+	{
+		cl_uchar zero = 0;
+		cl_int err = clEnqueueFillBuffer(env->queue, buf, &zero, sizeof(zero), 0, buf_rows * buf_cols * es, 0, NULL, NULL);
+		if (err != CL_SUCCESS) return err;
+	}
+	return clEnqueueWriteBufferRect(env->queue, buf, CL_FALSE, buffer_origin, host_origin, region, buf_cols * es, 0,
+		ld * es, 0, src, 0, NULL, NULL);
+}
+
+static cl_int read_block(ocl_env* env, cl_mem buf, size_t buf_cols, void* dst, size_t ld, size_t row, size_t col,
+	size_t rows, size_t cols, size_t es)
+{
+	size_t buffer_origin[3] = { 0, 0, 0 }, host_origin[3] = { col * es, row, 0 }, region[3] = { cols * es, rows, 1 };
+
+	return clEnqueueReadBufferRect(env->queue, buf, CL_TRUE, buffer_origin, host_origin, region, buf_cols * es, 0,
+		ld * es, 0, dst, 0, NULL, NULL);
+}
+
+bool ooc_gemm(ocl_env* env, const kernel_params* p, size_t mem_limit, double alpha, const void* A, size_t lda,
+	const void* B, size_t ldb, double beta, void* C, size_t ldc, ooc_stats* stats)
+{
+	ooc_blocks b;
+	ooc_stats local_stats;
+	char options[512];
+	cl_int err;
+
+	if (stats == NULL) stats = &local_stats;
+	memset(stats, 0, sizeof(*stats));
+	if (!ooc_plan(env, p, mem_limit, &b)) return false;
+
+	const kernel_params* bp = &b.block;
+	const kernel_variant* v = select_variant(bp);
+	size_t es = dtype_size(p->dtype), bm = bp->m, bn = bp->n, bk = bp->k;
+
+	kernel_build_options(bp, options, sizeof(options));
+	cl_program program = prebuilt_build(env, KernelSource, options, &err);
+	if (program == NULL) return false;
+	cl_kernel kernel = clCreateKernel(program, v->entry, &err);
+	if (err != CL_SUCCESS)
+	{
+		printf("Error setting kernel %s. Error: %d\n", v->entry, err);
+		clReleaseProgram(program);
+		return false;
+	}
+
+	// the blocks are multiples of vec and tile, so the padded and the unpadded variants see the same layout
+	cl_mem Ab = clCreateBuffer(env->context, CL_MEM_READ_ONLY, bm * bk * es, NULL, &err);
+	cl_mem Bb = err == CL_SUCCESS ? clCreateBuffer(env->context, CL_MEM_READ_ONLY, bk * bn * es, NULL, &err) : NULL;
+	cl_mem Cb = err == CL_SUCCESS ? clCreateBuffer(env->context, CL_MEM_READ_WRITE, bm * bn * es, NULL, &err) : NULL;
+	if (err != CL_SUCCESS) printf("Unable to create the block buffers of %zu bytes. Error: %d\n", b.bytes, err);
+
+	size_t global[MAX_WORK_DIM], local[MAX_WORK_DIM];
+	launch_plan plan;
+	bool ok = err == CL_SUCCESS;
+	if (ok)
+	{
+		clSetKernelArg(kernel, 0, sizeof(cl_mem), &Ab);
+		clSetKernelArg(kernel, 1, sizeof(cl_mem), &Bb);
+		clSetKernelArg(kernel, 2, sizeof(cl_mem), &Cb);
+		kernel_set_scalar(kernel, 3, bp, alpha);
+		kernel_set_scalar(kernel, 4, bp, beta);
+		if (v->local_arg) clSetKernelArg(kernel, 5, v->local_mem(bp), NULL);
+		v->geometry(bp, global, local);
+		ok = launch_plan_init(env, kernel, v->dim, global, local, &plan);
+	}
+
+	// C blocks row by row in serpentine order and the k blocks of consecutive C blocks in alternating direction,
+	// so the A and B blocks of the last step are often the ones the next step needs
+	long a_resident = -1, b_resident = -1;
+	int c_index = 0;
+	for (int i = 0; ok && i < b.count_m; ++i)
+		for (int jj = 0; ok && jj < b.count_n; ++jj, ++c_index)
+		{
+			int j = i % 2 == 0 ? jj : b.count_n - 1 - jj;
+			size_t row = (size_t)i * bm, col = (size_t)j * bn;
+			size_t rows = min_size(bm, p->m - row), cols = min_size(bn, p->n - col);
+
+			if (beta != 0)
+			{
+				err = write_block(env, Cb, bm, bn, C, ldc, row, col, rows, cols, es);
+				stats->uploaded += rows * cols * es;
+			}
+			for (int step = 0; err == CL_SUCCESS && step < b.count_k; ++step)
+			{
+				int kk = c_index % 2 == 0 ? step : b.count_k - 1 - step;
+				size_t depth_at = (size_t)kk * bk, depth = min_size(bk, p->k - depth_at);
+
+				// A is stored k x m when op() transposes it, B n x k, the kernels read the blocks in place
+				if (a_resident != (long)i * b.count_k + kk)
+				{
+					err = p->transa ? write_block(env, Ab, bk, bm, A, lda, depth_at, row, depth, rows, es)
+						: write_block(env, Ab, bm, bk, A, lda, row, depth_at, rows, depth, es);
+					a_resident = (long)i * b.count_k + kk;
+					stats->uploaded += rows * depth * es;
+				}
+				if (err == CL_SUCCESS && b_resident != (long)kk * b.count_n + j)
+				{
+					err = p->transb ? write_block(env, Bb, bn, bk, B, ldb, col, depth_at, cols, depth, es)
+						: write_block(env, Bb, bk, bn, B, ldb, depth_at, col, depth, cols, es);
+					b_resident = (long)kk * b.count_n + j;
+					stats->uploaded += depth * cols * es;
+				}
+
+				// the first step scales the old C, the others add to the partial sum
+				if (err == CL_SUCCESS) err = kernel_set_scalar(kernel, 4, bp, step == 0 ? beta : 1.0);
+				if (err == CL_SUCCESS) err = clEnqueueNDRangeKernel(env->queue, kernel, v->dim, NULL, plan.global, plan.local[0] ? plan.local : NULL, 0, NULL, NULL);
+				++stats->launches;
+			}
+			if (err == CL_SUCCESS)
+			{
+				stats->c_written = true;
+				err = read_block(env, Cb, bn, C, ldc, row, col, rows, cols, es);
+				stats->downloaded += rows * cols * es;
+			}
+			if (err != CL_SUCCESS)
+			{
+				printf("Out-of-core block (%d, %d) failed. Error: %d\n", i, j, err);
+				ok = false;
+			}
+		}
+
+	// the uploads of a failed block still read A, B and C of the caller
+	if (!ok) clFinish(env->queue);
+	if (Ab != NULL) clReleaseMemObject(Ab);
+	if (Bb != NULL) clReleaseMemObject(Bb);
+	if (Cb != NULL) clReleaseMemObject(Cb);
+	clReleaseKernel(kernel);
+	clReleaseProgram(program);
+
+	return ok;
+}
@@ -0,0 +1,42 @@
+// out-of-core product: matrices too large for CL_DEVICE_MAX_MEM_ALLOC_SIZE or the global memory of the device are
+// multiplied block by block through three fixed size device buffers, one C block stays on the device while the
+// blocks of A and B along k stream through, and blocks that are still resident are not uploaded again
+// every block has the same size, the edges are zero padded, so one program with the block sizes as build options
+// serves the whole product
+
+#pragma once
+
+#include "CL/cl.h"
+#include <stddef.h>
+
+#include "kernels.h"
+#include "ocl.h"
+
+#define OOC_MEM_SHARE 2 //the blocks take at most 1 / OOC_MEM_SHARE of the global memory, the rest is left to others
+
+struct ooc_blocks
+{
+	kernel_params block;        //sizes and build parameters of one block product
+	int count_m, count_n, count_k;
+	size_t bytes;               //device memory of the three block buffers
+};
+
+struct ooc_stats
+{
+	size_t uploaded, downloaded;    //bytes
+	int launches;
+	bool c_written;                 //blocks of C went back to the host, after a failure C is then neither the old nor the new C
+};
+
+//splits the product of p into blocks whose buffers fit mem_limit bytes together (0 takes the limits of the device),
+//halving the largest block size until they do, a product that fits as it is stays one block
+//prints the reason and returns false if not even the smallest blocks fit
+bool ooc_plan(ocl_env* env, const kernel_params* p, size_t mem_limit, ooc_blocks* b);
+
+//C = alpha * op(A) * op(B) + beta * C for host matrices of the element type of p (rows lda, ldb, ldc elements
+//apart, A and B as stored), built and run block by block as ooc_plan splits it, stats may be NULL
+//the blocks along k are summed in C on the device, in the storage type of p
+//on failure nothing is left in flight, and a caller may only run the product again elsewhere if stats->c_written is
+//false or beta is 0
+bool ooc_gemm(ocl_env* env, const kernel_params* p, size_t mem_limit, double alpha, const void* A, size_t lda,
+	const void* B, size_t ldb, double beta, void* C, size_t ldc, ooc_stats* stats);
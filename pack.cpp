@@ -0,0 +1,121 @@
+#include "pack.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define PACK_X86 1 //the AVX2 packer is compiled with a target attribute and chosen at run time, as in host_igemm
+#else
+#define PACK_X86 0
+#endif
+
+bool pack4_range(const float* x, size_t n, float* lo)
+{
+	float mn = n > 0 ? x[0] : 0.f, mx = mn;
+	bool integral = true;
+
+	//no early exit so the loop vectorizes, NaN fails the integer test
+	for (size_t i = 0; i < n; ++i)
+	{
+		integral &= x[i] == floorf(x[i]);
+		mn = x[i] < mn ? x[i] : mn;
+		mx = x[i] > mx ? x[i] : mx;
+	}
+	*lo = mn;
+	return integral && mx - mn <= PACK4_LEVELS - 1;
+}
+
+size_t pack4_size(size_t n)
+{
+	return (n + 1) / 2;
+}
+
+static void pack4_scalar(const float* x, size_t i, size_t n, float lo, uint8_t* out)
+{
+	for (; i + 1 < n; i += 2) out[i / 2] = (uint8_t)((int)(x[i] - lo) | (int)(x[i + 1] - lo) << 4);
+	if (i < n) out[i / 2] = (uint8_t)(int)(x[i] - lo);
+}
+
+#if PACK_X86
+//16 floats to 8 bytes: after the conversion to int32 a shift of each 64 bit lane by 28 puts the odd element into
+//the high nibble of the even one, byte 0 and 8 of every 128 bit lane are then gathered in order by the shuffles
+__attribute__((target("avx2")))
+static size_t pack4_avx2(const float* x, size_t n, float lo, uint8_t* out)
+{
+	const __m256 vlo = _mm256_set1_ps(lo);
+	const __m256i first = _mm256_setr_epi8(0, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, 0, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m256i second = _mm256_setr_epi8(-1, -1, -1, -1, 0, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, 0, 8, -1, -1, -1, -1, -1, -1, -1, -1);
+	size_t i = 0;
+
+	for (; i + 16 <= n; i += 16)
+	{
+		__m256i a = _mm256_cvttps_epi32(_mm256_sub_ps(_mm256_loadu_ps(x + i), vlo));
+		__m256i b = _mm256_cvttps_epi32(_mm256_sub_ps(_mm256_loadu_ps(x + i + 8), vlo));
+		a = _mm256_or_si256(a, _mm256_srli_epi64(a, 28));
+		b = _mm256_or_si256(b, _mm256_srli_epi64(b, 28));
+		__m256i bytes = _mm256_or_si256(_mm256_shuffle_epi8(a, first), _mm256_shuffle_epi8(b, second));
+		__m128i packed = _mm_or_si128(_mm256_castsi256_si128(bytes), _mm256_extracti128_si256(bytes, 1));
+		_mm_storel_epi64((__m128i*)(out + i / 2), packed);
+	}
+	return i;
+}
+#endif
+
+void pack4(const float* x, size_t n, float lo, uint8_t* out)
+{
+	size_t i = 0;
+
+#if PACK_X86
+	if (__builtin_cpu_supports("avx2")) i = pack4_avx2(x, n, lo, out);
+#endif
+	pack4_scalar(x, i, n, lo, out);
+}
+
+//device pre-pass, false if any step fails so the caller can fall back to the full upload
+static bool unpack4_device(ocl_env* env, cl_program program, const kernel_params* p, cl_mem buf, const uint8_t* packed, size_t n, float lo)
+{
+	cl_int err;
+	int count = (int)n;
+	size_t global = pack4_size(n);
+	cl_mem in = clCreateBuffer(env->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, pack4_size(n), (void*)packed, &err);
+	if (err != CL_SUCCESS) return false;
+
+	cl_kernel kernel = clCreateKernel(program, "unpack4", &err);
+	if (err == CL_SUCCESS)
+	{
+		clSetKernelArg(kernel, 0, sizeof(cl_mem), &in);
+		clSetKernelArg(kernel, 1, sizeof(cl_mem), &buf);
+		clSetKernelArg(kernel, 2, sizeof(int), &count);
+		kernel_set_scalar(kernel, 3, p, lo);
+		err = clEnqueueNDRangeKernel(env->queue, kernel, 1, NULL, &global, NULL, 0, NULL, NULL);
+		if (err == CL_SUCCESS) err = clFinish(env->queue);
+		clReleaseKernel(kernel);
+	}
+	clReleaseMemObject(in);
+	if (err != CL_SUCCESS) printf("Packed upload failed, sending the full matrix. Error: %d\n", err);
+	return err == CL_SUCCESS;
+}
+
+size_t pack4_upload(ocl_env* env, cl_program program, const kernel_params* p, cl_mem buf, const float* x, size_t n)
+{
+	float lo;
+
+	if (pack4_range(x, n, &lo))
+	{
+		std::vector<uint8_t> packed(pack4_size(n));
+		pack4(x, n, lo, packed.data());
+		if (unpack4_device(env, program, p, buf, packed.data(), n, lo)) return packed.size();
+	}
+
+	size_t bytes = n * dtype_size(p->dtype);
+	void* typed = malloc(bytes);
+	to_dtype(p->dtype, x, typed, n);
+	clEnqueueWriteBuffer(env->queue, buf, CL_TRUE, 0, bytes, typed, 0, NULL, NULL);
+	free(typed);
+	return bytes;
+}
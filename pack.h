@@ -0,0 +1,26 @@
+// 4-bit packed transfer: matrices of small integers (init_mat gives 0..9) go to the device two elements per byte
+// and the unpack4 kernel of KernelSource widens them into the buffer the variants read, that is 8x fewer bytes
+// over the bus than float (4x than half and bf16, 16x than double)
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kernels.h"
+#include "ocl.h"
+
+#define PACK4_LEVELS 16 //distinct values a nibble holds, lo ... lo + 15
+
+//true if every element is an integer and they all lie in [lo, lo + PACK4_LEVELS - 1], lo is set to the minimum
+bool pack4_range(const float* x, size_t n, float* lo);
+
+//bytes of the packed form of n elements
+size_t pack4_size(size_t n);
+
+//stores x - lo two per byte, element 2i in the low and 2i + 1 in the high nibble of byte i, pack4_range must accept x
+void pack4(const float* x, size_t n, float lo, uint8_t* out);
+
+//uploads n elements of x into buf in the element type of p->dtype: packed and widened by unpack4 of program when
+//pack4_range accepts x, converted and written in full otherwise (or when the pre-pass fails), returns the bytes sent
+size_t pack4_upload(ocl_env* env, cl_program program, const kernel_params* p, cl_mem buf, const float* x, size_t n);
@@ -0,0 +1,60 @@
+#include "prebuilt.h"
+#include <string.h>
+
+#include <string>
+#include <thread>
+
+cl_program prebuilt_build(ocl_env* env, const char* source, const char* options, cl_int* err)
+{
+	char device[256] = "", driver[256] = "";
+
+	clGetDeviceInfo(env->device, CL_DEVICE_NAME, sizeof(device), device, NULL);
+	clGetDeviceInfo(env->device, CL_DRIVER_VERSION, sizeof(driver), driver, NULL);
+
+	// SPIR-V first, it does not depend on the driver version a binary was made with
+	const int order[] = { PREBUILT_SPIRV, PREBUILT_BINARY };
+	for (int f = 0; f < NUM_PREBUILT_FORMATS; ++f)
+		for (int i = 0; i < num_prebuilt_programs; ++i)
+		{
+			const prebuilt_program* e = &prebuilt_programs[i];
+			if (e->format != order[f] || strcmp(e->options, options) != 0) continue;
+			if (e->format == PREBUILT_BINARY && (strcmp(e->device, device) != 0 || strcmp(e->driver, driver) != 0)) continue;
+
+			cl_program program = e->format == PREBUILT_SPIRV ? ocl_build_il(env, e->data, e->size, options, err)
+				: ocl_build_binary(env, e->data, e->size, options, err);
+			if (program != NULL) return program;
+		}
+
+	return ocl_build(env, source, options, err);
+}
+
+//clBuildProgram with a notify callback still blocks on several runtimes, a thread of our own overlaps on all of them
+struct prebuilt_job
+{
+	std::thread worker;
+	std::string options;
+	cl_program program;
+	cl_int err;
+};
+
+prebuilt_job* prebuilt_build_async(ocl_env* env, const char* source, const char* options)
+{
+	prebuilt_job* job = new prebuilt_job();
+
+	job->options = options;
+	job->program = NULL;
+	job->err = CL_SUCCESS;
+	job->worker = std::thread([job, env, source]() { job->program = prebuilt_build(env, source, job->options.c_str(), &job->err); });
+
+	return job;
+}
+
+cl_program prebuilt_build_wait(prebuilt_job* job, cl_int* err)
+{
+	job->worker.join();
+	cl_program program = job->program;
+	*err = job->err;
+	delete job;
+
+	return program;
+}
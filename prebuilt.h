@@ -0,0 +1,46 @@
+// kernel programs compiled ahead of time and embedded into the binary, so a process does not compile KernelSource
+// for the shapes it was built for; the table lives in prebuilt_data.cpp, which kernelc (kernelc.cpp) writes:
+// g++ kernelc.cpp ocl.cpp kernels.cpp precision.cpp -o kernelc -lOpenCL
+// ./kernelc --size 1000 --size 512x256x128 --dtype float --dtype half -o prebuilt_data.cpp
+// and rebuild the driver or the library with it, the checked in prebuilt_data.cpp is empty so everything builds
+// from source as before; entries are found by the exact build options of kernel_build_options
+
+#pragma once
+
+#include "CL/cl.h"
+#include <stddef.h>
+
+#include "ocl.h"
+
+enum prebuilt_format
+{
+	PREBUILT_BINARY,    //device binary of the runtime compiler, only loaded on the same device and driver
+	PREBUILT_SPIRV,     //SPIR-V module, loaded with clCreateProgramWithIL on any device that takes SPIR-V
+	NUM_PREBUILT_FORMATS
+};
+
+struct prebuilt_program
+{
+	const char* options;        //kernel_build_options of the program
+	int format;                 //PREBUILT_*
+	const char* device;         //CL_DEVICE_NAME and CL_DRIVER_VERSION the binary was built with, "" for SPIR-V
+	const char* driver;
+	const unsigned char* data;
+	size_t size;
+};
+
+extern const prebuilt_program prebuilt_programs[];
+extern const int num_prebuilt_programs;
+
+//the program of source built with options: from an embedded SPIR-V module if the device takes SPIR-V, from an
+//embedded binary of this device and driver otherwise, and compiled from source if neither is there or loads
+cl_program prebuilt_build(ocl_env* env, const char* source, const char* options, cl_int* err);
+
+struct prebuilt_job;
+
+//starts prebuilt_build on a thread of its own, so the caller can prepare its data while the program compiles,
+//source is kept by pointer (KernelSource lives for the whole process), options are copied
+prebuilt_job* prebuilt_build_async(ocl_env* env, const char* source, const char* options);
+
+//waits for the build of the job and frees it, returns the program or NULL with err set as prebuilt_build
+cl_program prebuilt_build_wait(prebuilt_job* job, cl_int* err);
@@ -0,0 +1,8 @@
+// written by kernelc, 0 programs, everything is built from source
+#include "prebuilt.h"
+
+const prebuilt_program prebuilt_programs[] =
+{
+	{ "", PREBUILT_BINARY, "", "", NULL, 0 } //end of the table, not counted
+};
+const int num_prebuilt_programs = 0;
@@ -0,0 +1,155 @@
+#include "precision.h"
+#include <string.h>
+
+static uint32_t float_bits(float f)
+{
+	uint32_t u;
+	memcpy(&u, &f, sizeof(u));
+	return u;
+}
+
+static float bits_float(uint32_t u)
+{
+	float f;
+	memcpy(&f, &u, sizeof(f));
+	return f;
+}
+
+half_t float_to_half(float f)
+{
+	uint32_t u = float_bits(f);
+	uint16_t sign = (uint16_t)((u >> 16) & 0x8000);
+	uint32_t abs = u & 0x7fffffff;
+	half_t h;
+
+	if (abs > 0x7f800000) h.bits = sign | 0x7e00;                      //NaN
+	else if (abs >= 0x477ff000) h.bits = sign | 0x7c00;                //rounds to beyond 65504, infinity
+	else if (abs < 0x38800000)                                         //below the smallest normal half, 2^-14
+	{
+		//subnormal: the mantissa with its implicit bit shifted into place, rounded to nearest even
+		int shift = 126 - (int)(abs >> 23);                            //14 - exponent + 13 bits of mantissa dropped
+		if (shift > 24) h.bits = sign;
+		else
+		{
+			uint32_t m = (abs & 0x7fffff) | 0x800000;
+			uint32_t half_ulp = 1u << (shift - 1);
+			uint32_t r = (m + half_ulp - 1 + ((m >> shift) & 1)) >> shift;
+			h.bits = sign | (uint16_t)r;
+		}
+	}
+	else
+	{
+		uint32_t r = abs + 0xfff + ((abs >> 13) & 1);                  //round to nearest even at bit 13
+		h.bits = sign | (uint16_t)((r - 0x38000000) >> 13);            //rebias the exponent from 127 to 15
+	}
+	return h;
+}
+
+static float widen_half(uint16_t bits)
+{
+	uint32_t sign = (uint32_t)(bits & 0x8000) << 16;
+	uint32_t exp = (bits >> 10) & 0x1f, mant = bits & 0x3ff;
+
+	if (exp == 0x1f) return bits_float(sign | 0x7f800000 | (mant << 13)); //infinity and NaN
+	if (exp == 0)
+	{
+		if (mant == 0) return bits_float(sign);
+		float f = mant * (1.f / 16777216.f);                          //subnormal: mant * 2^-24
+		return sign ? -f : f;
+	}
+	return bits_float(sign | ((exp + 112) << 23) | (mant << 13));
+}
+
+//there are only 65536 halves, the host products widen every operand they read so a table pays off
+struct half_table
+{
+	float value[65536];
+	half_table() { for (uint32_t h = 0; h < 65536; ++h) value[h] = widen_half((uint16_t)h); }
+};
+
+float half_to_float(half_t h)
+{
+	static const half_table table;
+	return table.value[h.bits];
+}
+
+bf16_t float_to_bf16(float f)
+{
+	uint32_t u = float_bits(f);
+	bf16_t b;
+
+	if ((u & 0x7fffffff) > 0x7f800000) b.bits = (uint16_t)((u >> 16) | 0x40); //keep NaN a quiet NaN
+	else b.bits = (uint16_t)((u + 0x7fff + ((u >> 16) & 1)) >> 16);
+	return b;
+}
+
+float bf16_to_float(bf16_t b)
+{
+	return bits_float((uint32_t)b.bits << 16);
+}
+
+static const char* names[NUM_DTYPES] = { "float", "double", "half", "bf16" };
+
+const char* dtype_name(int dtype)
+{
+	return dtype >= 0 && dtype < NUM_DTYPES ? names[dtype] : "unknown";
+}
+
+int dtype_from_name(const char* name)
+{
+	for (int d = 0; d < NUM_DTYPES; ++d)
+		if (strcmp(names[d], name) == 0) return d;
+
+	return -1;
+}
+
+size_t dtype_size(int dtype)
+{
+	switch (dtype)
+	{
+	case DTYPE_DOUBLE: return sizeof(double);
+	case DTYPE_HALF: return sizeof(half_t);
+	case DTYPE_BF16: return sizeof(bf16_t);
+	default: return sizeof(float);
+	}
+}
+
+size_t dtype_acc_size(int dtype)
+{
+	return dtype == DTYPE_DOUBLE ? sizeof(double) : sizeof(float);
+}
+
+double dtype_epsilon(int dtype)
+{
+	switch (dtype)
+	{
+	case DTYPE_DOUBLE: return 2.220446049250313e-16;
+	case DTYPE_HALF: return 9.765625e-4;    //2^-10
+	case DTYPE_BF16: return 7.8125e-3;      //2^-7
+	default: return 1.1920929e-7;
+	}
+}
+
+void to_dtype(int dtype, const float* src, void* dst, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		switch (dtype)
+		{
+		case DTYPE_DOUBLE: ((double*)dst)[i] = src[i]; break;
+		case DTYPE_HALF: ((half_t*)dst)[i] = float_to_half(src[i]); break;
+		case DTYPE_BF16: ((bf16_t*)dst)[i] = float_to_bf16(src[i]); break;
+		default: ((float*)dst)[i] = src[i]; break;
+		}
+}
+
+void from_dtype(int dtype, const void* src, float* dst, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		switch (dtype)
+		{
+		case DTYPE_DOUBLE: dst[i] = (float)((const double*)src)[i]; break;
+		case DTYPE_HALF: dst[i] = half_to_float(((const half_t*)src)[i]); break;
+		case DTYPE_BF16: dst[i] = bf16_to_float(((const bf16_t*)src)[i]); break;
+		default: dst[i] = ((const float*)src)[i]; break;
+		}
+}
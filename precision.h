@@ -0,0 +1,60 @@
+// element types of the products: float and double compute in their own precision, half (IEEE fp16) and
+// bfloat16 are storage formats whose values are widened to float for the arithmetic and rounded back on store
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+//the values are those of DTYPE in KernelSource
+enum dtype
+{
+	DTYPE_FLOAT,
+	DTYPE_DOUBLE,   //needs cl_khr_fp64 on the device
+	DTYPE_HALF,
+	DTYPE_BF16,
+	NUM_DTYPES
+};
+
+struct half_t { uint16_t bits; };
+struct bf16_t { uint16_t bits; };
+
+//both round to nearest even, overflow goes to infinity
+half_t float_to_half(float f);
+float half_to_float(half_t h);
+bf16_t float_to_bf16(float f);
+float bf16_to_float(bf16_t b);
+
+//element type T and the type acc the arithmetic is done in, load widens and store rounds
+template <typename T> struct precision
+{
+	typedef T acc;
+	static acc load(T x) { return x; }
+	static T store(acc x) { return x; }
+};
+
+template <> struct precision<half_t>
+{
+	typedef float acc;
+	static float load(half_t x) { return half_to_float(x); }
+	static half_t store(float x) { return float_to_half(x); }
+};
+
+template <> struct precision<bf16_t>
+{
+	typedef float acc;
+	static float load(bf16_t x) { return bf16_to_float(x); }
+	static bf16_t store(float x) { return float_to_bf16(x); }
+};
+
+//"float", "double", "half", "bf16", dtype_from_name returns -1 for anything else
+const char* dtype_name(int dtype);
+int dtype_from_name(const char* name);
+
+size_t dtype_size(int dtype);       //bytes per stored element
+size_t dtype_acc_size(int dtype);   //bytes per element of the arithmetic type
+double dtype_epsilon(int dtype);    //distance from 1 to the next stored value
+
+//converts n floats into the stored format of dtype and back
+void to_dtype(int dtype, const float* src, void* dst, size_t n);
+void from_dtype(int dtype, const void* src, float* dst, size_t n);
@@ -0,0 +1,204 @@
+#include "service.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <atomic>
+
+#include "precision.h"
+
+const char* service_status_name(int status)
+{
+	static const char* names[NUM_SERVICE_STATUSES] = { "ok", "bad request", "no shared memory", "failed" };
+
+	return status >= 0 && status < NUM_SERVICE_STATUSES ? names[status] : "unknown";
+}
+
+const char* service_priority_name(int priority)
+{
+	static const char* names[NUM_SERVICE_PRIORITIES] = { "high", "low" };
+
+	return priority >= 0 && priority < NUM_SERVICE_PRIORITIES ? names[priority] : "unknown";
+}
+
+static uint64_t align_up(uint64_t x)
+{
+	return (x + SERVICE_ALIGN - 1) / SERVICE_ALIGN * SERVICE_ALIGN;
+}
+
+size_t service_layout(service_request* r, int dtype, int m, int n, int k, int transa, int transb, double alpha, double beta)
+{
+	uint64_t es = dtype_size(dtype);
+
+	memset(r, 0, sizeof(*r));
+	r->magic = SERVICE_MAGIC;
+	r->version = SERVICE_VERSION;
+	r->kind = SERVICE_GEMM;
+	r->priority = SERVICE_PRIORITY_HIGH;
+	r->dtype = (uint32_t)dtype;
+	r->transa = transa;
+	r->transb = transb;
+	r->m = m;
+	r->n = n;
+	r->k = k;
+	r->alpha = alpha;
+	r->beta = beta;
+	r->a_offset = 0;
+	r->b_offset = align_up(r->a_offset + (uint64_t)m * k * es);
+	r->c_offset = align_up(r->b_offset + (uint64_t)k * n * es);
+	r->shm_bytes = r->c_offset + (uint64_t)m * n * es;
+
+	return (size_t)r->shm_bytes;
+}
+
+bool service_shm_create(service_shm* s, size_t bytes)
+{
+	static std::atomic<unsigned> counter(0);
+
+	memset(s, 0, sizeof(*s));
+	snprintf(s->name, sizeof(s->name), "/pvs_gemm.%d.%u", (int)getpid(), counter++);
+	int fd = shm_open(s->name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0)
+	{
+		printf("Unable to create shared memory %s: %s\n", s->name, strerror(errno));
+		return false;
+	}
+	if (ftruncate(fd, (off_t)bytes) != 0)
+	{
+		printf("Unable to size shared memory %s to %zu bytes\n", s->name, bytes);
+		close(fd);
+		shm_unlink(s->name);
+		return false;
+	}
+
+	s->data = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (s->data == MAP_FAILED)
+	{
+		printf("Unable to map shared memory %s\n", s->name);
+		shm_unlink(s->name);
+		s->data = NULL;
+		return false;
+	}
+	s->bytes = bytes;
+	return true;
+}
+
+void service_shm_destroy(service_shm* s)
+{
+	if (s->data != NULL)
+	{
+		munmap(s->data, s->bytes);
+		shm_unlink(s->name);
+	}
+	memset(s, 0, sizeof(*s));
+}
+
+static bool socket_address(const char* path, sockaddr_un* addr)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr->sun_path))
+	{
+		printf("Socket path %s is too long\n", path);
+		return false;
+	}
+	strcpy(addr->sun_path, path);
+	return true;
+}
+
+int service_connect(const char* path)
+{
+	sockaddr_un addr;
+
+	if (!socket_address(path, &addr)) return -1;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0)
+	{
+		printf("No GEMM daemon at %s: %s\n", path, strerror(errno));
+		if (fd >= 0) close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+bool service_send(int fd, const void* data, size_t bytes)
+{
+	const char* p = (const char*)data;
+
+	while (bytes > 0)
+	{
+		// no SIGPIPE if the other side is gone, the caller sees false
+		ssize_t sent = send(fd, p, bytes, MSG_NOSIGNAL);
+		if (sent < 0 && errno == EINTR) continue;
+		if (sent <= 0) return false;
+		p += sent;
+		bytes -= (size_t)sent;
+	}
+	return true;
+}
+
+bool service_recv(int fd, void* data, size_t bytes)
+{
+	char* p = (char*)data;
+
+	while (bytes > 0)
+	{
+		ssize_t got = recv(fd, p, bytes, 0);
+		if (got < 0 && errno == EINTR) continue;
+		if (got <= 0) return false;
+		p += got;
+		bytes -= (size_t)got;
+	}
+	return true;
+}
+
+bool service_submit(int fd, const service_request* r, service_reply* reply)
+{
+	if (!service_send(fd, r, sizeof(*r)) || !service_recv(fd, reply, sizeof(*reply))) return false;
+	return reply->magic == SERVICE_MAGIC;
+}
+
+bool service_query_stats(int fd, service_stats* stats)
+{
+	service_request r;
+
+	memset(&r, 0, sizeof(r));
+	r.magic = SERVICE_MAGIC;
+	r.version = SERVICE_VERSION;
+	r.kind = SERVICE_STATS;
+	if (!service_send(fd, &r, sizeof(r)) || !service_recv(fd, stats, sizeof(*stats))) return false;
+	return stats->magic == SERVICE_MAGIC;
+}
+
+int service_listen(const char* path)
+{
+	sockaddr_un addr;
+	struct stat st;
+
+	if (!socket_address(path, &addr)) return -1;
+	// only a socket left by an earlier daemon is removed, never a file that happens to be at path
+	if (lstat(path, &st) == 0)
+	{
+		if (!S_ISSOCK(st.st_mode))
+		{
+			printf("%s exists and is not a socket, not listening there\n", path);
+			return -1;
+		}
+		unlink(path);
+	}
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0)
+	{
+		printf("Unable to listen at %s: %s\n", path, strerror(errno));
+		if (fd >= 0) close(fd);
+		return -1;
+	}
+	return fd;
+}
@@ -0,0 +1,121 @@
+// protocol of the GEMM daemon (gemmd.cpp) and its client side: a client puts A, B and C into a POSIX shared memory
+// object, sends one fixed size service_request over the Unix domain socket of the daemon and reads one
+// service_reply back, by then C in the shared memory holds alpha * op(A) * op(B) + beta * C
+// the matrices are row major and dense as stored (A k x m for transa, B n x k for transb) at the offsets of the
+// request, service_layout places them, requests on one connection are answered in order
+// a request of kind SERVICE_STATS carries no product and is answered with service_stats instead, the latency
+// percentiles of each priority class
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SERVICE_SOCKET   "/tmp/pvs_gemmd.sock" //default path of the socket
+#define SERVICE_MAGIC    0x47535650u           //"PVSG" in the first four bytes of every message
+#define SERVICE_VERSION  2
+#define SERVICE_NAME_LEN 64                    //of a shared memory name, with the terminating 0
+#define SERVICE_ALIGN    4096                  //the matrices start at multiples of this in the shared memory
+
+enum service_status
+{
+	SERVICE_OK,
+	SERVICE_BAD_REQUEST,    //magic, version, element type or sizes
+	SERVICE_NO_SHM,         //the shared memory cannot be opened or is smaller than the matrices need
+	SERVICE_FAILED,         //the product itself failed
+	NUM_SERVICE_STATUSES
+};
+
+enum service_kind
+{
+	SERVICE_GEMM,
+	SERVICE_STATS,
+	NUM_SERVICE_KINDS
+};
+
+//latency sensitive jobs go before bulk ones, large jobs of either class run in slices with other jobs in between
+enum service_priority
+{
+	SERVICE_PRIORITY_HIGH,
+	SERVICE_PRIORITY_LOW,
+	NUM_SERVICE_PRIORITIES
+};
+
+struct service_request
+{
+	uint32_t magic, version;
+	uint32_t kind;                  //SERVICE_GEMM or SERVICE_STATS
+	uint32_t priority;              //SERVICE_PRIORITY_*
+	uint32_t dtype;                 //DTYPE_* of precision.h
+	int32_t transa, transb;
+	int32_t m, n, k;
+	double alpha, beta;
+	uint64_t a_offset, b_offset, c_offset;
+	uint64_t shm_bytes;             //the matrices need this much of the shared memory
+	char shm[SERVICE_NAME_LEN];     //name for shm_open, starting with '/'
+};
+
+struct service_reply
+{
+	uint32_t magic;
+	int32_t status;                 //SERVICE_*
+	int32_t device;                 //1 if the OpenCL device ran it, 0 for the host backend
+	int32_t batch;                  //jobs of the launch it ran in, more than 1 when the daemon coalesced it with others
+	int32_t slices;                 //launches a large job was cut into, 1 otherwise
+	uint32_t reserved;
+	double queue_ms;                //from the arrival of the request to the start of the product
+	double run_ms;                  //of the product (all slices), with transfers and a build of a shape not seen before
+};
+
+//over the last jobs of a class, from the arrival of the request to the reply
+struct service_class_stats
+{
+	uint64_t jobs;                  //since the daemon started
+	uint64_t samples;               //jobs the percentiles are taken over
+	double p50_ms, p90_ms, p99_ms, max_ms;
+};
+
+struct service_stats
+{
+	uint32_t magic;
+	int32_t status;
+	service_class_stats classes[NUM_SERVICE_PRIORITIES];
+};
+
+struct service_shm
+{
+	char name[SERVICE_NAME_LEN];
+	void* data;
+	size_t bytes;
+};
+
+const char* service_status_name(int status);
+const char* service_priority_name(int priority);
+
+//fills the request for a high priority product of that shape and places A, B and C one after the other, returns the
+//shared memory bytes they need, the name of the shared memory is left to the caller
+size_t service_layout(service_request* r, int dtype, int m, int n, int k, int transa, int transb, double alpha, double beta);
+
+//a new shared memory object of a name unique to this process, mapped read and write
+//prints the reason and returns false on failure
+bool service_shm_create(service_shm* s, size_t bytes);
+
+//unmaps and removes it
+void service_shm_destroy(service_shm* s);
+
+//the connected socket, -1 with the reason printed if no daemon listens at path
+int service_connect(const char* path);
+
+//sends the request and waits for the reply, false if the connection broke
+bool service_submit(int fd, const service_request* r, service_reply* reply);
+
+//asks for the latency percentiles, false if the connection broke
+bool service_query_stats(int fd, service_stats* stats);
+
+//whole messages over a socket, false on end of file or error, shared by the daemon and the client
+bool service_send(int fd, const void* data, size_t bytes);
+bool service_recv(int fd, void* data, size_t bytes);
+
+//a listening socket at path, an old socket there is removed first, any other file makes it fail
+//-1 with the reason printed on failure
+int service_listen(const char* path);
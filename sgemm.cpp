@@ -0,0 +1,338 @@
+#include "sgemm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <mutex>
+
+#include "host_gemm.h"
+#include "kernels.h"
+#include "launch.h"
+#include "ocl.h"
+#include "ooc.h"
+#include "prebuilt.h"
+
+//tuning of the kernels used by the library, the values the driver defaults to
+#define SGEMM_VEC   4
+#define SGEMM_TILE  16
+#define SGEMM_WPT   4
+
+//one built program per shape, with the kernel of the variant select_variant picks for it
+struct program_entry
+{
+	char options[512];
+	cl_program program;
+	cl_kernel kernel;
+	unsigned last_use;
+};
+
+//grow-only device buffer
+struct device_buffer
+{
+	cl_mem mem;
+	size_t size;
+};
+
+//everything below is guarded by lock, there is only one queue
+static std::mutex lock;
+static bool initialized = false, available = false;
+static ocl_env env;
+static program_entry programs[SGEMM_PROGRAM_CACHE];
+static unsigned use_counter = 0;
+static device_buffer buf_a, buf_b, buf_c;
+
+static void release_all(void)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	for (int e = 0; e < SGEMM_PROGRAM_CACHE; ++e)
+	{
+		if (programs[e].kernel != NULL) clReleaseKernel(programs[e].kernel);
+		if (programs[e].program != NULL) clReleaseProgram(programs[e].program);
+	}
+	memset(programs, 0, sizeof(programs));
+	if (buf_a.mem != NULL) clReleaseMemObject(buf_a.mem);
+	if (buf_b.mem != NULL) clReleaseMemObject(buf_b.mem);
+	if (buf_c.mem != NULL) clReleaseMemObject(buf_c.mem);
+	memset(&buf_a, 0, sizeof(buf_a)); memset(&buf_b, 0, sizeof(buf_b)); memset(&buf_c, 0, sizeof(buf_c));
+	if (available) ocl_release(&env);
+	available = false;
+}
+
+//when the library is unloaded (dlclose) or the process exits, an atexit handler would run after a dlclose unmapped it
+#ifndef _WIN32
+__attribute__((destructor)) static void unload(void)
+{
+	release_all();
+}
+#endif
+
+//first OpenCL call of the process, a missing device leaves the library on the host backend for good
+static bool opencl_available(void)
+{
+	if (!initialized)
+	{
+		initialized = true;
+		available = ocl_init(&env);
+#ifdef _WIN32
+		if (available) atexit(release_all);
+#endif
+	}
+	return available;
+}
+
+//cached program and kernel for the build options of p, the least recently used entry is rebuilt on a miss
+static cl_kernel find_kernel(const kernel_params* p, const kernel_variant* v)
+{
+	char options[512];
+	int victim = 0;
+	cl_int err;
+
+	kernel_build_options(p, options, sizeof(options));
+	for (int e = 0; e < SGEMM_PROGRAM_CACHE; ++e)
+	{
+		if (programs[e].program != NULL && strcmp(programs[e].options, options) == 0)
+		{
+			programs[e].last_use = ++use_counter;
+			return programs[e].kernel;
+		}
+		if (programs[e].last_use < programs[victim].last_use) victim = e;
+	}
+
+	program_entry* entry = &programs[victim];
+	if (entry->kernel != NULL) clReleaseKernel(entry->kernel);
+	if (entry->program != NULL) clReleaseProgram(entry->program);
+	memset(entry, 0, sizeof(*entry));
+
+	entry->program = prebuilt_build(&env, KernelSource, options, &err);
+	if (entry->program == NULL) return NULL;
+	entry->kernel = clCreateKernel(entry->program, v->entry, &err);
+	if (err != CL_SUCCESS)
+	{
+		printf("Error setting kernel %s. Error: %d\n", v->entry, err);
+		clReleaseProgram(entry->program);
+		entry->program = NULL;
+		return NULL;
+	}
+	snprintf(entry->options, sizeof(entry->options), "%s", options);
+	entry->last_use = ++use_counter;
+
+	return entry->kernel;
+}
+
+static bool reserve(device_buffer* buf, size_t size, cl_mem_flags flags)
+{
+	cl_int err;
+
+	if (buf->size >= size) return true;
+	if (buf->mem != NULL) clReleaseMemObject(buf->mem);
+	buf->mem = clCreateBuffer(env.context, flags, size, NULL, &err);
+	buf->size = buf->mem != NULL ? size : 0;
+	if (err != CL_SUCCESS)
+	{
+		printf("Unable to create buffer of %zu bytes. Error: %d\n", size, err);
+		return false;
+	}
+	return true;
+}
+
+//copies a rows x cols block with leading dimension ld into a buffer whose rows are buf_cols floats apart
+static cl_int write_rect(cl_mem buf, int buf_cols, const float* src, int ld, int rows, int cols)
+{
+	size_t origin[3] = { 0, 0, 0 }, region[3] = { cols * sizeof(float), (size_t)rows, 1 };
+	return clEnqueueWriteBufferRect(env.queue, buf, CL_FALSE, origin, origin, region, buf_cols * sizeof(float), 0,
+		ld * sizeof(float), 0, src, 0, NULL, NULL);
+}
+
+static cl_int read_rect(cl_mem buf, int buf_cols, float* dst, int ld, int rows, int cols)
+{
+	size_t origin[3] = { 0, 0, 0 }, region[3] = { cols * sizeof(float), (size_t)rows, 1 };
+	return clEnqueueReadBufferRect(env.queue, buf, CL_TRUE, origin, origin, region, buf_cols * sizeof(float), 0,
+		ld * sizeof(float), 0, dst, 0, NULL, NULL);
+}
+
+//row major product on the device, the rectangular transfers pack the leading dimensions into the (padded) layout
+//of the kernel on the way, false means the caller should use the host backend
+static bool opencl_gemm(bool transa, bool transb, int m, int n, int k, float alpha, const float* A, int lda,
+	const float* B, int ldb, float beta, float* C, int ldc)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	kernel_params p;
+	size_t global[MAX_WORK_DIM], local[MAX_WORK_DIM];
+	launch_plan plan;
+	cl_int err;
+
+	if (!opencl_available()) return false;
+	if (!kernel_params_init(&p, DTYPE_FLOAT, m, n, k, transa, transb, SGEMM_VEC, SGEMM_TILE, SGEMM_WPT, 1, 0)) return false;
+
+	//products whose buffers do not fit the device go through in blocks
+	ooc_blocks blocks;
+	if (!ooc_plan(&env, &p, 0, &blocks)) return false;
+	if (blocks.count_m * blocks.count_n * blocks.count_k > 1)
+	{
+		ooc_stats stats;
+		if (ooc_gemm(&env, &p, 0, alpha, A, lda, B, ldb, beta, C, ldc, &stats)) return true;
+		// the host backend would scale blocks that already hold the product, BLAS has no error to return instead
+		if (stats.c_written && beta != 0.f)
+		{
+			printf("The out-of-core product failed after it wrote blocks of C, C is left as it is\n");
+			return true;
+		}
+		return false;
+	}
+
+	const kernel_variant* v = select_variant(&p);
+	cl_kernel kernel = find_kernel(&p, v);
+	if (kernel == NULL) return false;
+
+	//stored shapes of A and B, and the shapes of the buffers the kernel expects
+	int a_rows = transa ? k : m, a_cols = transa ? m : k;
+	int b_rows = transb ? n : k, b_cols = transb ? k : n;
+	int abuf_rows = a_rows, abuf_cols = a_cols, bbuf_rows = b_rows, bbuf_cols = b_cols, cbuf_rows = m, cbuf_cols = n;
+	if (v->padded)
+	{
+		abuf_rows = transa ? p.kp : p.mp; abuf_cols = transa ? p.mp : p.kp;
+		bbuf_rows = transb ? p.np : p.kp; bbuf_cols = transb ? p.kp : p.np;
+		cbuf_rows = p.mp; cbuf_cols = p.np;
+	}
+	size_t a_size = (size_t)abuf_rows * abuf_cols * sizeof(float), b_size = (size_t)bbuf_rows * bbuf_cols * sizeof(float);
+	size_t c_size = (size_t)cbuf_rows * cbuf_cols * sizeof(float);
+	if (!reserve(&buf_a, a_size, CL_MEM_READ_ONLY) || !reserve(&buf_b, b_size, CL_MEM_READ_ONLY) ||
+		!reserve(&buf_c, c_size, CL_MEM_READ_WRITE))
+		return false;
+
+	//the padding has to be zero, the buffers may hold a larger product from an earlier call
+	if (v->padded)
+	{
+		float zero = 0.f;
+		clEnqueueFillBuffer(env.queue, buf_a.mem, &zero, sizeof(zero), 0, a_size, 0, NULL, NULL);
+		clEnqueueFillBuffer(env.queue, buf_b.mem, &zero, sizeof(zero), 0, b_size, 0, NULL, NULL);
+	}
+	err = write_rect(buf_a.mem, abuf_cols, A, lda, a_rows, a_cols);
+	if (err == CL_SUCCESS) err = write_rect(buf_b.mem, bbuf_cols, B, ldb, b_rows, b_cols);
+	if (err == CL_SUCCESS && beta != 0.f) err = write_rect(buf_c.mem, cbuf_cols, C, ldc, m, n);
+	if (err != CL_SUCCESS) printf("Unable to write operands. Error: %d\n", err);
+
+	if (err == CL_SUCCESS)
+	{
+		clSetKernelArg(kernel, 0, sizeof(cl_mem), &buf_a.mem);
+		clSetKernelArg(kernel, 1, sizeof(cl_mem), &buf_b.mem);
+		clSetKernelArg(kernel, 2, sizeof(cl_mem), &buf_c.mem);
+		kernel_set_scalar(kernel, 3, &p, alpha);
+		kernel_set_scalar(kernel, 4, &p, beta);
+		if (v->local_arg) clSetKernelArg(kernel, 5, v->local_mem(&p), NULL);
+		v->geometry(&p, global, local);
+		if (!launch_plan_init(&env, kernel, v->dim, global, local, &plan)) err = CL_INVALID_WORK_GROUP_SIZE;
+		else err = clEnqueueNDRangeKernel(env.queue, kernel, v->dim, NULL, plan.global, plan.local[0] ? plan.local : NULL, 0, NULL, NULL);
+		if (err != CL_SUCCESS) printf("Unable to launch kernel. Error: %d\n", err);
+	}
+	if (err == CL_SUCCESS)
+	{
+		err = read_rect(buf_c.mem, cbuf_cols, C, ldc, m, n);
+		if (err != CL_SUCCESS) printf("Unable to read result. Error: %d\n", err);
+	}
+
+	// the writes read A, B and C of the caller until they are done, the host backend then writes C and the next
+	// call reuses the buffers, so finish even after an error
+	if (err != CL_SUCCESS)
+	{
+		clFinish(env.queue);
+		return false;
+	}
+	return true;
+}
+
+static bool use_opencl(int m, int n, int k)
+{
+	const char* backend = getenv("SGEMM_BACKEND");
+
+	if (backend != NULL && strcmp(backend, "host") == 0) return false;
+	if (backend != NULL && strcmp(backend, "opencl") == 0) return true;
+
+	return 2.0 * m * n * k >= SGEMM_OPENCL_MIN_FLOPS;
+}
+
+//row major dispatch, the arguments are already checked
+static void gemm(bool transa, bool transb, int m, int n, int k, float alpha, const float* A, int lda,
+	const float* B, int ldb, float beta, float* C, int ldc)
+{
+	if (m == 0 || n == 0) return;
+
+	//alpha == 0 or k == 0 only scales C, A and B are not read then and may be NULL as in the reference BLAS,
+	//beta == 0 writes zeros even over NaN
+	if (alpha == 0.f || k == 0)
+	{
+		if (beta == 1.f) return;
+		for (int i = 0; i < m; ++i)
+			for (int j = 0; j < n; ++j) C[(size_t)i * ldc + j] = beta == 0.f ? 0.f : beta * C[(size_t)i * ldc + j];
+		return;
+	}
+
+	if (use_opencl(m, n, k) && opencl_gemm(transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc))
+		return;
+
+	host_gemm_blocked(transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, 0);
+}
+
+//reports the first invalid argument the way the reference BLAS xerbla does, positions are those of sgemm_
+static bool check_args(const char* name, bool trans_ok_a, bool trans_ok_b, int m, int n, int k, int lda, int ldb, int ldc,
+	int a_cols, int b_cols, int c_cols, int offset)
+{
+	int bad = 0;
+
+	if (!trans_ok_a) bad = 1;
+	else if (!trans_ok_b) bad = 2;
+	else if (m < 0) bad = 3;
+	else if (n < 0) bad = 4;
+	else if (k < 0) bad = 5;
+	else if (lda < (a_cols > 1 ? a_cols : 1)) bad = 8;
+	else if (ldb < (b_cols > 1 ? b_cols : 1)) bad = 10;
+	else if (ldc < (c_cols > 1 ? c_cols : 1)) bad = 13;
+
+	if (bad != 0) printf(" ** On entry to %s parameter number %d had an illegal value\n", name, bad + offset);
+	return bad == 0;
+}
+
+static bool parse_trans(char c, bool* trans)
+{
+	c = (char)(c & ~0x20); //upper case
+	*trans = c == 'T' || c == 'C';
+	return c == 'N' || c == 'T' || c == 'C';
+}
+
+//column major C = op(A) * op(B) is row major C^T = op(B)^T * op(A)^T, so the operands swap and the flags stay
+void sgemm_(const char* transa, const char* transb, const int* m, const int* n, const int* k,
+	const float* alpha, const float* A, const int* lda, const float* B, const int* ldb,
+	const float* beta, float* C, const int* ldc)
+{
+	bool ta, tb;
+	bool ok_a = parse_trans(*transa, &ta), ok_b = parse_trans(*transb, &tb);
+
+	//column major: the leading dimension bounds the number of rows
+	if (!check_args("SGEMM ", ok_a, ok_b, *m, *n, *k, *lda, *ldb, *ldc, ta ? *k : *m, tb ? *n : *k, *m, 0)) return;
+
+	gemm(tb, ta, *n, *m, *k, *alpha, B, *ldb, A, *lda, *beta, C, *ldc);
+}
+
+void cblas_sgemm(enum CBLAS_ORDER order, enum CBLAS_TRANSPOSE transa, enum CBLAS_TRANSPOSE transb,
+	int m, int n, int k, float alpha, const float* A, int lda, const float* B, int ldb,
+	float beta, float* C, int ldc)
+{
+	bool ta = transa != CblasNoTrans, tb = transb != CblasNoTrans;
+	bool ok_a = transa == CblasNoTrans || transa == CblasTrans || transa == CblasConjTrans;
+	bool ok_b = transb == CblasNoTrans || transb == CblasTrans || transb == CblasConjTrans;
+
+	if (order == CblasRowMajor)
+	{
+		//row major: the leading dimension bounds the number of columns
+		if (!check_args("cblas_sgemm", ok_a, ok_b, m, n, k, lda, ldb, ldc, ta ? m : k, tb ? k : n, n, 1)) return;
+		gemm(ta, tb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc);
+	}
+	else if (order == CblasColMajor)
+	{
+		if (!check_args("cblas_sgemm", ok_a, ok_b, m, n, k, lda, ldb, ldc, ta ? k : m, tb ? n : k, m, 1)) return;
+		gemm(tb, ta, n, m, k, alpha, B, ldb, A, lda, beta, C, ldc);
+	}
+	else
+		printf(" ** On entry to cblas_sgemm parameter number 1 had an illegal value\n");
+}
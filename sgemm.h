@@ -0,0 +1,32 @@
+// BLAS compatible entry points of the project, built as a shared library so existing binaries can link or
+// LD_PRELOAD it instead of their BLAS:
+// g++ -shared -fPIC -fvisibility=hidden -O2 sgemm.cpp ocl.cpp kernels.cpp launch.cpp ooc.cpp host_gemm.cpp precision.cpp prebuilt.cpp prebuilt_data.cpp -o libpvs_sgemm.so -lOpenCL -pthread
+// large products go to the OpenCL kernels (block by block if they do not fit the device, see ooc.h), small ones and
+// everything without an OpenCL device to the host backend, the environment variable SGEMM_BACKEND=host|opencl
+// forces one of them
+
+#pragma once
+
+#ifdef _WIN32
+#define SGEMM_EXPORT __declspec(dllexport)
+#else
+#define SGEMM_EXPORT __attribute__((visibility("default"))) //everything else is hidden by -fvisibility=hidden
+#endif
+
+#define SGEMM_OPENCL_MIN_FLOPS  (2.0 * 256 * 256 * 256) //smaller products are not worth the transfers and the build
+#define SGEMM_PROGRAM_CACHE     16                      //built programs kept, the sizes are build options so every shape needs one
+
+enum CBLAS_ORDER { CblasRowMajor = 101, CblasColMajor = 102 };
+enum CBLAS_TRANSPOSE { CblasNoTrans = 111, CblasTrans = 112, CblasConjTrans = 113 };
+
+extern "C"
+{
+	//Fortran BLAS, column major, transa and transb are 'N', 'T' or 'C' (no conjugate for real matrices)
+	SGEMM_EXPORT void sgemm_(const char* transa, const char* transb, const int* m, const int* n, const int* k,
+		const float* alpha, const float* A, const int* lda, const float* B, const int* ldb,
+		const float* beta, float* C, const int* ldc);
+
+	SGEMM_EXPORT void cblas_sgemm(enum CBLAS_ORDER order, enum CBLAS_TRANSPOSE transa, enum CBLAS_TRANSPOSE transb,
+		int m, int n, int k, float alpha, const float* A, int lda, const float* B, int ldb,
+		float beta, float* C, int ldc);
+}
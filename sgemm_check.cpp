@@ -0,0 +1,77 @@
+// compile in Linux with gcc, after building libpvs_sgemm.so as in sgemm.h:
+// g++ -O2 sgemm_check.cpp -L. -lpvs_sgemm -Wl,-rpath,. -o sgemm_check
+// checks the BLAS entry points against the reference semantics, the edge cases first: alpha == 0 and k == 0 only
+// scale C and must not read A or B (they may be NULL or hold NaN), beta == 0 overwrites C even where it is NaN
+// exits with 1 if a case fails
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sgemm.h"
+
+static int failures = 0;
+
+static void expect(const char* name, const float* C, const float* want, int count)
+{
+	bool ok = true;
+
+	for (int i = 0; i < count; ++i)
+		if (!(C[i] == want[i] || fabsf(C[i] - want[i]) <= 1e-4f * fabsf(want[i]))) ok = false;
+	printf("%-40s %s\n", name, ok ? "ok" : "FAILED");
+	if (!ok)
+	{
+		for (int i = 0; i < count; ++i) printf("  %g (expected %g)\n", C[i], want[i]);
+		++failures;
+	}
+}
+
+int main(void)
+{
+	float nan = NAN;
+	float A[4] = { nan, 1, 2, 3 }, B[4] = { 1, nan, 3, 4 };
+
+	//2 x 2, alpha 0, beta 2: C = 2 * C whatever A and B are
+	{
+		float C[4] = { 1, 2, 3, 4 }, want[4] = { 2, 4, 6, 8 };
+		cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, 2, 2, 2, 0.f, NULL, 2, NULL, 2, 2.f, C, 2);
+		expect("alpha 0, NULL A and B", C, want, 4);
+	}
+	{
+		float C[4] = { 1, 2, 3, 4 }, want[4] = { 2, 4, 6, 8 };
+		cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, 2, 2, 2, 0.f, A, 2, B, 2, 2.f, C, 2);
+		expect("alpha 0, NaN in A and B", C, want, 4);
+	}
+	{
+		float C[4] = { nan, 2, 3, 4 }, want[4] = { 0, 0, 0, 0 };
+		cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, 2, 2, 2, 0.f, NULL, 2, NULL, 2, 0.f, C, 2);
+		expect("alpha 0, beta 0 over NaN in C", C, want, 4);
+	}
+	{
+		float C[4] = { 1, 2, 3, 4 }, want[4] = { 3, 6, 9, 12 };
+		char n = 'N';
+		int two = 2, zero = 0;
+		float alpha = 1.f, beta = 3.f;
+		sgemm_(&n, &n, &two, &two, &zero, &alpha, NULL, &two, NULL, &two, &beta, C, &two);
+		expect("sgemm_ k 0, NULL A and B", C, want, 4);
+	}
+
+	//a plain product both ways: row major [1 2; 3 4] * [5 6; 7 8] = [19 22; 43 50]
+	{
+		float X[4] = { 1, 2, 3, 4 }, Y[4] = { 5, 6, 7, 8 }, C[4] = { 1, 1, 1, 1 }, want[4] = { 20, 23, 44, 51 };
+		cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, 2, 2, 2, 1.f, X, 2, Y, 2, 1.f, C, 2);
+		expect("row major, beta 1", C, want, 4);
+	}
+	{
+		//column major C^T = Y^T X^T, the same numbers transposed
+		float X[4] = { 1, 3, 2, 4 }, Y[4] = { 5, 7, 6, 8 }, C[4] = { 0, 0, 0, 0 }, want[4] = { 19, 43, 22, 50 };
+		char n = 'N';
+		int two = 2;
+		float alpha = 1.f, beta = 0.f;
+		sgemm_(&n, &n, &two, &two, &two, &alpha, X, &two, Y, &two, &beta, C, &two);
+		expect("column major sgemm_", C, want, 4);
+	}
+
+	printf("%d failed\n", failures);
+	return failures > 0 ? 1 : 0;
+}
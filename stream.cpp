@@ -0,0 +1,456 @@
+#include "stream.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "launch.h"
+#include "matfile.h"
+#include "matrix.h"
+#include "prebuilt.h"
+
+const char* stream_stage_names[5] = { "read", "upload", "compute", "download", "write" };
+
+enum { STAGE_READ, STAGE_UPLOAD, STAGE_COMPUTE, STAGE_DOWNLOAD, STAGE_WRITE };
+
+//a job on its way through the stages, made by the reader and freed by the writer
+struct stream_item
+{
+	int job;
+	matfile files[2];       //A and B, mapped until they are uploaded
+	const void* src[2];     //their elements in the element type of the stream, in the mapping or in owned
+	void* owned[2];
+	void* c;                //m x n result
+	int slot;               //device buffers, -1 before the upload
+	bool failed;
+};
+
+//lock free ring of one producer and one consumer, head and tail count the pushes and pops so far, a full (empty)
+//ring makes the producer (consumer) yield until the other side moves
+template <typename T, unsigned N>
+struct spsc_ring
+{
+	T items[N];
+	std::atomic<unsigned> head{ 0 }, tail{ 0 };
+};
+
+template <typename T, unsigned N>
+static void ring_push(spsc_ring<T, N>* r, T item)
+{
+	unsigned h = r->head.load(std::memory_order_relaxed);
+
+	while (h - r->tail.load(std::memory_order_acquire) == N) std::this_thread::yield();
+	r->items[h % N] = item;
+	r->head.store(h + 1, std::memory_order_release);
+}
+
+template <typename T, unsigned N>
+static T ring_pop(spsc_ring<T, N>* r)
+{
+	unsigned t = r->tail.load(std::memory_order_relaxed);
+
+	while (r->head.load(std::memory_order_acquire) == t) std::this_thread::yield();
+	T item = r->items[t % N];
+	r->tail.store(t + 1, std::memory_order_release);
+	return item;
+}
+
+struct stream_context
+{
+	ocl_env* env;
+	const kernel_params* p;
+	const kernel_variant* v;
+	const stream_job* jobs;
+	int count;
+	int a_rows, a_cols, b_rows, b_cols;     //as stored
+	int buf_cols[3];                        //row pitch of the device buffers of A, B and C in elements (padded or not)
+	cl_command_queue queues[3];             //upload, compute, download
+	cl_kernel kernel;
+	launch_plan plan;
+	cl_mem buffers[STREAM_SLOTS][3];
+
+	// a NULL item ends the stream, the download stage hands the slots back to the upload stage
+	spsc_ring<stream_item*, STREAM_QUEUE> read_to_upload, upload_to_compute, compute_to_download, download_to_write;
+	spsc_ring<int, STREAM_SLOTS> free_slots;
+
+	double busy_ms[5];                      //each written by its own stage only
+	int done, failed;                       //written by the writer
+};
+
+static double now_ms(void)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//an operand of the stream from its file: in place if it is stored as the stream needs it, else converted
+static bool load_operand(stream_context* s, stream_item* item, int which, const char* path, int rows, int cols)
+{
+	matfile* f = &item->files[which];
+
+	// verify reads every page, so the upload finds the mapping resident
+	if (!matfile_open(f, path, true)) return false;
+	if ((int)f->header.rows != rows || (int)f->header.cols != cols)
+	{
+		printf("%s: %d x %d instead of %d x %d\n", path, (int)f->header.rows, (int)f->header.cols, rows, cols);
+		return false;
+	}
+	if ((int)f->header.dtype == s->p->dtype && f->header.layout == MATFILE_ROW_MAJOR && (int)f->header.ld == cols)
+	{
+		item->src[which] = f->data;
+		return true;
+	}
+
+	float** X = matfile_to_mat(f);
+	item->owned[which] = malloc((size_t)rows * cols * dtype_size(s->p->dtype));
+	to_dtype(s->p->dtype, X[0], item->owned[which], (size_t)rows * cols);
+	free_mat(X, rows);
+	matfile_close(f);
+	item->src[which] = item->owned[which];
+	return true;
+}
+
+static void release_operands(stream_item* item)
+{
+	for (int i = 0; i < 2; ++i)
+	{
+		matfile_close(&item->files[i]);
+		free(item->owned[i]);
+		item->owned[i] = NULL;
+		item->src[i] = NULL;
+	}
+}
+
+static void read_stage(stream_context* s)
+{
+	size_t c_size = (size_t)s->p->m * s->p->n * dtype_size(s->p->dtype);
+
+	for (int j = 0; j < s->count; ++j)
+	{
+		double start = now_ms();
+		stream_item* item = (stream_item*)calloc(1, sizeof(stream_item));
+
+		item->job = j;
+		item->slot = -1;
+		if (load_operand(s, item, 0, s->jobs[j].a, s->a_rows, s->a_cols) && load_operand(s, item, 1, s->jobs[j].b, s->b_rows, s->b_cols))
+			item->c = malloc(c_size);
+		else
+		{
+			release_operands(item);
+			item->failed = true;
+		}
+		s->busy_ms[STAGE_READ] += now_ms() - start;
+		ring_push(&s->read_to_upload, item);
+	}
+	ring_push(&s->read_to_upload, (stream_item*)NULL);
+}
+
+//rows x cols elements with rows cols elements apart into the top left of a buffer whose rows are buf_cols apart
+static cl_int write_rect(cl_command_queue queue, cl_mem buf, int buf_cols, const void* src, int rows, int cols, size_t es)
+{
+	size_t origin[3] = { 0, 0, 0 }, region[3] = { cols * es, (size_t)rows, 1 };
+
+	return clEnqueueWriteBufferRect(queue, buf, CL_FALSE, origin, origin, region, buf_cols * es, 0, cols * es, 0,
+		src, 0, NULL, NULL);
+}
+
+static void upload_stage(stream_context* s)
+{
+	size_t es = dtype_size(s->p->dtype);
+	stream_item* item;
+
+	while ((item = ring_pop(&s->read_to_upload)) != NULL)
+	{
+		if (!item->failed)
+		{
+			item->slot = ring_pop(&s->free_slots);
+			double start = now_ms();
+			cl_mem* bufs = s->buffers[item->slot];
+			cl_int err = write_rect(s->queues[0], bufs[0], s->buf_cols[0], item->src[0], s->a_rows, s->a_cols, es);
+			if (err == CL_SUCCESS) err = write_rect(s->queues[0], bufs[1], s->buf_cols[1], item->src[1], s->b_rows, s->b_cols, es);
+			if (err == CL_SUCCESS) err = clFinish(s->queues[0]);
+			if (err != CL_SUCCESS)
+			{
+				printf("%s: upload failed. Error: %d\n", s->jobs[item->job].a, err);
+				item->failed = true;
+			}
+			release_operands(item);
+			s->busy_ms[STAGE_UPLOAD] += now_ms() - start;
+		}
+		ring_push(&s->upload_to_compute, item);
+	}
+	ring_push(&s->upload_to_compute, (stream_item*)NULL);
+}
+
+static void compute_stage(stream_context* s)
+{
+	stream_item* item;
+
+	while ((item = ring_pop(&s->upload_to_compute)) != NULL)
+	{
+		if (!item->failed)
+		{
+			double start = now_ms();
+			cl_mem* bufs = s->buffers[item->slot];
+			clSetKernelArg(s->kernel, 0, sizeof(cl_mem), &bufs[0]);
+			clSetKernelArg(s->kernel, 1, sizeof(cl_mem), &bufs[1]);
+			clSetKernelArg(s->kernel, 2, sizeof(cl_mem), &bufs[2]);
+			cl_int err = clEnqueueNDRangeKernel(s->queues[1], s->kernel, s->v->dim, NULL, s->plan.global,
+				s->plan.local[0] ? s->plan.local : NULL, 0, NULL, NULL);
+			if (err == CL_SUCCESS) err = clFinish(s->queues[1]);
+			if (err != CL_SUCCESS)
+			{
+				printf("%s: kernel failed. Error: %d\n", s->jobs[item->job].c, err);
+				item->failed = true;
+			}
+			s->busy_ms[STAGE_COMPUTE] += now_ms() - start;
+		}
+		ring_push(&s->compute_to_download, item);
+	}
+	ring_push(&s->compute_to_download, (stream_item*)NULL);
+}
+
+static void download_stage(stream_context* s)
+{
+	size_t es = dtype_size(s->p->dtype);
+	stream_item* item;
+
+	while ((item = ring_pop(&s->compute_to_download)) != NULL)
+	{
+		if (!item->failed)
+		{
+			double start = now_ms();
+			size_t origin[3] = { 0, 0, 0 }, region[3] = { s->p->n * es, (size_t)s->p->m, 1 };
+			cl_int err = clEnqueueReadBufferRect(s->queues[2], s->buffers[item->slot][2], CL_TRUE, origin, origin, region,
+				s->buf_cols[2] * es, 0, s->p->n * es, 0, item->c, 0, NULL, NULL);
+			if (err != CL_SUCCESS)
+			{
+				printf("%s: download failed. Error: %d\n", s->jobs[item->job].c, err);
+				item->failed = true;
+			}
+			s->busy_ms[STAGE_DOWNLOAD] += now_ms() - start;
+		}
+		if (item->slot >= 0) ring_push(&s->free_slots, item->slot);
+		ring_push(&s->download_to_write, item);
+	}
+	ring_push(&s->download_to_write, (stream_item*)NULL);
+}
+
+static void write_stage(stream_context* s)
+{
+	stream_item* item;
+
+	while ((item = ring_pop(&s->download_to_write)) != NULL)
+	{
+		double start = now_ms();
+
+		if (!item->failed && matfile_write(s->jobs[item->job].c, s->p->dtype, s->p->m, s->p->n, s->p->n, item->c)) ++s->done;
+		else ++s->failed;
+		free(item->c);
+		free(item);
+		s->busy_ms[STAGE_WRITE] += now_ms() - start;
+	}
+}
+
+bool stream_params(const stream_job* job, const kernel_params* tmpl, kernel_params* p)
+{
+	matfile a, b;
+
+	if (!matfile_open(&a, job->a, false)) return false;
+	if (!matfile_open(&b, job->b, false))
+	{
+		matfile_close(&a);
+		return false;
+	}
+
+	int a_rows = (int)a.header.rows, a_cols = (int)a.header.cols, b_rows = (int)b.header.rows, b_cols = (int)b.header.cols;
+	int m = tmpl->transa ? a_cols : a_rows, k = tmpl->transa ? a_rows : a_cols, n = tmpl->transb ? b_rows : b_cols;
+	matfile_close(&a);
+	matfile_close(&b);
+	if ((tmpl->transb ? b_cols : b_rows) != k)
+	{
+		printf("A (%d x %d) of %s and B (%d x %d) of %s do not fit\n", a_rows, a_cols, job->a, b_rows, b_cols, job->b);
+		return false;
+	}
+	return kernel_params_init(p, tmpl->dtype, m, n, k, tmpl->transa, tmpl->transb, tmpl->vec, tmpl->tile, tmpl->wpt, tmpl->pad, tmpl->stage_bt);
+}
+
+//queues, program, kernel and the buffers of every slot, the padding of padded buffers is cleared once and stays zero
+static bool stream_setup(stream_context* s, double alpha)
+{
+	const kernel_params* p = s->p;
+	size_t es = dtype_size(p->dtype), global[MAX_WORK_DIM], local[MAX_WORK_DIM];
+	char options[512];
+	cl_int err;
+
+	s->a_rows = p->transa ? p->k : p->m; s->a_cols = p->transa ? p->m : p->k;
+	s->b_rows = p->transb ? p->n : p->k; s->b_cols = p->transb ? p->k : p->n;
+	int buf_rows[3] = { s->a_rows, s->b_rows, p->m };
+	s->buf_cols[0] = s->a_cols; s->buf_cols[1] = s->b_cols; s->buf_cols[2] = p->n;
+	if (s->v->padded)
+	{
+		buf_rows[0] = p->transa ? p->kp : p->mp; s->buf_cols[0] = p->transa ? p->mp : p->kp;
+		buf_rows[1] = p->transb ? p->np : p->kp; s->buf_cols[1] = p->transb ? p->kp : p->np;
+		buf_rows[2] = p->mp; s->buf_cols[2] = p->np;
+	}
+
+	for (int q = 0; q < 3; ++q)
+	{
+		s->queues[q] = clCreateCommandQueue(s->env->context, s->env->device, 0, &err);
+		if (err != CL_SUCCESS)
+		{
+			printf("Unable to create a command queue. Error: %d\n", err);
+			return false;
+		}
+	}
+
+	kernel_build_options(p, options, sizeof(options));
+	cl_program program = prebuilt_build(s->env, KernelSource, options, &err);
+	if (program == NULL) return false;
+	s->kernel = clCreateKernel(program, s->v->entry, &err);
+	clReleaseProgram(program); //the kernel keeps it
+	if (err != CL_SUCCESS)
+	{
+		printf("Error setting kernel %s. Error: %d\n", s->v->entry, err);
+		s->kernel = NULL;
+		return false;
+	}
+
+	for (int slot = 0; slot < STREAM_SLOTS; ++slot)
+		for (int i = 0; i < 3; ++i)
+		{
+			size_t size = (size_t)buf_rows[i] * s->buf_cols[i] * es;
+			s->buffers[slot][i] = clCreateBuffer(s->env->context, i < 2 ? CL_MEM_READ_ONLY : CL_MEM_READ_WRITE, size, NULL, &err);
+			if (err == CL_SUCCESS && s->v->padded)
+			{
+				cl_uchar zero = 0;
+				err = clEnqueueFillBuffer(s->queues[0], s->buffers[slot][i], &zero, sizeof(zero), 0, size, 0, NULL, NULL);
+			}
+			if (err != CL_SUCCESS)
+			{
+				printf("Unable to create buffer of %zu bytes. Error: %d\n", size, err);
+				return false;
+			}
+		}
+	if (clFinish(s->queues[0]) != CL_SUCCESS) return false;
+
+	// alpha, beta and the local memory are the same for every job, only the buffers change
+	kernel_set_scalar(s->kernel, 3, p, alpha);
+	kernel_set_scalar(s->kernel, 4, p, 0.0);
+	if (s->v->local_arg) clSetKernelArg(s->kernel, 5, s->v->local_mem(p), NULL);
+	s->v->geometry(p, global, local);
+	return launch_plan_init(s->env, s->kernel, s->v->dim, global, local, &s->plan);
+}
+
+static void stream_release(stream_context* s)
+{
+	for (int slot = 0; slot < STREAM_SLOTS; ++slot)
+		for (int i = 0; i < 3; ++i)
+			if (s->buffers[slot][i] != NULL) clReleaseMemObject(s->buffers[slot][i]);
+	if (s->kernel != NULL) clReleaseKernel(s->kernel);
+	for (int q = 0; q < 3; ++q)
+		if (s->queues[q] != NULL) clReleaseCommandQueue(s->queues[q]);
+}
+
+bool stream_run(ocl_env* env, const kernel_params* p, double alpha, const stream_job* jobs, int count, stream_stats* stats)
+{
+	stream_context* s = new stream_context(); //value initialized, everything starts out 0 or NULL
+
+	memset(stats, 0, sizeof(*stats));
+	s->env = env;
+	s->p = p;
+	s->v = select_variant(p);
+	s->jobs = jobs;
+	s->count = count;
+	bool ok = stream_setup(s, alpha);
+	if (ok)
+	{
+		for (int slot = 0; slot < STREAM_SLOTS; ++slot) ring_push(&s->free_slots, slot);
+
+		double start = now_ms();
+		std::thread reader(read_stage, s), uploader(upload_stage, s), computer(compute_stage, s),
+			downloader(download_stage, s), writer(write_stage, s);
+		reader.join();
+		uploader.join();
+		computer.join();
+		downloader.join();
+		writer.join();
+		stats->wall_ms = now_ms() - start;
+
+		stats->done = s->done;
+		stats->failed = s->failed;
+		memcpy(stats->busy_ms, s->busy_ms, sizeof(stats->busy_ms));
+	}
+	stream_release(s);
+	delete s;
+
+	return ok;
+}
+
+int stream_read_list(const char* path, stream_job** jobs, char** text)
+{
+	FILE* f = fopen(path, "rb");
+	int count = 0, capacity = 16, line = 0;
+
+	*jobs = NULL;
+	*text = NULL;
+	if (f == NULL)
+	{
+		printf("Unable to open %s\n", path);
+		return -1;
+	}
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	*text = (char*)malloc(size + 1);
+	size = (long)fread(*text, 1, size, f);
+	(*text)[size] = '\0';
+	fclose(f);
+
+	*jobs = (stream_job*)malloc(capacity * sizeof(stream_job));
+	for (char* next = *text; next != NULL; )
+	{
+		char* cur = next;
+		next = strchr(cur, '\n');
+		if (next != NULL) *next++ = '\0';
+		++line;
+
+		char* hash = strchr(cur, '#');
+		if (hash != NULL) *hash = '\0';
+
+		// up to four words, so a fourth one shows up as an error
+		char* words[4];
+		int num_words = 0;
+		for (char* c = cur; *c != '\0' && num_words < 4; )
+		{
+			while (isspace((unsigned char)*c)) *c++ = '\0';
+			if (*c == '\0') break;
+			words[num_words++] = c;
+			while (*c != '\0' && !isspace((unsigned char)*c)) ++c;
+		}
+		if (num_words == 0) continue;
+		if (num_words != 3)
+		{
+			printf("%s:%d: expected <A file> <B file> <C file>\n", path, line);
+			free(*jobs);
+			free(*text);
+			*jobs = NULL;
+			*text = NULL;
+			return -1;
+		}
+
+		if (count == capacity)
+		{
+			capacity *= 2;
+			*jobs = (stream_job*)realloc(*jobs, capacity * sizeof(stream_job));
+		}
+		(*jobs)[count].a = words[0];
+		(*jobs)[count].b = words[1];
+		(*jobs)[count].c = words[2];
+		++count;
+	}
+	return count;
+}
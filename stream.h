@@ -0,0 +1,44 @@
+// streaming products: a list of jobs (two matrix files in, one out) runs through five stages on threads of their own,
+// reader (maps the files and converts them to the element type), upload, compute, download and writer, connected by
+// bounded single producer single consumer rings, so the disk, the bus and the device work on different jobs at once
+// STREAM_SLOTS sets of device buffers let the upload of one job, the kernel of the one before and the download of the
+// one before that overlap, every transfer stage has its own command queue
+// all jobs have the shape of the first one, one program serves the whole stream
+
+#pragma once
+
+#include "CL/cl.h"
+
+#include "kernels.h"
+#include "ocl.h"
+
+#define STREAM_SLOTS 3 //sets of device buffers (triple buffering)
+#define STREAM_QUEUE 4 //jobs a ring between two stages holds, the reader is at most this far ahead of the upload
+
+struct stream_job
+{
+	const char* a, *b;  //matfile.h files of A and B as stored (k x m for transa, n x k for transb)
+	const char* c;      //C = alpha * op(A) * op(B) is written there
+};
+
+struct stream_stats
+{
+	int done, failed;
+	double wall_ms;
+	double busy_ms[5];  //reader, upload, compute, download, writer, without the time spent waiting on the rings
+};
+
+//the stage names in the order of busy_ms
+extern const char* stream_stage_names[5];
+
+//reads jobs[0].a and jobs[0].b for the shape, fills p from it with the build parameters of tmpl (element type,
+//transposes, vec, tile, wpt, pad, stage_bt), prints the reason and returns false if the files do not fit together
+bool stream_params(const stream_job* job, const kernel_params* tmpl, kernel_params* p);
+
+//runs every job, a job that fails (file missing, other shape, device error) is counted and the stream goes on
+//returns false if the stream could not start (build, buffers, queues)
+bool stream_run(ocl_env* env, const kernel_params* p, double alpha, const stream_job* jobs, int count, stream_stats* stats);
+
+//reads a job list, one job per line: <A file> <B file> <C file>, empty lines and lines from # on are skipped
+//the jobs point into *text, free() both, returns the number of jobs or -1 if the list cannot be read
+int stream_read_list(const char* path, stream_job** jobs, char** text);